@@ -60,6 +60,10 @@ local function fannkuch(n)
     until false
 end
 
+local start = os.clock()
+
 local n = 9
 local sum, flips = fannkuch(n)
 io.write(sum, "\nfannkuchen(", n, ") = ", flips, "\n")
+
+io.write(string.format("elapsed: %g\n", os.clock() - start))
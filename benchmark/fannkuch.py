@@ -1,3 +1,5 @@
+import time
+
 def fannkuch(n):
     maxFlipsCount = 0
     permSign = True
@@ -41,6 +43,10 @@ def fannkuch(n):
                     return checksum, maxFlipsCount
             count[r] -= 1
 
+start = time.time()
+
 n = 9
 checksum, flips = fannkuch(n)
-print("%i\nfannkuchen(%i) = %i" % (checksum, n, flips))
\ No newline at end of file
+print("%i\nfannkuchen(%i) = %i" % (checksum, n, flips))
+
+print("elapsed: " + str(time.time() - start))
\ No newline at end of file
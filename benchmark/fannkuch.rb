@@ -55,6 +55,10 @@ def fannkuch(n)
     end
 end
 
+start = Time.now
+
 n = 9
 sum, flips = fannkuch(n)
-printf "%d\nPfannkuchen(%d) = %d\n", sum, n, flips
\ No newline at end of file
+printf "%d\nfannkuchen(%d) = %d\n", sum, n, flips
+
+puts "elapsed: " + (Time.now - start).to_s
\ No newline at end of file
@@ -0,0 +1,21 @@
+local parts = {}
+for i = 0, 2999 do
+    parts[#parts + 1] = tostring(i * 7919 % 10007)
+end
+local text = table.concat(parts)
+
+local start = os.clock()
+local total = 0
+
+for _, len in ipairs({4, 8, 16, 32, 64, 256}) do
+    for r = 0, 99 do
+        for i = 0, 1999 do
+            local s = string.sub(text, i + 1, i + len)
+            total = total + #s
+        end
+    end
+end
+
+io.write(total.."\n")
+
+io.write(string.format("elapsed: %g\n", os.clock() - start))
@@ -0,0 +1,24 @@
+from __future__ import print_function
+
+import time
+
+# Map "range" to an efficient range in both Python 2 and 3.
+try:
+    range = xrange
+except NameError:
+    pass
+
+text = "".join(str(i * 7919 % 10007) for i in range(0, 3000))
+
+start = time.process_time()
+total = 0
+
+for length in [4, 8, 16, 32, 64, 256]:
+    for r in range(0, 100):
+        for i in range(0, 2000):
+            s = text[i:i + length]
+            total += len(s)
+
+print(total)
+
+print("elapsed: " + str(time.process_time() - start))
@@ -0,0 +1,17 @@
+text = (0...3000).map {|i| (i * 7919 % 10007).to_s}.join
+
+start = Time.now
+total = 0
+
+[4, 8, 16, 32, 64, 256].each do |len|
+  100.times do
+    2000.times do |i|
+      s = text[i, len]
+      total += s.length
+    end
+  end
+end
+
+puts total
+
+puts "elapsed: " + (Time.now - start).to_s
@@ -15,6 +15,7 @@
 #include "tea_char.h"
 #include "tea_bcdump.h"
 #include "tea_buf.h"
+#include "tea_gc.h"
 #include "tea_str.h"
 #include "tea_lib.h"
 #include "tea_meta.h"
@@ -24,11 +25,19 @@ static void base_print(tea_State* T)
     int count = tea_get_top(T);
     for(int i = 0; i < count; i++)
     {
-        size_t len;
-        const char* str = tea_to_lstring(T, i, &len);
         if(i)
             putchar('\t');
 
+        cTValue* o = T->base + i;
+        if(tvisstr(o))
+        {
+            /* Write strings as they are, views need no copy */
+            GCstr* str = tea_str_flatten(T, strV(o));
+            fwrite(str_mem(str), sizeof(char), str->len, stdout);
+            continue;
+        }
+        size_t len;
+        const char* str = tea_to_lstring(T, i, &len);
         fwrite(str, sizeof(char), len, stdout);
         tea_pop(T, 1);
     }
@@ -42,7 +51,7 @@ static void base_input(tea_State* T)
     if(count != 0)
     {
         GCstr* str = tea_lib_checkstr(T, 0);
-        fwrite(str_data(str), sizeof(char), str->len, stdout);
+        fwrite(str_mem(str), sizeof(char), str->len, stdout);
     }
 
     size_t m = TEA_BUFFER_SIZE, n = 0, ok = 0;
@@ -100,7 +109,7 @@ static void base_tonumber(tea_State* T)
     }
     else
     {
-        const char* p = str_data(tea_lib_checkstr(T, 0));
+        const char* p = tea_str_data(T, tea_lib_checkstr(T, 0));
         char* ep;
         unsigned int neg = 0;
         unsigned long ul;
@@ -135,8 +144,38 @@ static void base_tostring(tea_State* T)
 
 static void base_gc(tea_State* T)
 {
-    int collected = tea_gc(T);
-    tea_push_number(T, collected);
+    static const int what[] = {
+        TEA_GCCOLLECT, TEA_GCCOUNT, TEA_GCSTEP, TEA_GCSETPAUSE,
+        TEA_GCSETSTEPMUL, TEA_GCGEN, TEA_GCINC
+    };
+    int opt = what[tea_lib_checkopt(T, 0, 0, "\7collect\5count\4step\10setpause\12setstepmul\14generational\13incremental")];
+    int32_t n = tea_lib_optint(T, 1, 0);
+    switch(opt)
+    {
+        case TEA_GCCOUNT:
+        {
+            int kb = tea_gc_control(T, TEA_GCCOUNT, 0);
+            int b = tea_gc_control(T, TEA_GCCOUNTB, 0);
+            tea_push_number(T, (double)kb + (double)b / 1024.0);
+            break;
+        }
+        case TEA_GCSTEP:
+            tea_push_bool(T, tea_gc_control(T, opt, n));
+            break;
+        case TEA_GCGEN:
+            tea_gc_control(T, TEA_GCSETMINORMUL, n);
+            tea_gc_control(T, TEA_GCSETMAJORMUL, tea_lib_optint(T, 2, 0));
+            /* fallthrough */
+        case TEA_GCINC:
+            if(tea_gc_control(T, opt, 0) == TEA_GCGEN)
+                tea_push_literal(T, "generational");
+            else
+                tea_push_literal(T, "incremental");
+            break;
+        default:
+            tea_push_number(T, tea_gc_control(T, opt, n));
+            break;
+    }
 }
 
 static void base_eval(tea_State* T)
@@ -169,7 +208,7 @@ static void base_dump(tea_State* T)
     {
         if(tvisstr(o))
         {
-            const char* mode = strVdata(o);
+            const char* mode = tea_str_data(T, strV(o));
             char c;
             while((c = *mode++))
             {
@@ -231,7 +270,7 @@ static void base_rawequal(tea_State* T)
 {
     cTValue* o1 = tea_lib_checkany(T, 0);
     cTValue* o2 = tea_lib_checkany(T, 1);
-    tea_push_bool(T, tea_obj_rawequal(o1, o2));
+    tea_push_bool(T, tea_obj_rawequal(T, o1, o2));
 }
 
 static void base_hasattr(tea_State* T)
@@ -308,7 +347,7 @@ static const tea_Reg globals[] = {
     { "typeof", base_typeof, 1, 0 },
     { "tonumber", base_tonumber, 1, 1 },
     { "tostring", base_tostring, 1, 0 },
-    { "gc", base_gc, 0, 0 },
+    { "gc", base_gc, 0, 3 },
     { "eval", base_eval, 1, 0 },
     { "dump", base_dump, 1, 1 },
     { "loadfile", base_loadfile, 1, 0 },
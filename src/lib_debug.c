@@ -14,6 +14,9 @@
 #include "tea_str.h"
 #include "tea_lib.h"
 #include "tea_debug.h"
+#include "tea_buf.h"
+#include "tea_err.h"
+#include "tea_prof.h"
 
 /* -- Reflection API for Teascript functions ------------------------------------ */
 
@@ -22,6 +25,11 @@ static void setintfield(tea_State* T, GCmap* m, const char* name, int32_t val)
     setintV(tea_map_setstr(T, m, tea_str_newlen(T, name)), val);
 }
 
+static void setnumfield(tea_State* T, GCmap* m, const char* name, double val)
+{
+    setnumV(tea_map_setstr(T, m, tea_str_newlen(T, name)), val);
+}
+
 static void debug_funcinfo(tea_State* T)
 {
     GCproto* pt = tea_lib_checkTproto(T, 0, false);
@@ -45,6 +53,9 @@ static void debug_funcinfo(tea_State* T)
         setintfield(T, m, "currentline", -1);
     }
     setintfield(T, m, "bytecodes", pt->sizebc);
+    setintfield(T, m, "icsites", pt->sizeic);
+    setnumfield(T, m, "ichits", pt->ichits);
+    setnumfield(T, m, "icmisses", pt->icmisses);
     tea_push_bool(T, (pt->flags & PROTO_CHILD));
     tea_set_key(T, -2, "children");
     tea_push_bool(T, (pt->flags & PROTO_VARARG));
@@ -97,6 +108,43 @@ static void debug_funcline(tea_State* T)
     setnumV(T->top++, tea_debug_line(pt, ofs));
 }
 
+/* -- Memory profiling ---------------------------------------------------- */
+
+static int writer_buf(tea_State* T, void* sb, const void* p, size_t size)
+{
+    tea_buf_putmem(T, (SBuf*)sb, p, size);
+    return 0;
+}
+
+static void debug_profstart(tea_State* T)
+{
+    int32_t interval = tea_lib_optint(T, 0, 0);
+    if(interval < 0)
+        tea_err_arg(T, 0, TEA_ERR_INTRANGE);
+    tea_prof_start(T, (size_t)interval);
+    tea_push_nil(T);
+}
+
+static void debug_profstop(tea_State* T)
+{
+    tea_prof_stop(T);
+    tea_push_nil(T);
+}
+
+static void debug_profdump(tea_State* T)
+{
+    SBuf* sb = tea_buf_tmp_(T);
+    tea_prof_dump(T, writer_buf, sb);
+    setstrV(T, T->top++, tea_buf_str(T, sb));
+}
+
+static void debug_heapsnapshot(tea_State* T)
+{
+    SBuf* sb = tea_buf_tmp_(T);
+    tea_prof_snapshot(T, writer_buf, sb);
+    setstrV(T, T->top++, tea_buf_str(T, sb));
+}
+
 /* ------------------------------------------------------------------------ */
 
 static const tea_Reg debug_module[] = {
@@ -105,6 +153,10 @@ static const tea_Reg debug_module[] = {
     { "funcbc", debug_funcbc, 2, 0 },
     { "funcuv", debug_funcuv, 2, 0 },
     { "funcline", debug_funcline, 2, 0 },
+    { "profstart", debug_profstart, 0, 1 },
+    { "profstop", debug_profstop, 0, 0 },
+    { "profdump", debug_profdump, 0, 0 },
+    { "heapsnapshot", debug_heapsnapshot, 0, 0 },
     { NULL, NULL }
 };
 
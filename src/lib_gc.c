@@ -0,0 +1,184 @@
+/*
+** lib_gc.c
+** Teascript gc module
+*/
+
+#define lib_gc_c
+#define TEA_LIB
+
+#include "tea.h"
+#include "tealib.h"
+
+#include "tea_obj.h"
+#include "tea_gc.h"
+#include "tea_udata.h"
+#include "tea_err.h"
+#include "tea_lib.h"
+
+static void gclib_collect(tea_State* T)
+{
+    tea_push_number(T, tea_gc_control(T, TEA_GCCOLLECT, 0));
+}
+
+static void gclib_count(tea_State* T)
+{
+    int kb = tea_gc_control(T, TEA_GCCOUNT, 0);
+    int b = tea_gc_control(T, TEA_GCCOUNTB, 0);
+    tea_push_number(T, (double)kb + (double)b / 1024.0);
+}
+
+static void gclib_step(tea_State* T)
+{
+    int kb = (int)tea_opt_integer(T, 0, 0);
+    tea_push_bool(T, tea_gc_control(T, TEA_GCSTEP, kb));
+}
+
+static void gclib_stop(tea_State* T)
+{
+    tea_gc_control(T, TEA_GCSTOP, 0);
+    tea_push_nil(T);
+}
+
+static void gclib_restart(tea_State* T)
+{
+    tea_gc_control(T, TEA_GCRESTART, 0);
+    tea_push_nil(T);
+}
+
+static void gclib_isrunning(tea_State* T)
+{
+    tea_push_bool(T, tea_gc_control(T, TEA_GCISRUNNING, 0));
+}
+
+static void gclib_setpause(tea_State* T)
+{
+    int pause = (int)tea_check_integer(T, 0);
+    tea_push_number(T, tea_gc_control(T, TEA_GCSETPAUSE, pause));
+}
+
+static void gclib_setstepmul(tea_State* T)
+{
+    int stepmul = (int)tea_check_integer(T, 0);
+    tea_push_number(T, tea_gc_control(T, TEA_GCSETSTEPMUL, stepmul));
+}
+
+/* Memory limits in Kbytes, 0 for none */
+static void gclib_setsoftlimit(tea_State* T)
+{
+    int kb = (int)tea_check_integer(T, 0);
+    tea_push_number(T, tea_gc_control(T, TEA_GCSETSOFTLIMIT, kb));
+}
+
+static void gclib_sethardlimit(tea_State* T)
+{
+    int kb = (int)tea_check_integer(T, 0);
+    tea_push_number(T, tea_gc_control(T, TEA_GCSETHARDLIMIT, kb));
+}
+
+static void gclib_pushmode(tea_State* T, int mode)
+{
+    if(mode == TEA_GCGEN)
+        tea_push_literal(T, "generational");
+    else
+        tea_push_literal(T, "incremental");
+}
+
+static void gclib_generational(tea_State* T)
+{
+    int minormul = (int)tea_opt_integer(T, 0, 0);
+    int majormul = (int)tea_opt_integer(T, 1, 0);
+    tea_gc_control(T, TEA_GCSETMINORMUL, minormul);
+    tea_gc_control(T, TEA_GCSETMAJORMUL, majormul);
+    gclib_pushmode(T, tea_gc_control(T, TEA_GCGEN, 0));
+}
+
+static void gclib_incremental(tea_State* T)
+{
+    gclib_pushmode(T, tea_gc_control(T, TEA_GCINC, 0));
+}
+
+static void stats_set(tea_State* T, const char* key, double value)
+{
+    tea_push_number(T, value);
+    tea_set_key(T, -2, key);
+}
+
+static void gclib_stats(tea_State* T)
+{
+    static const char* const names[] = {
+        "string", "range", "function", "module", "class",
+        "instance", "list", "map", "userdata"
+    };
+    tea_GCStats s;
+    tea_gc_stats(T, &s);
+    tea_new_map(T);
+    stats_set(T, "count", (double)s.count);
+    stats_set(T, "cycles", (double)s.cycles);
+    stats_set(T, "minors", (double)s.minors);
+    stats_set(T, "freed", (double)s.freed);
+    stats_set(T, "totalfreed", (double)s.totalfreed);
+    stats_set(T, "pausetime", s.pausetime);
+    stats_set(T, "strnum", (double)s.strnum);
+    stats_set(T, "strsize", (double)s.strsize);
+    stats_set(T, "large", (double)s.large);
+    tea_new_map(T);
+    for(int i = TEA_TYPE_STRING; i <= TEA_TYPE_USERDATA; i++)
+    {
+        stats_set(T, names[i - TEA_TYPE_STRING], (double)s.objects[i]);
+    }
+    tea_set_key(T, -2, "objects");
+}
+
+/* -- WeakRef class ------------------------------------------------------- */
+
+static void weakref_init(tea_State* T)
+{
+    tea_check_type(T, 0, TEA_TYPE_CLASS);
+    TValue* o = tea_lib_checkany(T, 1);
+    GCudata* ud = tea_udata_new(T, 0, 1);
+    ud->klass = classV(T->base);
+    ud->udtype = UDTYPE_WEAKREF;
+    copyTV(T, ud_uvalues(ud), o);
+    setudataV(T, T->top++, ud);
+    tea_gc_weak(T, obj2gco(ud));
+}
+
+static void weakref_get(tea_State* T)
+{
+    if(!(T->base < T->top && tvisudata(T->base) &&
+         udataV(T->base)->udtype == UDTYPE_WEAKREF))
+        tea_err_argtype(T, 0, "weakref");
+    copyTV(T, T->top++, ud_uvalues(udataV(T->base)));
+}
+
+/* ------------------------------------------------------------------------ */
+
+static const tea_Methods weakref_class[] = {
+    { "new", "method", weakref_init, 2, 0 },
+    { "get", "method", weakref_get, 1, 0 },
+    { NULL, NULL, NULL }
+};
+
+static const tea_Reg gc_module[] = {
+    { "collect", gclib_collect, 0, 0 },
+    { "count", gclib_count, 0, 0 },
+    { "step", gclib_step, 0, 1 },
+    { "stop", gclib_stop, 0, 0 },
+    { "restart", gclib_restart, 0, 0 },
+    { "isrunning", gclib_isrunning, 0, 0 },
+    { "setpause", gclib_setpause, 1, 0 },
+    { "setstepmul", gclib_setstepmul, 1, 0 },
+    { "setsoftlimit", gclib_setsoftlimit, 1, 0 },
+    { "sethardlimit", gclib_sethardlimit, 1, 0 },
+    { "generational", gclib_generational, 0, 2 },
+    { "incremental", gclib_incremental, 0, 0 },
+    { "stats", gclib_stats, 0, 0 },
+    { NULL, NULL }
+};
+
+TEAMOD_API void tea_import_gc(tea_State* T)
+{
+    tea_create_module(T, TEA_MODULE_GC, gc_module);
+    tea_create_class(T, "WeakRef", weakref_class);
+    tea_set_attr(T, 0, "WeakRef");
+}
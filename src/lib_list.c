@@ -595,6 +595,7 @@ void tea_open_list(tea_State* T)
 {
     tea_create_class(T, TEA_CLASS_LIST, list_reg);
     T->gcroot[GCROOT_KLLIST] = obj2gco(classV(T->top - 1));
+    tea_lib_setffid(T, classV(T->top - 1), MM_ITER, FF_ITER_LIST);
     tea_set_global(T, TEA_CLASS_LIST);
     tea_push_nil(T);
 }
\ No newline at end of file
@@ -52,7 +52,11 @@ static void map_values(tea_State* T)
 
 static void map_init(tea_State* T)
 {
+    static const uint8_t modes[] = { MAP_WEAKKEY, MAP_WEAKVAL, MAP_WEAKMODE, 0 };
+    int opt = tea_lib_checkopt(T, 1, 3, "\1k\1v\2kv");
     tea_new_map(T);
+    if(modes[opt])
+        tea_map_setweak(T, mapV(T->top - 1), modes[opt]);
 }
 
 static void map_get(tea_State* T)
@@ -60,7 +64,7 @@ static void map_get(tea_State* T)
     tea_opt_nil(T, 2);
     GCmap* map = tea_lib_checkmap(T, 0);
     TValue* key = T->base + 1;
-    cTValue* o = tea_map_get(map, key);
+    cTValue* o = tea_map_get(T, map, key);
     if(o)
     {
         copyTV(T, T->top++, o);
@@ -73,7 +77,7 @@ static void map_set(tea_State* T)
     GCmap* map = tea_lib_checkmap(T, 0);
     TValue* key = tea_lib_checkany(T, 1);
     TValue* value = T->base + 2;
-    cTValue* o = tea_map_get(map, key);
+    cTValue* o = tea_map_get(T, map, key);
     if(!o)
     {
         copyTV(T, tea_map_set(T, map, key), value);
@@ -102,7 +106,7 @@ static void map_contains(tea_State* T)
 {
     GCmap* map = tea_lib_checkmap(T, 0);
     TValue* o = tea_lib_checkany(T, 1);
-    tea_push_bool(T, tea_map_get(map, o) != NULL);
+    tea_push_bool(T, tea_map_get(T, map, o) != NULL);
 }
 
 static void map_delete(tea_State* T)
@@ -207,7 +211,7 @@ static const tea_Methods map_reg[] = {
     { "count", "getter", map_count, 1, 0 },
     { "keys", "getter", map_keys, 1, 0 },
     { "values", "getter", map_values, 1, 0 },
-    { "new", "method", map_init, 1, 0 },
+    { "new", "method", map_init, 1, 1 },
     { "get", "method", map_get, 2, 1 },
     { "set", "method", map_set, 2, 1 },
     { "update", "method", map_update, 2, 0 },
@@ -225,6 +229,7 @@ void tea_open_map(tea_State* T)
 {
     tea_create_class(T, TEA_CLASS_MAP, map_reg);
     T->gcroot[GCROOT_KLMAP] = obj2gco(classV(T->top - 1));
+    tea_lib_setffid(T, classV(T->top - 1), MM_ITER, FF_ITER_MAP);
     tea_set_global(T, TEA_CLASS_MAP);
     tea_push_nil(T);
 }
\ No newline at end of file
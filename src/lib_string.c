@@ -36,7 +36,7 @@ static void string_byte(tea_State* T)
     const unsigned char* p;
     if(idx < 0 && idx > s->len)
         tea_err_msg(T, TEA_ERR_IDXSTR);
-    p = (const unsigned char*)str_data(s);
+    p = (const unsigned char*)str_mem(s);
     tea_push_integer(T, p[idx]);
 }
 
@@ -46,7 +46,7 @@ static void string_upper(tea_State* T)
     SBuf* sb = tea_buf_tmp_(T);
     int len = str->len;
     char* w = tea_buf_more(T, sb, len), *e = w + len;
-    const char* q = str_data(str);
+    const char* q = str_mem(str);
     for(; w < e; w++, q++)
     {
         uint32_t c = *(unsigned char*)q;
@@ -62,7 +62,7 @@ static void string_lower(tea_State* T)
     SBuf* sb = tea_buf_tmp_(T);
     int len = str->len;
     char* w = tea_buf_more(T, sb, len), *e = w + len;
-    const char* q = str_data(str);
+    const char* q = str_mem(str);
     for(; w < e; w++, q++)
     {
         uint32_t c = *(unsigned char*)q;
@@ -78,19 +78,39 @@ static void string_reverse(tea_State* T)
     SBuf* sb = tea_buf_tmp_(T);
     uint32_t len = str->len;
     char* w = tea_buf_more(T, sb, len), *e = w + len;
-    const char* q = str_data(str) + len - 1;    
+    const char* q = str_mem(str) + len - 1;    
     while(w < e)
         *w++ = *q--;
     sb->w = w;
     setstrV(T, T->top++, tea_buf_str(T, sb));
 }
 
+/* Find a substring, the contents need not be terminated */
+static const char* string_search(const char* s, size_t len, const char* p, size_t plen)
+{
+    if(plen == 0)
+        return s;
+    if(plen > len)
+        return NULL;
+    const char* e = s + len - plen;
+    while(s <= e)
+    {
+        s = (const char*)memchr(s, p[0], e - s + 1);
+        if(s == NULL)
+            return NULL;
+        if(memcmp(s + 1, p + 1, plen - 1) == 0)
+            return s;
+        s++;
+    }
+    return NULL;
+}
+
 static void string_split(tea_State* T)
 {
     int count = tea_get_top(T);
 
-    size_t len;
-    char* str = (char*)tea_get_lstring(T, 0, &len);
+    GCstr* str = tea_lib_checkstr(T, 0);
+    size_t len = str->len;
 
     const char* sep = "";
     size_t sep_len = 0;
@@ -118,49 +138,40 @@ static void string_split(tea_State* T)
     tea_new_list(T, 0);
     int list_len = 0;
 
-    SBuf* sb = tea_buf_tmp_(T);
-
+    /* The parts are views of the string, so it is read with str_mem() */
     if(sep_len == 0)
     {
         int idx = 0;
         for(; idx < len && list_len < max_split; idx++)
         {
             list_len++;
-            tea_buf_reset(sb);
-            tea_buf_putmem(T, sb, str + idx, 1);
-            setstrV(T, T->top++, tea_buf_str(T, sb));
+            setstrV(T, T->top++, tea_str_sub(T, str, idx, 1));
             tea_add_item(T, count);
         }
 
         if(idx != len && list_len >= max_split)
         {
-            tea_buf_reset(sb);
-            tea_buf_putmem(T, sb, str + idx, len - idx);
-            setstrV(T, T->top++, tea_buf_str(T, sb));
+            setstrV(T, T->top++, tea_str_sub(T, str, idx, len - idx));
             tea_add_item(T, count);
         }
     }
     else if(max_split > 0)
     {
-        const char* start = str;
+        const char* start = str_mem(str);
+        const char* end = start + len;
         const char* found;
         
-        while((found = strstr(start, sep)) && list_len < max_split)
+        while((found = string_search(start, end - start, sep, sep_len)) && list_len < max_split)
         {
             list_len++;
-            size_t part_len = found - start;
-            tea_buf_reset(sb);
-            tea_buf_putmem(T, sb, start, part_len);
-            setstrV(T, T->top++, tea_buf_str(T, sb));
+            setstrV(T, T->top++, tea_str_sub(T, str, start - str_mem(str), found - start));
             tea_add_item(T, count);
             start = found + sep_len;
         }
 
-        if(*start != '\0' && (list_len < max_split || found == NULL))
+        if(start < end && (list_len < max_split || found == NULL))
         {
-            tea_buf_reset(sb);
-            tea_buf_putmem(T, sb, start, (str + len) - start);
-            setstrV(T, T->top++, tea_buf_str(T, sb));
+            setstrV(T, T->top++, tea_str_sub(T, str, start - str_mem(str), end - start));
             tea_add_item(T, count);
         }
     }
@@ -170,27 +181,30 @@ static void string_contains(tea_State* T)
 {
     GCstr* str = tea_lib_checkstr(T, 0);
     GCstr* del = tea_lib_checkstr(T, 1);
-    tea_push_bool(T, strstr(str_data(str), str_data(del)) != NULL);
+    tea_push_bool(T, string_search(str_mem(str), str->len, str_mem(del), del->len) != NULL);
 }
 
 static void string_startswith(tea_State* T)
 {
     GCstr* str = tea_lib_checkstr(T, 0);
     GCstr* start = tea_lib_checkstr(T, 1);
-    tea_push_bool(T, strncmp(str_data(str), str_data(start), start->len) == 0);
+    tea_push_bool(T, start->len <= str->len &&
+                     memcmp(str_mem(str), str_mem(start), start->len) == 0);
 }
 
 static void string_endswith(tea_State* T)
 {
     GCstr* str = tea_lib_checkstr(T, 0);
     GCstr* end = tea_lib_checkstr(T, 1);
-    tea_push_bool(T, strcmp(str_data(str) + (str->len - end->len), str_data(end)) == 0);
+    tea_push_bool(T, end->len <= str->len &&
+                     memcmp(str_mem(str) + (str->len - end->len), str_mem(end), end->len) == 0);
 }
 
 static void string_leftstrip(tea_State* T)
 {
-    size_t len;
-    const char* str = tea_check_lstring(T, 0, &len);
+    GCstr* s = tea_lib_checkstr(T, 0);
+    size_t len = s->len;
+    const char* str = str_mem(s);
 
     int i = 0;
     int count = 0;
@@ -205,23 +219,14 @@ static void string_leftstrip(tea_State* T)
         count++;
     }
 
-    SBuf* sb = tea_buf_tmp_(T);
-    if(count != 0)
-    {
-        tea_buf_more(T, sb, len - count);
-    }
-    else
-    {
-        tea_buf_more(T, sb, len);
-    }
-    tea_buf_putmem(T, sb, str + count, len - count);
-    setstrV(T, T->top++, tea_buf_str(T, sb));
+    setstrV(T, T->top++, tea_str_sub(T, s, count, len - count));
 }
 
 static void string_rightstrip(tea_State* T)
 {
-    size_t l;
-    const char* str = tea_check_lstring(T, 0, &l);
+    GCstr* s = tea_lib_checkstr(T, 0);
+    size_t l = s->len;
+    const char* str = str_mem(s);
 
     int len;
     unsigned char c;
@@ -234,18 +239,7 @@ static void string_rightstrip(tea_State* T)
         }
     }
 
-    SBuf* sb = tea_buf_tmp_(T);
-    /* If characters were stripped resize the buffer */
-    if(len + 1 != l)
-    {
-        tea_buf_more(T, sb, len + 1);
-    }
-    else
-    {
-        tea_buf_more(T, sb, l);
-    }
-    tea_buf_putmem(T, sb, str, len + 1);
-    setstrV(T, T->top++, tea_buf_str(T, sb));
+    setstrV(T, T->top++, tea_str_sub(T, s, 0, len + 1));
 }
 
 static void string_strip(tea_State* T)
@@ -261,10 +255,12 @@ static void string_strip(tea_State* T)
 
 static void string_count(tea_State* T)
 {
-    const char* str = tea_check_string(T, 0);
-    const char* needle = tea_check_string(T, 1);
+    GCstr* s = tea_lib_checkstr(T, 0);
+    GCstr* needle = tea_lib_checkstr(T, 1);
+    const char* str = str_mem(s);
+    const char* end = str + s->len;
     int count = 0;
-    while((str = strstr(str, needle)))
+    while(str <= end && (str = string_search(str, end - str, str_mem(needle), needle->len)))
     {
         count++;
         str++;
@@ -281,14 +277,17 @@ static void string_find(tea_State* T)
         idx = tea_check_number(T, 2);
     }
 
-    size_t len;
-    const char* str = tea_check_string(T, 0);
-    const char* substr = tea_check_lstring(T, 1, &len);
+    GCstr* s = tea_lib_checkstr(T, 0);
+    GCstr* sub = tea_lib_checkstr(T, 1);
+    const char* str = str_mem(s);
+    const char* end = str + s->len;
+    const char* substr = str_mem(sub);
+    size_t len = sub->len;
 
     int pos = 0;
     for(int i = 0; i < idx; i++)
     {
-        char* result = strstr(str, substr);
+        const char* result = string_search(str, end - str, substr, len);
         if(!result)
         {
             pos = -1;
@@ -384,8 +383,8 @@ static void string_repeat(tea_State* T)
 
 static void string_iternext(tea_State* T)
 {
-    GCstr* str = strV(tea_lib_upvalue(T, 0));
-    const char* s = str_data(str);
+    GCstr* str = tea_str_flatten(T, strV(tea_lib_upvalue(T, 0)));
+    const char* s = str_mem(str);
     uint32_t idx = (uint32_t)tea_get_number(T, tea_upvalue_index(1));
     
     if(str->len == 0 || idx >= str->len)
@@ -420,9 +419,8 @@ static void string_opadd(tea_State* T)
     if(!tvisstr(T->base) || !tvisstr(T->base + 1))
         tea_err_bioptype(T, T->base, T->base + 1, MM_PLUS);
 
-    GCstr* s1 = tea_lib_checkstr(T, 0);
-    GCstr* s2 = tea_lib_checkstr(T, 1);
-    GCstr* str = tea_buf_cat2str(T, s1, s2);
+    /* The operands are not read, a long result is a rope of them */
+    GCstr* str = tea_buf_cat2str(T, strV(T->base), strV(T->base + 1));
     T->top -= 2;
     setstrV(T, T->top++, str);
 }
@@ -457,6 +455,7 @@ void tea_open_string(tea_State* T)
 {
     tea_create_class(T, TEA_CLASS_STRING, string_reg);
     T->gcroot[GCROOT_KLSTR] = obj2gco(classV(T->top - 1));
+    tea_lib_setffid(T, classV(T->top - 1), MM_ITER, FF_ITER_STR);
     tea_set_global(T, TEA_CLASS_STRING);
     tea_push_nil(T);
 }
\ No newline at end of file
@@ -177,11 +177,11 @@ GCstr* utf8_codepoint_at(tea_State* T, GCstr* str, uint32_t idx)
         return NULL;
     }
 
-    int code_point = utf8_decode((uint8_t*)str_data(str) + idx, str->len - idx);
+    int code_point = utf8_decode((uint8_t*)str_mem(str) + idx, str->len - idx);
     if(code_point == -1)
     {
         char bytes[2];
-        bytes[0] = str_data(str)[idx];
+        bytes[0] = str_mem(str)[idx];
         bytes[1] = '\0';
         return tea_str_new(T, bytes, 1);
     }
@@ -196,7 +196,7 @@ static void utf8_len(tea_State* T)
     uint32_t len = 0;
     for(uint32_t i = 0; i < str->len;)
     {
-        i += utf8_decode_bytes(str_data(str)[i]);
+        i += utf8_decode_bytes(str_mem(str)[i]);
         len++;
     }
     tea_push_number(T, len);
@@ -211,7 +211,7 @@ static void utf8_char(tea_State* T)
 static void utf8_ord(tea_State* T)
 {
     GCstr* c = tea_lib_checkstr(T, 0);
-    tea_push_number(T, utf8_decode((uint8_t*)str_data(c), c->len));
+    tea_push_number(T, utf8_decode((uint8_t*)str_mem(c), c->len));
 }
 
 static void utf8_reverse(tea_State* T)
@@ -219,7 +219,7 @@ static void utf8_reverse(tea_State* T)
     GCstr* str = tea_lib_checkstr(T, 0);
     size_t len = str->len;
     char* rev = tea_buf_tmp(T, len);
-    memcpy(rev, str_data(str), len);
+    memcpy(rev, str_mem(str), len);
 
     /* this assumes that the string is valid UTF-8 */
     char* scanl, *scanr, *scanr2, c;
@@ -253,8 +253,8 @@ static void utf8_reverse(tea_State* T)
 
 static void utf8_iternext(tea_State* T)
 {
-    GCstr* str = strV(tea_lib_upvalue(T, 0));
-    const char* s = str_data(str);
+    GCstr* str = tea_str_flatten(T, strV(tea_lib_upvalue(T, 0)));
+    const char* s = str_mem(str);
     uint32_t idx = (uint32_t)tea_get_number(T, tea_upvalue_index(1));
 
     if(str->len == 0 || idx >= str->len)
@@ -45,6 +45,11 @@
 #include "tea_state.c"
 #include "tea_meta.c"
 #include "tea_tab.c"
+#include "tea_shape.c"
+#include "tea_slab.c"
+#include "tea_los.c"
+#include "tea_prof.c"
+#include "tea_pool.c"
 #include "tea_vm.c"
 
 #include "lib_base.c"
@@ -61,5 +66,6 @@
 #include "lib_sys.c"
 #include "lib_time.c"
 #include "lib_utf8.c"
+#include "lib_gc.c"
 
 #include "tea.c"
\ No newline at end of file
@@ -35,6 +35,9 @@
 
 static tea_State* globalT = NULL;
 static char* empty_argv[2] = { NULL, NULL };
+static char loadmode[] = "btO1";   /* Load mode with the optimization level */
+static const char* memprof_file = NULL;   /* Output of the allocation profiler */
+static bool pooled = false;   /* Run on a pooled state */
 
 static void taction(int id)
 {
@@ -49,6 +52,9 @@ static void print_usage()
         "Available options are:\n"
         "  -e code    Execute string 'code'\n"
         "  -b ...     Save or list bytecode\n"
+        "  -O[level]  Set bytecode optimization level (0 or 1, default 1)\n"
+        "  -M file    Profile allocations, write folded stacks to 'file'\n"
+        "  -P         Run on a pooled state, released at once on exit\n"
         "  -i         Enter interactive mode after executing 'script'\n"
         "  -v         Show version information\n"
         "  --         Stop handling options\n"
@@ -103,13 +109,13 @@ static int docall(tea_State* T, int narg)
 
 static int dofile(tea_State* T, const char* name)
 {
-    int status = tea_load_file(T, name, NULL) || docall(T, 0);
+    int status = tea_load_filex(T, name, NULL, loadmode) || docall(T, 0);
     return report(T, status);
 }
 
 static int dostring(tea_State* T, const char* s, const char* name)
 {
-    int status = tea_load_buffer(T, s, strlen(s), name) || docall(T, 0);
+    int status = tea_load_bufferx(T, s, strlen(s), name, loadmode) || docall(T, 0);
     return report(T, status);
 }
 
@@ -197,7 +203,7 @@ static int loadline(tea_State* T)
     while(true)
     {
         line = tea_get_lstring(T, -1, &len);
-        status = tea_load_buffer(T, line, len, "=<stdin>");
+        status = tea_load_bufferx(T, line, len, "=<stdin>", loadmode);
         if(!incomplete(T, status))
             break;  /* Cannot try to add lines? */
         if(!pushline(T, false))
@@ -233,7 +239,7 @@ static int handle_script(tea_State* T, char** argx, const char* name)
     if(strcmp(path, "-") == 0 && strcmp(argx[-1], "--") != 0)
         path = NULL; /* stdin */
 
-    status = tea_load_file(T, path, name);
+    status = tea_load_filex(T, path, name, loadmode);
     if(status == TEA_OK)
     {
         status = docall(T, 0);
@@ -297,6 +303,27 @@ static int collect_args(char** argv, int* flags)
                         return -1;
                 }
                 break;
+            case 'O':
+                if(argv[i][2] == '\0')
+                    break;
+                if(argv[i][2] < '0' || argv[i][2] > '1' || argv[i][3] != '\0')
+                    return -1;
+                loadmode[3] = argv[i][2];
+                break;
+            case 'M':
+                memprof_file = argv[i] + 2;
+                if(*memprof_file == '\0')
+                {
+                    i++;
+                    if(argv[i] == NULL)
+                        return -1;
+                    memprof_file = argv[i];
+                }
+                break;
+            case 'P':
+                notail(argv[i])
+                pooled = true;
+                break;
             case 'b':
                 if(*flags) return -1;
                 *flags |= FLAG_EXEC;
@@ -329,6 +356,10 @@ static int run_args(tea_State* T, char** argv, int n)
             }
             case 'b':
                 return dobytecode(T, argv + i);
+            case 'M':
+                if(argv[i][2] == '\0')
+                    i++;
+                break;
             default:
                 break;
         }
@@ -340,6 +371,8 @@ static struct Smain
 {
     char** argv;
     int argc;
+    int script;
+    int flags;
     int status;
 } smain;
 
@@ -348,18 +381,15 @@ static void pmain(tea_State* T)
     struct Smain* s = &smain;
     char** argv = s->argv;
     int argc = s->argc;
+    int script = s->script;
+    int flags = s->flags;
     globalT = T;
 
-    int flags = 0;
-    int script = collect_args(argv, &flags);
-    if(script < 0)
-    {
-        print_usage();
-        return;
-    }
-
     tea_set_argv(T, argc, argv, script);
 
+    if(memprof_file != NULL)
+        tea_memprof_start(T, 0);
+
     if(flags & FLAG_VERSION)
         print_version();
 
@@ -393,12 +423,40 @@ static void pmain(tea_State* T)
     }
 }
 
+static int writer_file(tea_State* T, void* fp, const void* p, size_t size)
+{
+    (void)T;
+    return fwrite(p, 1, size, (FILE*)fp) != size;
+}
+
+/* Write the allocation profile */
+static void pmemprof(tea_State* T)
+{
+    FILE* fp = fopen(memprof_file, "w");
+    if(fp == NULL)
+    {
+        tea_error(T, "cannot open %s", memprof_file);
+    }
+    tea_memprof_stop(T);
+    int status = tea_memprof_dump(T, writer_file, fp);
+    if(fclose(fp) != 0 || status != 0)
+    {
+        tea_error(T, "cannot write %s", memprof_file);
+    }
+}
+
 int main(int argc, char** argv)
 {
     int status;
     tea_State* T;
     if(!argv[0]) argv = empty_argv;
-    T = tea_open();
+    smain.script = collect_args(argv, &smain.flags);
+    if(smain.script < 0)
+    {
+        print_usage();
+        return EXIT_SUCCESS;
+    }
+    T = pooled ? tea_new_pooled_state() : tea_open();
     if(T == NULL)
     {
         t_message("Cannot create state: not enough memory");
@@ -408,6 +466,8 @@ int main(int argc, char** argv)
     smain.argv = argv;
     status = tea_pccall(T, pmain, NULL);
     report(T, status);
+    if(memprof_file != NULL && report(T, tea_pccall(T, pmemprof, NULL)))
+        smain.status = EXIT_FAILURE;
     tea_close(T);
     return (status || smain.status > 0) ? smain.status : EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -135,6 +135,7 @@ enum
 ** State manipulation
 */
 TEA_API tea_State* tea_new_state(tea_Alloc allocf, void* ud);
+TEA_API tea_State* tea_new_pooled_state(void);
 TEA_API void tea_close(tea_State* T);
 TEA_API void tea_set_argv(tea_State* T, int argc, char** argv, int argf);
 TEA_API int tea_get_argv(tea_State* T, char*** argv, int* argf);
@@ -315,9 +316,54 @@ TEA_API void* tea_opt_userdata(tea_State* T, int index, void* def);
 TEA_API tea_CFunction tea_opt_cfunction(tea_State* T, int index, tea_CFunction def);
 
 /*
-** Garbage collection function
+** Garbage collection function and options
 */
+#define TEA_GCSTOP          0
+#define TEA_GCRESTART       1
+#define TEA_GCCOLLECT       2
+#define TEA_GCCOUNT         3
+#define TEA_GCCOUNTB        4
+#define TEA_GCSTEP          5
+#define TEA_GCSETPAUSE      6
+#define TEA_GCSETSTEPMUL    7
+#define TEA_GCISRUNNING     8
+#define TEA_GCGEN           9
+#define TEA_GCINC           10
+#define TEA_GCSETMINORMUL   11
+#define TEA_GCSETMAJORMUL   12
+#define TEA_GCSETSOFTLIMIT  13
+#define TEA_GCSETHARDLIMIT  14
+
+/*
+** Garbage collector statistics. Prototypes, upvalues and bound methods
+** are counted as functions
+*/
+typedef struct tea_GCStats
+{
+    size_t count;       /* Bytes in use */
+    size_t cycles;      /* Number of completed GC cycles */
+    size_t minors;      /* Number of minor collections (generational mode) */
+    size_t freed;       /* Bytes freed by the last cycle */
+    size_t totalfreed;  /* Bytes freed since the state was created */
+    double pausetime;   /* Seconds spent in the collector */
+    size_t strnum;      /* Number of interned strings */
+    size_t strsize;     /* Size of the string table */
+    size_t large;       /* Bytes in the large-object space */
+    size_t objects[TEA_TYPE_USERDATA + 1];  /* Number of objects per type */
+} tea_GCStats;
+
 TEA_API int tea_gc(tea_State* T);
+TEA_API int tea_gc_control(tea_State* T, int what, int data);
+TEA_API void tea_gc_stats(tea_State* T, tea_GCStats* stats);
+
+/*
+** Memory profiling. Profiles and snapshots are written as folded stacks,
+** one "frame;frame;frame bytes" line per stack
+*/
+TEA_API void tea_memprof_start(tea_State* T, size_t interval);
+TEA_API void tea_memprof_stop(tea_State* T);
+TEA_API int tea_memprof_dump(tea_State* T, tea_Writer writer, void* data);
+TEA_API int tea_heap_snapshot(tea_State* T, tea_Writer writer, void* data);
 
 /*
 ** Memory management
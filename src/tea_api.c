@@ -22,6 +22,7 @@
 #include "tea_udata.h"
 #include "tea_meta.h"
 #include "tea_import.h"
+#include "tea_prof.h"
 
 /* -- Common helper functions --------------------------------------------- */
 
@@ -171,6 +172,8 @@ static void copy_slot(tea_State* T, TValue* f, int idx)
 {
     TValue* o = index2addr_check(T, idx);
     copyTV(T, o, f);
+    if(idx < TEA_REGISTRY_INDEX)  /* Upvalue of the current C function */
+        tea_gc_barrierback(T, obj2gco(T->ci->func));
 }
 
 TEA_API void tea_replace(tea_State* T, int idx)
@@ -285,14 +288,14 @@ TEA_API const char* tea_get_lstring(tea_State* T, int idx, size_t* len)
     tea_checkapi(tvisstr(o), "stack slot #%d is not a string", idx);
     GCstr* str = strV(o);
     if(len) *len = str->len;
-    return str_data(str);
+    return tea_str_data(T, str);
 }
 
 TEA_API const char* tea_get_string(tea_State* T, int idx)
 {
     cTValue* o = index2addr(T, idx);
     tea_checkapi(tvisstr(o), "stack slot #%d is not a string", idx);
-    return str_data(strV(o));
+    return tea_str_data(T, strV(o));
 }
 
 TEA_API void* tea_get_userdata(tea_State* T, int idx)
@@ -330,6 +333,7 @@ TEA_API void tea_set_udvalue(tea_State* T, int ud, int n)
     o = T->top - 1;
     TValue* uvalues = ud_uvalues(udata);
     copyTV(T, &uvalues[n], o);
+    tea_gc_barrierback(T, obj2gco(udata));
     T->top--;
 }
 
@@ -349,14 +353,14 @@ TEA_API bool tea_equal(tea_State* T, int index1, int index2)
 {
     cTValue* o1 = index2addr_check(T, index1);
     cTValue* o2 = index2addr_check(T, index2);
-    return tea_obj_equal(o1, o2);
+    return tea_obj_equal(T, o1, o2);
 }
 
 TEA_API bool tea_rawequal(tea_State* T, int index1, int index2)
 {
     cTValue* o1 = index2addr_check(T, index1);
     cTValue* o2 = index2addr_check(T, index2);
-    return tea_obj_rawequal(o1, o2);
+    return tea_obj_rawequal(T, o1, o2);
 }
 
 TEA_API bool tea_to_bool(tea_State* T, int idx)
@@ -373,13 +377,13 @@ TEA_API tea_Number tea_to_numberx(tea_State* T, int idx, bool* is_num)
         if(is_num) *is_num = false;
         return 0;
     }
-    return tea_obj_tonum(o, is_num);
+    return tea_obj_tonum(T, o, is_num);
 }
 
 TEA_API tea_Number tea_to_number(tea_State* T, int idx)
 {
     TValue* o = index2addr(T, idx);
-    return tea_obj_tonum(o, NULL);
+    return tea_obj_tonum(T, o, NULL);
 }
 
 TEA_API tea_Integer tea_to_integerx(tea_State* T, int idx, bool* is_num)
@@ -390,13 +394,13 @@ TEA_API tea_Integer tea_to_integerx(tea_State* T, int idx, bool* is_num)
         if(is_num) *is_num = false;
         return 0;
     }
-    return (tea_Integer)tea_obj_tonum(o, is_num);
+    return (tea_Integer)tea_obj_tonum(T, o, is_num);
 }
 
 TEA_API tea_Integer tea_to_integer(tea_State* T, int idx)
 {
     TValue* o = index2addr(T, idx);
-    return (tea_Integer)tea_obj_tonum(o, NULL);
+    return (tea_Integer)tea_obj_tonum(T, o, NULL);
 }
 
 TEA_API const void* tea_to_pointer(tea_State* T, int idx)
@@ -407,6 +411,8 @@ TEA_API const void* tea_to_pointer(tea_State* T, int idx)
 
 static GCstr* obj_tostring(tea_State* T, cTValue* o)
 {
+    if(tvisstr(o))
+        return strV(o);
     if(tvisinstance(o) || tvisudata(o))
     {
         TValue* mo = tea_meta_lookup(T, o, MM_TOSTRING);
@@ -439,7 +445,9 @@ TEA_API const char* tea_to_lstring(tea_State* T, int idx, size_t* len)
     setstrV(T, T->top, str);
     incr_top(T);
     if(len) *len = str->len;
-    return str_data(str);
+    const char* s = tea_str_data(T, str);
+    tea_gc_check(T);
+    return s;
 }
 
 TEA_API const char* tea_to_string(tea_State* T, int idx)
@@ -450,7 +458,9 @@ TEA_API const char* tea_to_string(tea_State* T, int idx)
     GCstr* str = obj_tostring(T, o);
     setstrV(T, T->top, str);
     incr_top(T);
-    return str_data(str);
+    const char* s = tea_str_data(T, str);
+    tea_gc_check(T);
+    return s;
 }
 
 TEA_API void* tea_to_userdata(tea_State* T, int idx)
@@ -490,6 +500,7 @@ TEA_API void tea_concat(tea_State* T, int n)
         T->top -= n;
         setstrV(T, T->top, str);
         incr_top(T);
+        tea_gc_check(T);
     }
     else if(n == 0)
     {
@@ -529,6 +540,7 @@ TEA_API void tea_push_bool(tea_State* T, bool b)
 TEA_API void tea_push_number(tea_State* T, tea_Number n)
 {
     setnumV(T->top, n);
+    canonnumV(T->top);
     incr_top(T);
 }
 
@@ -549,6 +561,7 @@ TEA_API const char* tea_push_lstring(tea_State* T, const char* s, size_t len)
     GCstr* str = tea_str_new(T, s, len);
     setstrV(T, T->top, str);
     incr_top(T);
+    tea_gc_check(T);
     return str_data(str);
 }
 
@@ -557,6 +570,7 @@ TEA_API const char* tea_push_string(tea_State* T, const char* s)
     GCstr* str = tea_str_newlen(T, s);
     setstrV(T, T->top, str);
     incr_top(T);
+    tea_gc_check(T);
     return str_data(str);
 }
 
@@ -567,12 +581,15 @@ TEA_API const char* tea_push_fstring(tea_State* T, const char* fmt, ...)
     va_start(argp, fmt);
     ret = tea_strfmt_pushvf(T, fmt, argp);
     va_end(argp);
+    tea_gc_check(T);
     return ret;
 }
 
 TEA_API const char* tea_push_vfstring(tea_State* T, const char* fmt, va_list argp)
 {
-    return tea_strfmt_pushvf(T, fmt, argp);
+    const char* ret = tea_strfmt_pushvf(T, fmt, argp);
+    tea_gc_check(T);
+    return ret;
 }
 
 TEA_API void tea_push_range(tea_State* T, tea_Number start, tea_Number end, tea_Number step)
@@ -580,6 +597,7 @@ TEA_API void tea_push_range(tea_State* T, tea_Number start, tea_Number end, tea_
     GCrange* range = tea_range_new(T, start, end, step);
     setrangeV(T, T->top, range);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_push_cclosure(tea_State* T, tea_CFunction fn, int nup, int nargs, int nopts)
@@ -592,6 +610,7 @@ TEA_API void tea_push_cclosure(tea_State* T, tea_CFunction fn, int nup, int narg
         copyTV(T, &cf->c.upvalues[nup], T->top + nup);
     setfuncV(T, T->top, cf);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_push_cfunction(tea_State* T, tea_CFunction fn, int nargs, int nopts)
@@ -599,6 +618,7 @@ TEA_API void tea_push_cfunction(tea_State* T, tea_CFunction fn, int nargs, int n
     GCfunc* cf = tea_func_newC(T, C_FUNCTION, fn, 0, nargs, nopts);
     setfuncV(T, T->top, cf);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_new_list(tea_State* T, size_t n)
@@ -606,6 +626,7 @@ TEA_API void tea_new_list(tea_State* T, size_t n)
     GClist* list = tea_list_new(T, n);
     setlistV(T, T->top, list);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_new_map(tea_State* T)
@@ -613,6 +634,7 @@ TEA_API void tea_new_map(tea_State* T)
     GCmap* map = tea_map_new(T);
     setmapV(T, T->top, map);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_new_class(tea_State* T, const char* name)
@@ -620,6 +642,7 @@ TEA_API void tea_new_class(tea_State* T, const char* name)
     GCclass* klass = tea_class_new(T, tea_str_newlen(T, name));
     setclassV(T, T->top, klass);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_new_module(tea_State* T, const char* name)
@@ -629,6 +652,7 @@ TEA_API void tea_new_module(tea_State* T, const char* name)
     mod->path = modname;
     setmoduleV(T, T->top, mod);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 TEA_API void tea_new_submodule(tea_State* T, const char* name)
@@ -638,6 +662,7 @@ TEA_API void tea_new_submodule(tea_State* T, const char* name)
     mod->path = modname;
     setmoduleV(T, T->top, mod);
     incr_top(T);
+    tea_gc_check(T);
 }
 
 static void set_method(tea_State* T, int obj, const char* name, uint8_t flags)
@@ -648,6 +673,8 @@ static void set_method(tea_State* T, int obj, const char* name, uint8_t flags)
     GCstr* str = tea_str_newlen(T, name);
     GCclass* k = classV(object);
     copyTV(T, tea_tab_setx(T, &k->methods, str, flags), item);
+    tea_gc_barrierback(T, obj2gco(k));
+    T->icepoch++;   /* Flush inline caches */
     T->top--;
     if(str == mmname_str(T, MM_NEW))
     {
@@ -755,6 +782,7 @@ TEA_API void* tea_new_userdatav(tea_State* T, size_t size, int nuvs)
     ud = tea_udata_new(T, size, (uint8_t)nuvs);
     setudataV(T, T->top, ud);
     incr_top(T);
+    tea_gc_check(T);
     return ud_data(ud);
 }
 
@@ -765,6 +793,7 @@ TEA_API void* tea_new_udatav(tea_State* T, size_t size, int nuvs, const char* na
     ud->klass = klass;
     setudataV(T, T->top, ud);
     incr_top(T);
+    tea_gc_check(T);
     return ud_data(ud);
 }
 
@@ -774,6 +803,7 @@ TEA_API void* tea_new_userdata(tea_State* T, size_t size)
     ud = tea_udata_new(T, size, 0);
     setudataV(T, T->top, ud);
     incr_top(T);
+    tea_gc_check(T);
     return ud_data(ud);
 }
 
@@ -784,6 +814,7 @@ TEA_API void* tea_new_udata(tea_State* T, size_t size, const char* name)
     ud->klass = klass;
     setudataV(T, T->top, ud);
     incr_top(T);
+    tea_gc_check(T);
     return ud_data(ud);
 }
 
@@ -821,7 +852,7 @@ TEA_API int tea_next(tea_State* T, int obj)
     TValue* o = index2addr(T, obj);
     int more;
     tea_checkapi(tvismap(o), "stack slot #%d is not a map", obj);
-    more = tea_map_next(mapV(o), T->top - 1, T->top - 1);
+    more = tea_map_next(T, mapV(o), T->top - 1, T->top - 1);
     if(more > 0)
     {
         /* Return new key and value slot */
@@ -861,6 +892,7 @@ TEA_API bool tea_set_item(tea_State* T, int list, int idx)
     if(idx < 0 || idx > l->len - 1)
         return false;
     copyTV(T, list_slot(l, idx), T->top - 1);
+    tea_gc_barrierback(T, obj2gco(l));
     T->top--;
     return true;
 }
@@ -908,7 +940,7 @@ TEA_API bool tea_get_fieldi(tea_State* T, int obj, tea_Integer i)
     bool found = false;
     TValue key; setintV(&key, i);
     GCmap* map = mapV(o);
-    cTValue* v = tea_map_get(map, &key);
+    cTValue* v = tea_map_get(T, map, &key);
     if(v)
     {
         found = true;
@@ -938,7 +970,7 @@ TEA_API bool tea_get_field(tea_State* T, int obj)
     TValue* key = T->top - 1;
     bool found = false;
     GCmap* map = mapV(o);
-    cTValue* v = tea_map_get(map, key);
+    cTValue* v = tea_map_get(T, map, key);
     if(v)
     {
         found = true;
@@ -1114,6 +1146,7 @@ TEA_API void tea_set_var(tea_State* T, const char* name, const char* var)
     GCstr* s2 = tea_str_newlen(T, var);
     GCmodule* module = moduleV(tea_tab_get(&T->modules, s1));
     copyTV(T, tea_tab_set(T, &module->exports, s2), o);
+    tea_gc_barrierback(T, obj2gco(module));
     T->top--;
 }
 
@@ -1330,6 +1363,119 @@ TEA_API int tea_gc(tea_State* T)
     return collected >> 10;
 }
 
+TEA_API int tea_gc_control(tea_State* T, int what, int data)
+{
+    int res = 0;
+    switch(what)
+    {
+        case TEA_GCSTOP:
+            T->gc.stopped = 1;
+            T->gc.next_gc = SIZE_MAX;
+            break;
+        case TEA_GCRESTART:
+            T->gc.stopped = 0;
+            T->gc.next_gc = T->gc.total;
+            break;
+        case TEA_GCCOLLECT:
+            res = tea_gc(T);
+            break;
+        case TEA_GCCOUNT:
+            res = (int)(T->gc.total >> 10);
+            break;
+        case TEA_GCCOUNTB:
+            res = (int)(T->gc.total & 0x3ff);
+            break;
+        case TEA_GCSTEP:
+            res = tea_gc_stepk(T, data > 0 ? (size_t)data : 0);
+            break;
+        case TEA_GCSETPAUSE:
+            res = (int)T->gc.pause;
+            T->gc.pause = (uint32_t)(data > 0 ? data : 0);
+            break;
+        case TEA_GCSETSTEPMUL:
+            res = (int)T->gc.stepmul;
+            T->gc.stepmul = (uint32_t)(data > 0 ? data : 0);
+            break;
+        case TEA_GCSETMINORMUL:
+            res = (int)T->gc.minormul;
+            if(data > 0) T->gc.minormul = (uint32_t)data;
+            break;
+        case TEA_GCSETMAJORMUL:
+            res = (int)T->gc.majormul;
+            if(data > 0) T->gc.majormul = (uint32_t)data;
+            break;
+        case TEA_GCSETSOFTLIMIT:
+        case TEA_GCSETHARDLIMIT:
+        {
+            /* Limits in Kbytes, 0 for none */
+            size_t* limit = what == TEA_GCSETSOFTLIMIT ? &T->gc.softlimit : &T->gc.hardlimit;
+            res = *limit == SIZE_MAX ? 0 : (int)(*limit >> 10);
+            *limit = data > 0 ? (size_t)data << 10 : SIZE_MAX;
+            tea_gc_setlimit(T);
+            break;
+        }
+        case TEA_GCISRUNNING:
+            res = !T->gc.stopped;
+            break;
+        case TEA_GCGEN:
+        case TEA_GCINC:
+            res = T->gc.kind == GCKinc ? TEA_GCINC : TEA_GCGEN;
+            tea_gc_changemode(T, what == TEA_GCGEN ? GCKgen : GCKinc);
+            break;
+        default:
+            res = -1;   /* Invalid option */
+            break;
+    }
+    return res;
+}
+
+TEA_API void tea_gc_stats(tea_State* T, tea_GCStats* stats)
+{
+    size_t counts[TEA_TMETHOD - TEA_TSTR + 1] = { 0 };
+    stats->count = T->gc.total;
+    stats->cycles = T->gc.cycles;
+    stats->minors = T->gc.minors;
+    stats->freed = T->gc.freed;
+    stats->totalfreed = T->gc.totalfreed;
+    stats->pausetime = T->gc.pausetime;
+    stats->strnum = T->str.num;
+    stats->strsize = T->str.size;
+    stats->large = T->gc.lototal;
+    tea_gc_countobj(T, counts);
+    for(int i = 0; i <= TEA_TYPE_USERDATA; i++)
+    {
+        stats->objects[i] = 0;
+    }
+    /* Public type numbers are the internal tags plus one */
+    for(int i = TEA_TSTR; i <= TEA_TUDATA; i++)
+    {
+        stats->objects[i + 1] = counts[i - TEA_TSTR];
+    }
+    stats->objects[TEA_TYPE_FUNCTION] += counts[TEA_TPROTO - TEA_TSTR] +
+                                         counts[TEA_TUPVAL - TEA_TSTR] +
+                                         counts[TEA_TMETHOD - TEA_TSTR];
+}
+
+TEA_API void tea_memprof_start(tea_State* T, size_t interval)
+{
+    tea_prof_start(T, interval);
+}
+
+TEA_API void tea_memprof_stop(tea_State* T)
+{
+    tea_prof_stop(T);
+}
+
+TEA_API int tea_memprof_dump(tea_State* T, tea_Writer writer, void* data)
+{
+    return tea_prof_dump(T, writer, data);
+}
+
+TEA_API int tea_heap_snapshot(tea_State* T, tea_Writer writer, void* data)
+{
+    return tea_prof_snapshot(T, writer, data);
+}
+
 TEA_API void* tea_alloc(tea_State* T, size_t size)
 {
     return tea_mem_new(T, size);
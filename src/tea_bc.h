@@ -27,7 +27,7 @@
     \
     /* Function calls */ \
     _(CALL, 0, 1) \
-    _(INVOKE, 0, 2) \
+    _(INVOKE, 0, 3) \
     _(NEW, 0, 1) \
     _(SUPER, 0, 2) \
     _(RETURN, 0, 0) \
@@ -64,9 +64,9 @@
     _(SPREAD, 0, 3) \
     \
     /* Object access */ \
-    _(GETATTR, 1, 1) \
-    _(PUSHATTR, 0, 1) \
-    _(SETATTR, 0, 1) \
+    _(GETATTR, 1, 2) \
+    _(PUSHATTR, 0, 2) \
+    _(SETATTR, 0, 2) \
     _(GETIDX, -1, 0) \
     _(PUSHIDX, 1, 0) \
     _(SETIDX, 0, 0) \
@@ -76,7 +76,7 @@
     _(GETGLOBAL, 1, 1) \
     _(GETMODULE, 1, 1) \
     _(SETMODULE, 0, 1) \
-    _(DEFMODULE, 0, 2) \
+    _(DEFMODULE, 0, 1) \
     \
     /* Closure and upvalue ops */ \
     _(CLOSURE, 1, 1) \
@@ -90,6 +90,7 @@
     _(NOT, 0, 0) \
     _(IS, -1, 0) \
     _(IN, -1, 0) \
+    _(CONCAT, 0, 1) \
     \
     /* Bitwise ops */ \
     _(BAND, -1, 0) \
@@ -101,7 +102,9 @@
     \
     /* Iterator ops */ \
     _(GETITER, 1, 1) \
-    _(FORITER, 1, 1) \
+    _(FORITER, 1, 4) \
+    _(FORPREP, 1, 3) \
+    _(FORLOOP, 1, 3) \
     \
     /* Class ops */ \
     _(CLASS, 1, 1) \
@@ -113,10 +116,28 @@
     _(IMPORTNAME, 0, 1) \
     _(IMPORTSTR, 0, 1) \
     _(IMPORTFMT, 0, 0) \
-    _(IMPORTVAR, 1, 2) \
+    _(IMPORTVAR, 1, 1) \
     _(IMPORTALIAS, 1, 0) \
     _(IMPORTEND, 1, 0) \
     \
+    /* Quickened ops, specialized at runtime */ \
+    _(ADDNN, -1, 0) \
+    _(SUBNN, -1, 0) \
+    _(MULNN, -1, 0) \
+    _(DIVNN, -1, 0) \
+    _(ISLTNN, -1, 0) \
+    _(ISLENN, -1, 0) \
+    _(ISGTNN, -1, 0) \
+    _(ISGENN, -1, 0) \
+    \
+    /* Superinstructions, fused by the parser */ \
+    _(GETLOCALATTR, 1, 3) \
+    _(INCLOCAL, 0, 2) \
+    _(ISLTJMP, 0, 4) \
+    _(ISLEJMP, 0, 4) \
+    _(ISGTJMP, 0, 4) \
+    _(ISGEJMP, 0, 4) \
+    \
     /* Special cases */ \
     _(DEFOPT, 0, 2) \
     _(MULTICASE, 0, 1) \
@@ -133,4 +154,22 @@ typedef enum
 
 TEA_DATA const char* const tea_bcnames[];
 
+/* Generic instructions with a quickened number-number form */
+#define BCQUICKDEF(_) \
+    _(ADD) _(SUB) _(MUL) _(DIV) \
+    _(ISLT) _(ISLE) _(ISGT) _(ISGE)
+
+/* Get the generic form of a possibly quickened instruction */
+static TEA_AINLINE uint8_t bc_generic(uint8_t ins)
+{
+    switch(ins)
+    {
+#define BCGENERIC(name) case BC_##name##NN: return BC_##name;
+        BCQUICKDEF(BCGENERIC)
+#undef BCGENERIC
+        default:
+            return ins;
+    }
+}
+
 #endif
\ No newline at end of file
@@ -20,7 +20,7 @@
 #define BCDUMP_HEAD3    0x65
 #define BCDUMP_HEAD4    0x61
 
-#define BCDUMP_VERSION    0
+#define BCDUMP_VERSION    2
 
 /* Bytecode flags */
 #define BCDUMP_F_BE     0x01
@@ -4,6 +4,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 
 #define tea_bcread_c
 #define TEA_CORE
@@ -13,6 +14,7 @@
 #include "tea_bcdump.h"
 #include "tea_strfmt.h"
 #include "tea_err.h"
+#include "tea_gc.h"
 
 /* Reuse some lexer fields for our own purposes */
 #define bcread_flags(ls)    ls->num_braces
@@ -206,13 +208,14 @@ static void bcread_kgc(LexState* ls, GCproto* pt, size_t sizek)
         {
             int len = type - BCDUMP_KGC_STR;
             const char* p = (const char*)bcread_mem(ls, len);
-            GCstr* str = tea_str_new(ls->T, p, len);
+            GCstr* str = tea_str_newintern(ls->T, p, len);  /* Like the constants of the parser */
             setstrV(ls->T, proto_kgc(pt, i), str);
         }
         else if(type == BCDUMP_KGC_NUM)
         {
             double num = bcread_knum(ls);
             setnumV(proto_kgc(pt, i), num);
+            canonnumV(proto_kgc(pt, i));
         }
         else
         {
@@ -260,8 +263,8 @@ static void bcread_uv(LexState* ls, GCproto* pt, size_t sizeuv)
 static GCproto* bcread_proto(LexState* ls)
 {
     GCproto* pt;
-    size_t numparams, numopts, flags, max_slots, sizeuv, sizebc, sizek, sizept;
-    size_t ofsk, ofsuv, ofsdbg;
+    size_t numparams, numopts, flags, max_slots, sizeuv, sizebc, sizek, sizeic, sizept;
+    size_t ofsk, ofsuv, ofsic, ofsdbg;
     size_t sizedbg = 0;
     BCLine firstline = 0, numline = 0;
 
@@ -277,6 +280,7 @@ static GCproto* bcread_proto(LexState* ls)
     sizeuv = bcread_byte(ls);
     sizebc = bcread_uleb128(ls);
     sizek = bcread_uleb128(ls);
+    sizeic = bcread_uleb128(ls);
     if(!(bcread_flags(ls) & BCDUMP_F_STRIP))
     {
         sizedbg = bcread_uleb128(ls);
@@ -291,6 +295,8 @@ static GCproto* bcread_proto(LexState* ls)
     sizept = sizeof(GCproto) + sizebc * sizeof(BCIns);
     ofsk = sizept; sizept += sizek * sizeof(TValue);
     ofsuv = sizept; sizept += sizeuv * sizeof(uint16_t);
+    sizept = (sizept + 7) & ~(size_t)7;
+    ofsic = sizept; sizept += sizeic * IC_WAYS * sizeof(ICEntry);
     ofsdbg = sizept; sizept += sizedbg;
 
     /* Allocate prototype and initialize its fields */
@@ -305,6 +311,11 @@ static GCproto* bcread_proto(LexState* ls)
     pt->k = (TValue*)((char*)pt + ofsk);
     pt->uv = (uint16_t*)((char*)pt + ofsuv);
     pt->sizek = sizek;
+    pt->ic = (ICEntry*)((char*)pt + ofsic);
+    pt->sizeic = sizeic;
+    pt->ichits = 0;
+    pt->icmisses = 0;
+    memset(pt->ic, 0, sizeic * IC_WAYS * sizeof(ICEntry));
     pt->sizept = sizept;
 
     /* Read bytecode instructions and upvalue indexes */
@@ -354,6 +365,7 @@ static void bcread_module(LexState* ls)
         mod->varnames[i] = name;
         setnilV(&mod->vars[i]);
     }
+    tea_gc_barrierback(T, obj2gco(mod));
 }
 
 /* Read and check header of bytecode dump */
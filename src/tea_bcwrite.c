@@ -7,6 +7,7 @@
 #define TEA_CORE
 
 #include "tea_arch.h"
+#include "tea_bc.h"
 #include "tea_bcdump.h"
 #include "tea_buf.h"
 #include "tea_vm.h"
@@ -100,11 +101,26 @@ static void bcwrite_kgc(BCWriteCtx* ctx, GCproto* pt)
     }
 }
 
+/* Operand byte count of each instruction */
+static const uint8_t bcwrite_argcount[] = {
+#define BCARG(_, __, argcount) argcount,
+    BCDEF(BCARG)
+#undef BCARG
+};
+
 /* Write bytecode instructions */
 static char* bcwrite_bytecode(BCWriteCtx* ctx, GCproto* pt, char* p)
 {
+    BCIns* bc = (BCIns*)p;
+    BCPos pc = 0;
     UNUSED(ctx);
     p = tea_buf_wmem(p, proto_bc(pt), pt->sizebc);
+    /* Write quickened instructions in their generic form */
+    while(pc < pt->sizebc)
+    {
+        bc[pc] = bc_generic(bc[pc]);
+        pc += 1 + bcwrite_argcount[bc[pc]];
+    }
     return p;
 }
 
@@ -128,7 +144,7 @@ static void bcwrite_proto(BCWriteCtx* ctx, GCproto* pt)
 
     /* Start writing the prototype into the buffer */
     p = tea_buf_need(ctx->T, &ctx->sb, 
-                5+(5+len)+6+2*5+(pt->sizebc-1)+(pt->sizeuv-1)*sizeof(uint16_t));
+                5+(5+len)+6+3*5+(pt->sizebc-1)+(pt->sizeuv-1)*sizeof(uint16_t));
     p += 5; /* Leave room for final size */
 
     /* Write prototype name */
@@ -143,6 +159,7 @@ static void bcwrite_proto(BCWriteCtx* ctx, GCproto* pt)
     *p++ = pt->sizeuv;
     p = bcwrite_wuleb128(p, pt->sizebc);
     p = bcwrite_wuleb128(p, pt->sizek);
+    p = bcwrite_wuleb128(p, pt->sizeic);
     if(!(ctx->flags & BCDUMP_F_STRIP))
     {
         if(pt->lineinfo)
@@ -76,9 +76,9 @@ void tea_buf_shrink(tea_State* T, SBuf* sb)
 {
     char* b = sb->b;
     size_t old_size = (size_t)(sb->e - b);
-    if(old_size > 2 * TEA_MIN_SBUF)
+    size_t n = (size_t)(sb->w - b);
+    if(old_size > 2 * TEA_MIN_SBUF && n <= (old_size >> 1))  /* Keep the contents */
     {
-        size_t n = (size_t)(sb->w - b);
         b = tea_mem_realloc(T, b, old_size, (old_size >> 1));
         sb->b = b;
         sb->w = b + n;
@@ -96,9 +96,9 @@ SBuf* tea_buf_putmem(tea_State* T, SBuf* sb, const void* q, size_t len)
 
 SBuf* tea_buf_putstr(tea_State* T, SBuf* sb, GCstr* str)
 {
-    size_t len = str->len;
+    size_t len = tea_str_flatten(T, str)->len;
     char* w = tea_buf_more(T, sb, len);
-    w = tea_buf_wmem(w, str_data(str), len);
+    w = tea_buf_wmem(w, str_mem(str), len);
     sb->w = w;
     return sb;
 }
@@ -128,9 +128,17 @@ char* tea_buf_tmp(tea_State* T, size_t size)
 GCstr* tea_buf_cat2str(tea_State* T, GCstr* s1, GCstr* s2)
 {
     size_t len1 = s1->len, len2 = s2->len;
+    if(len1 + len2 >= TEA_MIN_ROPE)
+    {
+        if(len1 == 0)
+            return s2;
+        if(len2 == 0)
+            return s1;
+        return tea_str_newrope(T, s1, s2);
+    }
     char* buf = tea_buf_tmp(T, len1 + len2);
-    memcpy(buf, str_data(s1), len1);
-    memcpy(buf + len1, str_data(s2), len2);
+    memcpy(buf, str_mem(s1), len1);
+    memcpy(buf + len1, str_mem(s2), len2);
     return tea_str_new(T, buf, len1 + len2);
 }
 
@@ -139,6 +147,7 @@ SBuf* tea_buf_putstr_repeat(tea_State* T, SBuf* sb, GCstr* s, int32_t rep)
     uint32_t len = s->len;
     if(rep > 0 && len)
     {
+        tea_str_flatten(T, s);
         uint64_t tlen = (uint64_t)rep * len;
         char* w;
         if(TEA_UNLIKELY(tlen > TEA_MAX_STR))
@@ -147,15 +156,15 @@ SBuf* tea_buf_putstr_repeat(tea_State* T, SBuf* sb, GCstr* s, int32_t rep)
         if(len == 1)
         {
             /* Optimize a common case */
-            uint32_t c = str_data(s)[0];
+            uint32_t c = str_mem(s)[0];
             do { *w++ = c; } while(--rep > 0);
         }
         else
         {
-            const char* e = str_data(s) + len;
+            const char* e = str_mem(s) + len;
             do
             {
-                const char* q = str_data(s);
+                const char* q = str_mem(s);
                 do { *w++ = *q++; } while(q < e);
             }
             while(--rep > 0);
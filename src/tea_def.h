@@ -19,11 +19,18 @@
 #define TEA_COMPUTED_GOTO
 #endif
 
+/* NaN-boxed values, enable with -DTEA_NANBOX (see Makefile) */
+#ifndef TEA_NANBOX
+#define TEA_NANBOX 0
+#endif
+
 /* Various VM limits */
 #define TEA_MAX_MEM32   0x7fffff00  /* Max. 32 bit memory allocation */
 #define TEA_MAX_MEM64 ((uint64_t)1 << 47) /* Max. 64 bit memory allocation */
 
 #define TEA_MAX_STR TEA_MAX_MEM32   /* Max string length */
+#define TEA_MAX_SHORTSTR 40 /* Max. length of strings interned on creation */
+#define TEA_MIN_ROPE 128    /* Min. length of deferred concatenations */
 #define TEA_MAX_BUF TEA_MAX_MEM32   /* Max. buffer length */
 #define TEA_MAX_UDATA TEA_MAX_MEM32 /* Max. userdata length */
 
@@ -47,6 +54,22 @@
 #define TEA_MAX_UPVAL 256  /* Max. # of upvalues */
 #define TEA_MAX_LOCAL 256  /* Max. # of local variables */
 #define TEA_MAX_VAR 256  /* Max. # of module variables */
+#define TEA_MAX_CONCAT 255  /* Max. # of parts concatenated at once */
+#define TEA_MAX_SHAPE 64   /* Max. # of attributes of a shaped instance */
+#define TEA_MAX_SHAPES 1024  /* Max. # of instance shapes per class */
+
+#define TEA_SLAB_MAXSIZE 256    /* Max. size of slab allocated GC objects */
+#define TEA_SLAB_NCLASS 16  /* # of slab size classes (16 byte steps) */
+#define TEA_LOS_MINSIZE (128 * 1024)    /* Min. size of blocks in the large-object space */
+#define TEA_GC_LIMITSLACK (64 * 1024)   /* Headroom for error handlers beyond the hard memory limit */
+#define TEA_PROF_INTERVAL (512 * 1024)  /* Default allocation sampling interval */
+
+#define TEA_OPTLEVEL 1  /* Default bytecode optimization level */
+
+#define TEA_GC_PAUSE 200    /* Default pause between GC cycles (in %) */
+#define TEA_GC_STEPMUL 200  /* Default GC step multiplier (in %) */
+#define TEA_GC_MINORMUL 20  /* Default heap growth for minor collections (in %) */
+#define TEA_GC_MAJORMUL 100 /* Default heap growth for major collections (in %) */
 
 /* Various macros */
 #ifndef UNUSED
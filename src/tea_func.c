@@ -12,7 +12,7 @@
 
 void TEA_FASTCALL tea_func_freeproto(tea_State* T, GCproto* pt)
 {
-    tea_mem_free(T, pt, pt->sizept);
+    tea_mem_freegco(T, pt, pt->sizept);
 }
 
 /* -- Upvalues -------------------------------------------------- */
@@ -65,13 +65,14 @@ void tea_func_closeuv(tea_State* T, TValue* last)
         GCupval* uv = T->open_upvalues;
         uv->closed = *uv->location;
         uv->location = &uv->closed;
+        tea_gc_barrieruv(T, uv, &uv->closed);
         T->open_upvalues = uv->next;
     }
 }
 
 void TEA_FASTCALL tea_func_freeuv(tea_State* T, GCupval* uv)
 {
-    tea_mem_freet(T, uv);
+    tea_mem_freegcot(T, uv);
 }
 
 /* -- Functions (closures) -------------------------------------------------- */
@@ -144,5 +145,5 @@ void TEA_FASTCALL tea_func_free(tea_State* T, GCfunc* fn)
 {
     size_t size = isteafunc(fn) ? sizeTfunc(fn->t.upvalue_count) :
                 sizeCfunc(fn->c.upvalue_count);
-    tea_mem_free(T, fn, size);
+    tea_mem_freegco(T, fn, size);
 }
\ No newline at end of file
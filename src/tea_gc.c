@@ -6,6 +6,8 @@
 #define tea_gc_c
 #define TEA_CORE
 
+#include <string.h>
+
 #include "tea_gc.h"
 #include "tea_buf.h"
 #include "tea_tab.h"
@@ -15,37 +17,68 @@
 #include "tea_map.h"
 #include "tea_str.h"
 #include "tea_vm.h"
+#include "tea_slab.h"
+#include "tea_prof.h"
+#include "tea_arch.h"
+
+#if TEA_TARGET_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 #ifdef TEA_DEBUG_LOG_GC
 #include <stdio.h>
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+#define GCSTEPSIZE 1024u    /* Bytes of allocation paid by a GC step */
+#define GCSWEEPMAX 40   /* Max. # of objects swept per GC step */
+#define GCSWEEPCOST 10  /* Cost of sweeping an object */
+#define GCFINALIZECOST 100  /* Cost of calling a finalizer */
 
 #define is_finalized(u) ((u)->gch.marked & TEA_GC_FINALIZED)
 
 /* -- Mark phase ---------------------------------------------------------- */
 
-/* Mark a GC object (if needed) */
-static void gc_markobj(tea_State* T, GCobj* obj)
+/* Push a gray object to a gray stack */
+static void gc_push(tea_State* T, GCobj*** stack, uint32_t* count, uint32_t* size, GCobj* obj)
 {
-    if(obj == NULL)
-        return;
-    if(obj->gch.marked)
-        return;
-
-    obj->gch.marked = 1;
-
-    if(T->gc.gray_size < T->gc.gray_count + 1)
+    if(*size < *count + 1)
     {
-        T->gc.gray_size = TEA_MEM_GROW(T->gc.gray_size);
-        T->gc.gray_stack = (GCobj**)T->allocf(T->allocd, T->gc.gray_stack, 0, sizeof(GCobj*) * T->gc.gray_size);
-
-        if(T->gc.gray_stack == NULL)
+        uint32_t new_size = TEA_MEM_GROW(*size);
+        GCobj** p = (GCobj**)T->allocf(T->allocd, *stack,
+                        sizeof(GCobj*) * (*size), sizeof(GCobj*) * new_size);
+        if(p == NULL)
             tea_err_mem(T);
+        *stack = p;
+        *size = new_size;
+    }
+    (*stack)[(*count)++] = obj;
+}
+
+/* Mark a white GC object */
+static void gc_mark(tea_State* T, GCobj* obj)
+{
+    white2gray(obj);
+    if((obj->gch.gct == TEA_TSTR && gco2str(obj)->kind == STR_FLAT) || obj->gch.gct == TEA_TRANGE)
+    {
+        gray2black(obj);    /* No references to traverse */
+        if(TEA_UNLIKELY(T->gc.snapbytes != NULL))
+        {
+            T->gc.snapbytes[obj->gch.gct] += obj->gch.gct == TEA_TSTR ?
+                tea_str_size(gco2str(obj)->len) : sizeof(GCrange);
+        }
+        return;
     }
+    gc_push(T, &T->gc.gray_stack, &T->gc.gray_count, &T->gc.gray_size, obj);
+}
 
-    T->gc.gray_stack[T->gc.gray_count++] = obj;
+/* Mark a GC object (if needed) */
+static void gc_markobj(tea_State* T, GCobj* obj)
+{
+    if(obj != NULL && iswhite(obj))
+        gc_mark(T, obj);
 }
 
 /* Mark a TValue (if needed) */
@@ -55,44 +88,110 @@ static void gc_markval(tea_State* T, TValue* o)
         gc_markobj(T, gcV(o));
 }
 
+/* Check whether a weakly held value has not been marked */
+#define gc_iscleared(o) \
+    (tvisgcv(o) && iswhite(gcV(o)) && !(gcV(o)->gch.marked & TEA_GC_FIXED))
+
+/* Mark the strong parts of a weak map */
+static size_t gc_markweakmap(tea_State* T, GCmap* map)
+{
+    for(uint32_t i = 0; i < map->size; i++)
+    {
+        MapEntry* item = &map->entries[i];
+        if(tvisnil(&item->key))
+            continue;
+        if(!(map->weak & MAP_WEAKKEY))
+            gc_markval(T, &item->key);
+        /* A weakly keyed value is kept alive by its key (ephemeron) */
+        if(!(map->weak & MAP_WEAKVAL) && !gc_iscleared(&item->key))
+            gc_markval(T, &item->val);
+    }
+    return sizeof(GCmap) + sizeof(MapEntry) * map->size;
+}
+
+/* Mark the key and the value of a table entry */
+static void gc_marktabentry(tea_State* T, TabEntry* entry)
+{
+    gc_markobj(T, obj2gco(entry->key));
+    if(entry->flags & (ACC_GET | ACC_SET))
+    {
+        if(entry->flags & ACC_GET)
+            gc_markval(T, &entry->u.acc.get);
+        else
+            gc_markval(T, &entry->u.acc.set);
+    }
+    else
+    {
+        gc_markval(T, &entry->u.val);
+    }
+}
+
 /* Mark table elements */
-void gc_marktab(tea_State* T, Tab* tab)
+static size_t gc_marktab(tea_State* T, Tab* tab)
 {
     for(int i = 0; i < tab->size; i++)
     {
-        TabEntry* entry = &tab->entries[i];
-        gc_markobj(T, obj2gco(entry->key));
-        if(entry->flags & (ACC_GET | ACC_SET))
-        {
-            if(entry->flags & ACC_GET)
-                gc_markval(T, &entry->u.acc.get);
-            else
-                gc_markval(T, &entry->u.acc.set);
-        }
-        else
-        {
-            gc_markval(T, &entry->u.val);
-        }
+        gc_marktabentry(T, &tab->entries[i]);
     }
+    return sizeof(TabEntry) * tab->size;
 }
 
-static void gc_blacken(tea_State* T, GCobj* obj)
+/* Mark the attribute names of a shape and all its transitions */
+static void gc_markshape(tea_State* T, Shape* shape)
 {
+    for(Shape* kid = shape->kids; kid != NULL; kid = kid->next)
+    {
+        gc_markobj(T, obj2gco(kid->key));
+        gc_markshape(T, kid);
+    }
+}
+
+/* Traverse the references of a gray object. Returns its approximate size */
+static size_t gc_blacken(tea_State* T, GCobj* obj)
+{
+    gray2black(obj);
     switch(obj->gch.gct)
     {
+        case TEA_TSTR:
+        {
+            GCstr* s = gco2str(obj);
+            if(s->kind == STR_VIEW)
+            {
+                /* The parent of a view is only marked if something else retains it */
+                StrView* v = str_view(s);
+                if(v->parent == NULL)
+                    return tea_str_objsize(s) + s->len + 1;
+                if(TEA_UNLIKELY(T->gc.snapbytes != NULL))
+                    gc_markobj(T, obj2gco(v->parent));
+                else if(iswhite(obj2gco(v->parent)))
+                    gc_push(T, &T->gc.views, &T->gc.view_count, &T->gc.view_size, obj);
+                return tea_str_objsize(s);
+            }
+            /* Ropes stay with their parts until flattened */
+            StrRope* r = str_rope(s);
+            gc_markobj(T, obj2gco(r->left));
+            gc_markobj(T, obj2gco(r->right));
+            return tea_str_objsize(s) + (r->data ? s->len + 1 : 0);
+        }
         case TEA_TUDATA:
         {
             GCudata* ud = gco2udata(obj);
+            TValue* uvs = ud_uvalues(ud);
             gc_markobj(T, obj2gco(ud->klass));
-            gc_marktab(T, &ud->attrs);
-            break;
+            if(ud->udtype != UDTYPE_WEAKREF)
+            {
+                for(int i = 0; i < ud->nuvals; i++)
+                {
+                    gc_markval(T, &uvs[i]);
+                }
+            }
+            return tea_udata_size(ud->len, ud->nuvals) + gc_marktab(T, &ud->attrs);
         }
         case TEA_TMODULE:
         {
             GCmodule* module = gco2module(obj);
             gc_markobj(T, obj2gco(module->name));
             gc_markobj(T, obj2gco(module->path));
-            gc_marktab(T, &module->exports);
             for(int i = 0; i < module->size; i++)
             {
                 gc_markobj(T, obj2gco(module->varnames[i]));
@@ -101,7 +200,8 @@ static void gc_blacken(tea_State* T, GCobj* obj)
             {
                 gc_markval(T, &module->vars[i]);
             }
-            break;
+            return sizeof(GCmodule) + (sizeof(TValue) + sizeof(GCstr*)) * module->size +
+                   gc_marktab(T, &module->exports);
         }
         case TEA_TLIST:
         {
@@ -110,33 +210,36 @@ static void gc_blacken(tea_State* T, GCobj* obj)
             {
                 gc_markval(T, list_slot(list, i));
             }
-            break;
+            return sizeof(GClist) + sizeof(TValue) * list->size;
         }
         case TEA_TMAP:
         {
             GCmap* map = gco2map(obj);
+            if(TEA_UNLIKELY(map->weak & MAP_WEAKMODE))
+                return gc_markweakmap(T, map);
             for(int i = 0; i < map->size; i++)
             {
                 MapEntry* item = &map->entries[i];
                 gc_markval(T, &item->key);
                 gc_markval(T, &item->val);
             }
-            break;
+            return sizeof(GCmap) + sizeof(MapEntry) * map->size;
         }
         case TEA_TMETHOD:
         {
             GCmethod* bound = gco2method(obj);
             gc_markval(T, &bound->receiver);
             gc_markobj(T, obj2gco(bound->func));
-            break;
+            return sizeof(GCmethod);
         }
         case TEA_TCLASS:
         {
             GCclass* klass = gco2class(obj);
             gc_markobj(T, obj2gco(klass->name));
             gc_markobj(T, obj2gco(klass->super));
-            gc_marktab(T, &klass->methods);
-            break;
+            if(klass->shape)
+                gc_markshape(T, klass->shape);
+            return sizeof(GCclass) + gc_marktab(T, &klass->methods);
         }
         case TEA_TFUNC:
         {
@@ -148,6 +251,7 @@ static void gc_blacken(tea_State* T, GCobj* obj)
                 {
                     gc_markobj(T, obj2gco(func->t.upvalues[i]));
                 }
+                return sizeTfunc(func->t.upvalue_count);
             }
             else
             {
@@ -155,8 +259,8 @@ static void gc_blacken(tea_State* T, GCobj* obj)
                 {
                     gc_markval(T, &func->c.upvalues[i]);
                 }
+                return sizeCfunc(func->c.upvalue_count);
             }
-            break;
         }
         case TEA_TPROTO:
         {
@@ -166,27 +270,54 @@ static void gc_blacken(tea_State* T, GCobj* obj)
             {
                 gc_markval(T, proto_kgc(pt, i));
             }
-            break;
+            return pt->sizept;
         }
         case TEA_TINSTANCE:
         {
             GCinstance* instance = gco2instance(obj);
             gc_markobj(T, obj2gco(instance->klass));
-            gc_marktab(T, &instance->attrs);
-            break;
+            if(instance->shape)
+            {
+                for(uint32_t i = 0; i < instance->shape->nslots; i++)
+                {
+                    gc_markval(T, &instance->slots[i]);
+                }
+            }
+            return sizeof(GCinstance) + sizeof(TValue) * instance->size +
+                   gc_marktab(T, &instance->attrs);
         }
         case TEA_TUPVAL:
         {
             GCupval* uv = gco2uv(obj);
             gc_markval(T, &uv->closed);
-            break;
+            return sizeof(GCupval);
         }
-        case TEA_TSTR:
-        case TEA_TRANGE:
-            break;
+        default:
+            tea_assertT(0, "bad GC type %d", obj->gch.gct);
+            return 0;
     }
 }
 
+/* Propagate one gray object. Returns the amount of work done */
+static size_t gc_propagate(tea_State* T)
+{
+    GCobj* obj = T->gc.gray_stack[--T->gc.gray_count];
+    tea_assertT(isgray(obj), "propagation of non-gray object");
+    size_t m = gc_blacken(T, obj);
+    if(TEA_UNLIKELY(T->gc.snapbytes != NULL))
+        T->gc.snapbytes[obj->gch.gct] += m;
+    return m;
+}
+
+/* Propagate all gray objects */
+static size_t gc_propagate_all(tea_State* T)
+{
+    size_t m = 0;
+    while(T->gc.gray_count > 0)
+        m += gc_propagate(T);
+    return m;
+}
+
 /* Mark GC roots */
 static void gc_mark_roots(tea_State* T)
 {
@@ -221,14 +352,32 @@ static void gc_mark_mmudata(tea_State* T)
     GCobj* obj;
     for(obj = T->gc.mmudata; obj; obj = obj->gch.nextgc)
     {
-        obj->gch.marked = 0;
-        gc_blacken(T, obj);
+        makewhite(T, obj);
+        gc_mark(T, obj);
     }
 }
 
+/* Append a list of old objects to a GC list */
+static void gc_appendold(GCobj** p, GCobj** old)
+{
+    while(*p != NULL)
+        p = &(*p)->gch.nextgc;
+    *p = *old;
+    *old = NULL;
+}
+
+/* Put the old objects of the generational mode back into the main lists */
+static void gc_mergeold(tea_State* T)
+{
+    gc_appendold(&T->gc.root, &T->gc.oldroot);
+    gc_appendold(&T->gc.rootud, &T->gc.oldud);
+}
+
 /* Separate userdata objects to be finalized to mmudata list */
-void tea_gc_separateudata(tea_State* T)
+void tea_gc_separateudata(tea_State* T, bool all)
 {
+    if(all)
+        gc_mergeold(T); /* Old userdata of the generational mode, too */
     GCobj** p = &T->gc.rootud;
     GCobj* curr;
     GCobj* collected = NULL; /* to collect udata with gc event */
@@ -237,7 +386,7 @@ void tea_gc_separateudata(tea_State* T)
     {
         tea_assertT(curr->gch.gct == TEA_TUDATA, "trying to separate non-userdata");
         GCudata* ud = gco2udata(curr);
-        if((curr->gch.marked == 1) || is_finalized(curr))
+        if(!(iswhite(curr) || all) || is_finalized(curr))
             p = &curr->gch.nextgc;    /* Don't bother with them */
         else if(tea_tab_get(&ud->klass->methods, mmname_str(T, MM_GC)) == NULL)
         {
@@ -258,6 +407,177 @@ void tea_gc_separateudata(tea_State* T)
     T->gc.mmudata = collected;
 }
 
+/* -- Weak maps and weak references -------------------------------------- */
+
+/* Add a weak map or weak reference to the list of weak objects */
+void tea_gc_weak(tea_State* T, GCobj* o)
+{
+    gc_push(T, &T->gc.weak, &T->gc.weak_count, &T->gc.weak_size, o);
+}
+
+/* Mark the values of live weakly keyed entries. Returns true if anything was marked */
+static bool gc_markephemerons(tea_State* T)
+{
+    bool marked = false;
+    for(uint32_t i = 0; i < T->gc.weak_count; i++)
+    {
+        GCobj* o = T->gc.weak[i];
+        if(iswhite(o) || o->gch.gct != TEA_TMAP ||
+           (gco2map(o)->weak & MAP_WEAKMODE) != MAP_WEAKKEY)
+            continue;
+        GCmap* map = gco2map(o);
+        for(uint32_t j = 0; j < map->size; j++)
+        {
+            MapEntry* item = &map->entries[j];
+            if(!tvisnil(&item->key) && !gc_iscleared(&item->key) && gc_iscleared(&item->val))
+            {
+                gc_markval(T, &item->val);
+                marked = true;
+            }
+        }
+    }
+    return marked;
+}
+
+/* Propagate marks until no more weakly keyed value becomes reachable */
+static void gc_convergeweak(tea_State* T)
+{
+    do
+    {
+        gc_propagate_all(T);
+    }
+    while(gc_markephemerons(T));
+}
+
+/* Remove the entries of weak maps with unmarked weak parts */
+static void gc_clearweak(tea_State* T, bool keys)
+{
+    for(uint32_t i = 0; i < T->gc.weak_count; i++)
+    {
+        GCobj* o = T->gc.weak[i];
+        if(o->gch.gct == TEA_TUDATA)
+        {
+            TValue* uv = ud_uvalues(gco2udata(o));
+            if(gc_iscleared(uv))
+                setnilV(uv);
+            continue;
+        }
+        GCmap* map = gco2map(o);
+        uint8_t weak = map->weak;
+        if(!(weak & MAP_WEAKVAL) && !(keys && (weak & MAP_WEAKKEY)))
+            continue;
+        for(uint32_t j = 0; j < map->size; j++)
+        {
+            MapEntry* item = &map->entries[j];
+            if(tvisnil(&item->key))
+                continue;
+            if(((weak & MAP_WEAKVAL) && gc_iscleared(&item->val)) ||
+               (keys && (weak & MAP_WEAKKEY) && gc_iscleared(&item->key)))
+            {
+                /* Leave a tombstone, the map is not resized during the GC */
+                setnilV(&item->key);
+                settrueV(&item->val);
+                map->count--;
+            }
+        }
+    }
+}
+
+/* Drop the weak objects that are about to be swept */
+static void gc_pruneweak(tea_State* T)
+{
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < T->gc.weak_count; i++)
+    {
+        GCobj* o = T->gc.weak[i];
+        if(!iswhite(o))
+            T->gc.weak[n++] = o;
+    }
+    T->gc.weak_count = n;
+}
+
+/* -- String views -------------------------------------------------------- */
+
+/*
+** A view keeps its parent alive only until the GC finds out that nothing
+** else retains it. Then the contents of the view are copied, so a short
+** part does not keep a large input alive. The atomic phase must not
+** allocate, so it marks these parents once more and keeps their views,
+** which are copied when the sweep is done
+*/
+static void gc_markviews(tea_State* T)
+{
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < T->gc.view_count; i++)
+    {
+        GCstr* parent = str_view(gco2str(T->gc.views[i]))->parent;
+        if(parent != NULL && iswhite(obj2gco(parent)) &&
+           !(parent->marked & TEA_GC_FIXED))
+            T->gc.views[n++] = T->gc.views[i];
+    }
+    T->gc.view_count = n;
+    for(uint32_t i = 0; i < n; i++)
+    {
+        gc_markobj(T, obj2gco(str_view(gco2str(T->gc.views[i]))->parent));
+    }
+    gc_propagate_all(T);
+}
+
+/* Copy the contents of the views kept by gc_markviews() */
+static void gc_cutviews(tea_State* T)
+{
+    if(T->gc.view_count == 0)
+        return;
+    /* The copies replace the parents, which must not fail on the memory limit */
+    size_t limit = T->gc.memlimit;
+    T->gc.memlimit = SIZE_MAX;
+    for(uint32_t i = 0; i < T->gc.view_count; i++)
+    {
+        GCstr* s = gco2str(T->gc.views[i]);
+        if(str_isview(s))   /* Unless copied by tea_str_data() since */
+            tea_str_viewcopy(T, s);
+    }
+    T->gc.memlimit = limit;
+    T->gc.view_count = 0;
+}
+
+/* Mark everything that is still reachable and flip the current white */
+static void gc_atomic(tea_State* T)
+{
+    gc_propagate_all(T);
+
+    /* The stack and the root tables are stored to without barriers */
+    gc_mark_roots(T);
+    gc_propagate_all(T);
+
+    /* Objects grayed again by write barriers */
+    while(T->gc.grayagain_count > 0)
+    {
+        GCobj* obj = T->gc.grayagain[--T->gc.grayagain_count];
+        gc_push(T, &T->gc.gray_stack, &T->gc.gray_count, &T->gc.gray_size, obj);
+    }
+    gc_convergeweak(T);
+
+    /* Weak values must not see userdata that is about to be finalized */
+    gc_clearweak(T, false);
+
+    tea_gc_separateudata(T, false);    /* Separate userdata to be finalized */
+    gc_mark_mmudata(T);     /* Mark them */
+    gc_convergeweak(T);     /* And propagate the marks */
+
+    /* All marking done, clear the weak parts that were not marked */
+    gc_clearweak(T, true);
+    gc_pruneweak(T);
+    gc_markviews(T);
+
+    /* All marking done, prepare the sweep */
+    T->gc.currentwhite = tea_gc_otherwhite(T);
+    T->gc.sweepstr = 0;
+    T->gc.sweep = &T->gc.root;
+    T->gc.estimate = T->gc.total;
+    T->icepoch++;   /* Cached classes may be freed */
+}
+
 /* -- Sweep phase --------------------------------------------------------- */
 
 /* Type of GC free functions */
@@ -281,78 +601,373 @@ static const GCFreeFunc gc_freefunc[] = {
 
 static void gc_free(tea_State* T, GCobj* obj)
 {
+    size_t old = T->gc.total;
     gc_freefunc[obj->gch.gct - TEA_TSTR](T, obj);
+    T->gc.cyclefreed += old - T->gc.total;
 }
 
-/* Sweep of a GC list */
-static void gc_sweep(tea_State* T, GCobj** p)
+/* Partial sweep of a GC list */
+static GCobj** gc_sweep(tea_State* T, GCobj** p, uint32_t lim)
 {
-    GCobj* prev = NULL;
-    GCobj* obj = *p;
-
-    while(obj != NULL)
+    GCobj* obj;
+    while((obj = *p) != NULL && lim-- > 0)
     {
-        if(obj->gch.marked)
+        if(isdead(T, obj) && !(obj->gch.marked & TEA_GC_FIXED))
         {
-            if(!(obj->gch.marked & TEA_GC_FIXED))
-                obj->gch.marked = 0;
-            prev = obj;
-            obj = obj->gch.nextgc;
+            *p = obj->gch.nextgc;
+            gc_free(T, obj);
         }
         else
         {
-            GCobj* unreached = obj;
-            obj = obj->gch.nextgc;
-            if(prev != NULL)
+            /* Make it white for the next cycle, generational survivors stay black (old) */
+            if(T->gc.kind != GCKgen || iswhite(obj))
+                makewhite(T, obj);
+            p = &obj->gch.nextgc;
+        }
+    }
+    return p;
+}
+
+/* Full sweep of a GC list */
+#define gc_sweepall(T, p) gc_sweep((T), (p), UINT32_MAX)
+
+/* Shrink the string table and temporary buffers, if possible */
+static void gc_shrink(tea_State* T)
+{
+    if(T->str.num < (T->str.size >> 2) && T->str.size > TEA_MIN_STRTAB * 2)
+    {
+        /* The new table is allocated first, which must not fail on the memory limit */
+        size_t limit = T->gc.memlimit;
+        T->gc.memlimit = SIZE_MAX;
+        tea_str_resize(T, T->str.size >> 1);    /* Shrink string table */
+        T->gc.memlimit = limit;
+    }
+    tea_buf_shrink(T, &T->tmpbuf);  /* Shrink temp buffer */
+    tea_buf_shrink(T, &T->strbuf);  /* Shrink string buffer */
+    tea_slab_shrink(T); /* Release unused slab chunks */
+}
+
+/* Finalize one userdata object from mmudata list */
+static void gc_finalize(tea_State* T)
+{
+    GCobj* obj = T->gc.mmudata;
+    GCudata* ud = gco2udata(obj);
+    T->gc.mmudata = obj->gch.nextgc;  /* Remove userdata from mmudata list */
+    obj->gch.nextgc = T->gc.rootud;   /* Add it back to the 'rootud' list */
+    T->gc.rootud = obj;
+    makewhite(T, obj);
+    mark_finalized(ud);
+    cTValue* mo = tea_tab_get(&ud->klass->methods, mmname_str(T, MM_GC));
+    if(mo != NULL)
+    {
+        size_t old_gc = T->gc.next_gc;
+        T->gc.next_gc = 2 * T->gc.total;    /* Avoid GC steps during the finalizer */
+        setudataV(T, T->top++, ud);
+        tea_vm_call(T, (TValue*)mo, 0);
+        T->top--;
+        T->gc.next_gc = old_gc;
+    }
+}
+
+/* Finalize all userdata objects from mmudata list */
+void tea_gc_finalize_udata(tea_State* T)
+{
+    while(T->gc.mmudata != NULL)
+        gc_finalize(T);
+}
+
+/* -- Collector -------------------------------------------------- */
+
+/* Update the statistics at the end of a GC cycle */
+static void gc_endcycle(tea_State* T, bool minor)
+{
+    if(minor)
+        T->gc.minors++;
+    else
+        T->gc.cycles++;
+    T->gc.freed = T->gc.cyclefreed;
+    T->gc.totalfreed += T->gc.cyclefreed;
+    T->gc.cyclefreed = 0;
+    tea_gc_setlimit(T);
+}
+
+/* Perform a single step of the collector. Returns the amount of work done */
+static size_t gc_onestep(tea_State* T)
+{
+    switch(T->gc.state)
+    {
+        case GCSpause:
+        {
+            gc_mark_roots(T);
+            T->gc.state = GCSpropagate;
+            return 0;
+        }
+        case GCSpropagate:
+        {
+            if(T->gc.gray_count > 0)
+                return gc_propagate(T);
+            T->gc.state = GCSatomic;
+            gc_atomic(T);
+            if(T->gc.kind == GCKmajor)
+            {
+                /*
+                ** Generational major collection: the survivors of the sweep
+                ** become the old generation, objects allocated while the
+                ** sweep is in progress are young
+                */
+                T->gc.kind = GCKgen;
+                T->gc.oldroot = T->gc.root;
+                T->gc.oldud = T->gc.rootud;
+                T->gc.root = NULL;
+                T->gc.rootud = NULL;
+                T->gc.sweep = &T->gc.oldroot;
+            }
+            T->gc.state = GCSsweepstring;
+            return 0;
+        }
+        case GCSsweepstring:
+        {
+            size_t old = T->gc.total;
+            if(T->gc.sweepstr < T->str.size)
+                gc_sweepall(T, &T->str.hash[T->gc.sweepstr++]);
+            if(T->gc.sweepstr >= T->str.size)
+                T->gc.state = GCSsweep;
+            tea_assertT(old >= T->gc.total, "sweep increased memory");
+            T->gc.estimate -= old - T->gc.total;
+            return GCSWEEPCOST;
+        }
+        case GCSsweep:
+        case GCSsweepud:
+        {
+            size_t old = T->gc.total;
+            T->gc.sweep = gc_sweep(T, T->gc.sweep, GCSWEEPMAX);
+            if(*T->gc.sweep == NULL)
+            {
+                if(T->gc.state == GCSsweep)
+                {
+                    T->gc.sweep = T->gc.kind == GCKgen ? &T->gc.oldud : &T->gc.rootud;
+                    T->gc.state = GCSsweepud;
+                }
+                else
+                {
+                    gc_shrink(T);
+                    T->gc.state = GCSfinalize;
+                }
+            }
+            tea_assertT(old >= T->gc.total, "sweep increased memory");
+            T->gc.estimate -= old - T->gc.total;
+            return GCSWEEPMAX * GCSWEEPCOST;
+        }
+        case GCSfinalize:
+        {
+            gc_cutviews(T);
+            if(T->gc.mmudata != NULL)
+            {
+                gc_finalize(T);
+                if(T->gc.estimate > GCFINALIZECOST)
+                    T->gc.estimate -= GCFINALIZECOST;
+                return GCFINALIZECOST;
+            }
+            if(T->gc.kind == GCKgen)
             {
-                prev->gch.nextgc = obj;
+                /* End of a major collection, back to minor collections */
+                T->gc.state = GCSpropagate;
+                T->gc.lastmajor = T->gc.total;
             }
             else
             {
-                *p = obj;
+                T->gc.state = GCSpause;
             }
-            gc_free(T, unreached);
+            T->gc.debt = 0;
+            gc_endcycle(T, false);
+            return 0;
         }
+        default:
+            tea_assertT(0, "bad GC state");
+            return 0;
     }
 }
 
-/* Finalize all userdata objects from mmudata list */
-void tea_gc_finalize_udata(tea_State* T)
+/* Check whether a GC cycle has finished */
+static bool gc_cycledone(tea_State* T)
 {
-    T->top++;
-    while(T->gc.mmudata != NULL)
+    if(T->gc.kind == GCKinc)
+        return T->gc.state == GCSpause;
+    return T->gc.kind == GCKgen && T->gc.state == GCSpropagate;
+}
+
+/* Set the memory threshold for the next GC cycle */
+static void gc_setthreshold(tea_State* T)
+{
+    if(T->gc.stopped)
+        T->gc.next_gc = SIZE_MAX;
+    else if(T->gc.kind == GCKgen)
+        T->gc.next_gc = T->gc.total + (T->gc.total / 100) * T->gc.minormul;
+    else
+        T->gc.next_gc = (T->gc.estimate / 100) * T->gc.pause;
+}
+
+/* Throw away the gray lists and restart sweeping, to make all objects white */
+static void gc_restartsweep(tea_State* T)
+{
+    gc_mergeold(T);
+    T->gc.gray_count = 0;
+    T->gc.grayagain_count = 0;
+    T->gc.view_count = 0;
+    T->gc.sweepstr = 0;
+    T->gc.sweep = &T->gc.root;
+    T->gc.state = GCSsweepstring;
+}
+
+/* Abort any marking and finish the sweep, leaving all live objects white */
+static void gc_whiten(tea_State* T)
+{
+    uint8_t kind = T->gc.kind;
+    if(kind == GCKgen || T->gc.state <= GCSatomic)
+        gc_restartsweep(T);
+    T->gc.kind = GCKinc;
+    while(T->gc.state != GCSfinalize)
     {
-        GCobj* obj = T->gc.mmudata;
-        GCudata* ud = gco2udata(obj);
-        T->gc.mmudata = obj->gch.nextgc;  /* Remove userdata from mmudata list */
-        obj->gch.nextgc = T->gc.rootud;   /* Add it back to the 'rootud' list */
-        T->gc.rootud = obj;
-        setudataV(T, T->top - 1, ud);   /* Keep a reference to it */
-        obj->gch.marked = 0;
-        mark_finalized(ud);
-        cTValue* mo = tea_tab_get(&ud->klass->methods, mmname_str(T, MM_GC));
-        if(mo != NULL)
+        gc_onestep(T);
+    }
+    T->gc.kind = kind == GCKinc ? GCKinc : GCKgen;
+}
+
+/*
+** Minor collection of the generational mode. Old objects are black and
+** are neither traversed nor swept. Old objects that were stored to since
+** the last collection are grayed by the write barriers and collected in
+** the grayagain list, which acts as the remembered set.
+*/
+static void gc_minor(tea_State* T)
+{
+    gc_atomic(T);
+    for(uint32_t i = 0; i < T->str.size; i++)
+    {
+        gc_sweepall(T, &T->str.hash[i]);
+    }
+    /* All survivors are old now */
+    *gc_sweepall(T, &T->gc.root) = T->gc.oldroot;
+    *gc_sweepall(T, &T->gc.rootud) = T->gc.oldud;
+    T->gc.oldroot = T->gc.root;
+    T->gc.oldud = T->gc.rootud;
+    T->gc.root = NULL;
+    T->gc.rootud = NULL;
+    gc_cutviews(T);
+    gc_shrink(T);
+    tea_gc_finalize_udata(T);
+    gc_endcycle(T, true);
+}
+
+/* Perform a limited amount of GC steps */
+static void gc_step(tea_State* T)
+{
+    if(T->gc.kind == GCKgen && T->gc.state == GCSpropagate)
+    {
+        if(T->gc.total <= T->gc.lastmajor + (T->gc.lastmajor / 100) * T->gc.majormul)
+        {
+            gc_minor(T);
+            gc_setthreshold(T);
+            return;
+        }
+        /*
+        ** Too much old garbage: start a major collection. It runs in
+        ** incremental steps, including the sweep of the old generation
+        */
+        gc_restartsweep(T);
+        T->gc.kind = GCKmajor;
+    }
+    size_t lim = (GCSTEPSIZE / 100) * T->gc.stepmul;
+    if(lim == 0)
+        lim = SIZE_MAX;
+    if(T->gc.total > T->gc.next_gc)
+        T->gc.debt += T->gc.total - T->gc.next_gc;
+    for(;;)
+    {
+        size_t work = gc_onestep(T);
+        if(gc_cycledone(T))
         {
-            setudataV(T, T->top++, ud);
-            tea_vm_call(T, (TValue*)mo, 0);
-            T->top--;
+            gc_setthreshold(T);
+            return;
         }
+        if(work >= lim)
+            break;
+        lim -= work;
+    }
+    if(T->gc.debt < GCSTEPSIZE)
+    {
+        T->gc.next_gc = T->gc.total + GCSTEPSIZE;
+    }
+    else
+    {
+        T->gc.debt -= GCSTEPSIZE;
+        T->gc.next_gc = T->gc.total;
     }
-    T->top--;
 }
 
-static void gc_trace_references(tea_State* T)
+/* Perform a limited amount of GC steps and account for the time spent */
+/* Monotonic clock in seconds, cheap enough to be read around every step */
+static double gc_clock(void)
 {
-    while(T->gc.gray_count > 0)
+#if TEA_TARGET_WINDOWS
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#elif TEA_TARGET_POSIX && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void tea_gc_step(tea_State* T)
+{
+    if(TEA_UNLIKELY(T->gc.emergency))
     {
-        GCobj* obj = T->gc.gray_stack[--T->gc.gray_count];
-        gc_blacken(T, obj);
+        /* Over a memory limit: collect everything and shrink the tables */
+        bool hard = T->gc.emergency == GCEhard;
+        T->gc.emergency = GCEnone;
+        /* The scratch buffers are dead at a safe point, release them */
+        tea_buf_free(T, &T->tmpbuf);
+        tea_buf_init(&T->tmpbuf);
+        tea_buf_free(T, &T->strbuf);
+        tea_buf_init(&T->strbuf);
+        tea_gc_collect(T);
+        if(hard && T->gc.total > T->gc.hardlimit)
+        {
+            /* Still over the hard limit, leave some headroom for the error handlers */
+            T->gc.emergency = GCEsoft;
+            T->gc.next_gc = 0;
+            T->gc.memlimit = T->gc.total + TEA_GC_LIMITSLACK;
+            tea_err_mem(T);
+        }
+        return;
     }
+    double start = gc_clock();
+    gc_step(T);
+    if(T->gc.stopped)
+        T->gc.next_gc = SIZE_MAX;
+    T->gc.pausetime += gc_clock() - start;
 }
 
-/* -- Collector -------------------------------------------------- */
+/* Perform GC steps worth kb Kbytes of allocation. Returns true if a cycle finished */
+bool tea_gc_stepk(tea_State* T, size_t kb)
+{
+    size_t a = kb << 10;
+    T->gc.next_gc = a <= T->gc.total ? T->gc.total - a : 0;
+    while(T->gc.next_gc <= T->gc.total)
+    {
+        tea_gc_step(T);
+        if(gc_cycledone(T))
+            return true;
+    }
+    return false;
+}
 
-/* Perform a GC collection */
+/* Perform a full GC collection */
 void tea_gc_collect(tea_State* T)
 {
 #ifdef TEA_DEBUG_LOG_GC
@@ -360,40 +975,292 @@ void tea_gc_collect(tea_State* T)
     size_t before = T->gc.total;
 #endif
 
-    gc_mark_roots(T);
-    gc_trace_references(T);
+    double start = gc_clock();
+    gc_whiten(T);
+    /* Run a complete cycle */
+    T->gc.state = GCSpause;
+    if(T->gc.kind == GCKgen)
+        T->gc.kind = GCKmajor;
+    do
+    {
+        gc_onestep(T);
+    }
+    while(!gc_cycledone(T));
+    gc_setthreshold(T);
+    T->gc.pausetime += gc_clock() - start;
 
-    tea_gc_separateudata(T);    /* Separate userdata to be finalized */
-    gc_mark_mmudata(T);     /* Mark them */
-    gc_trace_references(T); /* And propagate the marks */
+#ifdef TEA_DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %llu bytes (from %llu to %llu) next at %llu\n", before - T->gc.total, before, T->gc.total, T->gc.next_gc);
+#endif
+}
 
-    gc_sweep(T, &T->gc.rootud);
-    for(int i = 0; i < T->str.size; i++)
+/* Switch between the incremental and the generational mode */
+void tea_gc_changemode(tea_State* T, uint8_t kind)
+{
+    if((kind == GCKinc) == (T->gc.kind == GCKinc))
+        return;
+    if(kind == GCKgen)
+    {
+        T->gc.kind = GCKgen;
+        tea_gc_collect(T);  /* Start with all live objects old */
+    }
+    else
     {
-        gc_sweep(T, &T->str.hash[i]);
+        gc_whiten(T);   /* Pending finalizers run in the next steps */
+        T->gc.kind = GCKinc;
+        T->gc.estimate = T->gc.total;
+        gc_setthreshold(T);
     }
-    gc_sweep(T, &T->gc.root);
+}
 
-    if(T->str.num < (T->str.size >> 2) && T->str.size > TEA_MIN_STRTAB * 2)
+/* Count the objects of a GC list per type */
+static void gc_countlist(GCobj* obj, size_t* counts)
+{
+    for(; obj != NULL; obj = obj->gch.nextgc)
     {
-        tea_str_resize(T, T->str.size >> 1);    /* Shrink string table */
+        counts[obj->gch.gct - TEA_TSTR]++;
     }
-    tea_buf_shrink(T, &T->tmpbuf);  /* Shrink temp buffer */
-    tea_buf_shrink(T, &T->strbuf);  /* Shrink string buffer */
+}
+
+/* Count all GC objects per type, indexed by tag - TEA_TSTR */
+void tea_gc_countobj(tea_State* T, size_t* counts)
+{
+    gc_countlist(T->gc.root, counts);
+    gc_countlist(T->gc.oldroot, counts);
+    gc_countlist(T->gc.rootud, counts);
+    gc_countlist(T->gc.oldud, counts);
+    gc_countlist(T->gc.mmudata, counts);
+    counts[0] += T->str.num;
+}
 
-    T->gc.next_gc = T->gc.total * GC_HEAP_GROW_FACTOR;
+/* -- Memory limits ------------------------------------------------------- */
 
-    tea_gc_finalize_udata(T);
+/*
+** Set the memory use at which the allocator checks the limits again.
+** Without a soft limit, emergency collections start at 7/8 of the hard
+** limit. While the live heap stays above the soft limit, the next
+** emergency collection waits until it has grown by another 1/8
+*/
+void tea_gc_setlimit(tea_State* T)
+{
+    size_t hard = T->gc.hardlimit;
+    size_t soft = T->gc.softlimit;
+    if(soft == SIZE_MAX && hard != SIZE_MAX)
+        soft = hard - (hard >> 3);
+    if(soft != SIZE_MAX && T->gc.total >= soft)
+        soft = T->gc.total + (T->gc.total >> 3);
+    T->gc.memlimit = soft < hard ? soft : hard;
+}
 
-#ifdef TEA_DEBUG_LOG_GC
-    printf("-- gc end\n");
-    printf("   collected %llu bytes (from %llu to %llu) next at %llu\n", before - T->gc.total, before, T->gc.total, T->gc.next_gc);
-#endif
+/*
+** Handle an allocation of size bytes crossing a memory limit. The collector
+** only runs at safe points, so an allocation crossing the hard limit by at
+** most the slack is let through and the emergency collection at the next
+** safe point decides whether to raise the memory error. A larger overrun or
+** another allocation crossing the hard limit before that point raises it
+** right away
+*/
+void tea_gc_overlimit(tea_State* T, size_t size)
+{
+    T->gc.next_gc = 0;
+    if(T->gc.total + size > T->gc.hardlimit)
+    {
+        if(T->gc.emergency == GCEhard ||
+           T->gc.total + size - T->gc.hardlimit > TEA_GC_LIMITSLACK)
+        {
+            /* Leave some headroom for the error handlers until the collection */
+            T->gc.emergency = GCEsoft;
+            T->gc.memlimit = (T->gc.total > T->gc.hardlimit ? T->gc.total : T->gc.hardlimit) +
+                TEA_GC_LIMITSLACK;
+            tea_err_mem(T);
+        }
+        T->gc.emergency = GCEhard;
+        T->gc.memlimit = T->gc.total + size + TEA_GC_LIMITSLACK;
+        return;
+    }
+    T->gc.emergency = GCEsoft;
+    T->gc.memlimit = T->gc.hardlimit;
+}
+
+/* -- Heap snapshots ------------------------------------------------------ */
+
+/* Attribute the objects marked from the current root to its path */
+static void gc_snapflush(tea_State* T, ProfState* ps)
+{
+    ProfBuf* path = &ps->key;
+    size_t len = path->len;
+    gc_propagate_all(T);
+    for(int i = TEA_TSTR; i <= TEA_TMETHOD; i++)
+    {
+        if(ps->snapbytes[i] == 0)
+            continue;
+        tea_prof_putlit(T, path, ";");
+        tea_prof_putmem(T, path, tea_obj_typenames[i], strlen(tea_obj_typenames[i]));
+        tea_prof_add(T, &ps->snapshot, path->b, path->len, ps->snapbytes[i]);
+        ps->snapbytes[i] = 0;
+        path->len = len;
+    }
+}
+
+/* Start the path of a root */
+static void gc_snaproot(tea_State* T, ProfState* ps, const char* root, GCstr* name)
+{
+    ProfBuf* path = &ps->key;
+    path->len = 0;
+    tea_prof_putmem(T, path, root, strlen(root));
+    if(name != NULL)
+    {
+        tea_prof_putlit(T, path, ";");
+        tea_prof_putmem(T, path, str_mem(name), name->len);
+    }
+}
+
+/* Mark the objects of a GC list that no root retains */
+static void gc_snapunreached(tea_State* T, GCobj* obj)
+{
+    for(; obj != NULL; obj = obj->gch.nextgc)
+    {
+        if(iswhite(obj))
+            gc_mark(T, obj);
+    }
+}
+
+/*
+** Take a heap snapshot. After a full collection, the live objects are
+** marked again one root at a time, so every object is attributed to the
+** first root that retains it: the stack frames, the variables of each
+** module, the globals and the internal roots. The module objects are
+** claimed first, so that an imported module is not attributed to the
+** variable it was imported as
+*/
+void tea_gc_snapshot(tea_State* T, ProfState* ps)
+{
+    tea_gc_collect(T);
+    gc_whiten(T);
+    memset(ps->snapbytes, 0, sizeof(ps->snapbytes));
+    T->gc.snapbytes = ps->snapbytes;
+
+    /* Claim the cached modules, they are traversed one variable at a time below */
+    for(uint32_t i = 0; i < T->modules.size; i++)
+    {
+        TabEntry* entry = &T->modules.entries[i];
+        if(entry->key != NULL && tvismodule(&entry->u.val) &&
+           iswhite(gcV(&entry->u.val)))
+            white2gray(gcV(&entry->u.val));
+    }
+
+    /* Stack frames, with the slots below a call attributed to the caller */
+    TValue* slot = T->stack;
+    gc_snaproot(T, ps, "stack", NULL);
+    for(CallInfo* ci = T->ci_base; ci <= T->ci; ci++)
+    {
+        TValue* end = ci < T->ci ? (ci + 1)->base : T->top;
+        if(ci > T->ci_base)
+        {
+            tea_prof_putlit(T, &ps->key, ";");
+            tea_prof_putframe(T, &ps->key, ci);
+        }
+        gc_markobj(T, obj2gco(ci->func));
+        for(; slot < end; slot++)
+        {
+            gc_markval(T, slot);
+        }
+        gc_snapflush(T, ps);
+    }
+    gc_snaproot(T, ps, "stack", NULL);
+    for(GCupval* uv = T->open_upvalues; uv != NULL; uv = uv->next)
+    {
+        gc_markobj(T, obj2gco(uv));
+    }
+    gc_snapflush(T, ps);
+
+    /* Module variables and exports */
+    for(uint32_t i = 0; i < T->modules.size; i++)
+    {
+        TabEntry* entry = &T->modules.entries[i];
+        if(entry->key == NULL || !tvismodule(&entry->u.val))
+            continue;
+        GCmodule* module = moduleV(&entry->u.val);
+        if(!isgray(obj2gco(module)))
+            continue;
+        for(int j = 0; j < module->size; j++)
+        {
+            gc_snaproot(T, ps, "modules", module->name);
+            tea_prof_putlit(T, &ps->key, ";");
+            tea_prof_putmem(T, &ps->key, str_mem(module->varnames[j]), module->varnames[j]->len);
+            gc_markval(T, &module->vars[j]);
+            gc_snapflush(T, ps);
+        }
+        for(uint32_t j = 0; j < module->exports.size; j++)
+        {
+            TabEntry* e = &module->exports.entries[j];
+            if(e->key == NULL)
+                continue;
+            gc_snaproot(T, ps, "modules", module->name);
+            tea_prof_putlit(T, &ps->key, ";");
+            tea_prof_putmem(T, &ps->key, str_mem(e->key), e->key->len);
+            gc_marktabentry(T, e);
+            gc_snapflush(T, ps);
+        }
+        gc_snaproot(T, ps, "modules", module->name);
+        ps->snapbytes[TEA_TMODULE] += gc_blacken(T, obj2gco(module));
+        gc_snapflush(T, ps);
+    }
+    gc_snaproot(T, ps, "modules", NULL);
+    gc_marktab(T, &T->modules);
+    gc_snapflush(T, ps);
+
+    /* Globals */
+    for(uint32_t i = 0; i < T->globals.size; i++)
+    {
+        TabEntry* entry = &T->globals.entries[i];
+        if(entry->key == NULL)
+            continue;
+        gc_snaproot(T, ps, "globals", entry->key);
+        gc_marktabentry(T, entry);
+        gc_snapflush(T, ps);
+    }
+
+    /* Internal roots */
+    gc_snaproot(T, ps, "registry", NULL);
+    gc_markval(T, registry(T));
+    gc_snapflush(T, ps);
+    gc_snaproot(T, ps, "internal", NULL);
+    for(int i = GCROOT_KLBASE; i < GCROOT_MAX; i++)
+    {
+        gc_markobj(T, T->gcroot[i]);
+    }
+    gc_snapflush(T, ps);
+    gc_snaproot(T, ps, "finalizers", NULL);
+    gc_mark_mmudata(T);
+    gc_snapflush(T, ps);
+    gc_snaproot(T, ps, "weak", NULL);
+    gc_convergeweak(T);
+    gc_snapflush(T, ps);
+
+    /* Fixed strings and whatever the roots above missed */
+    gc_snaproot(T, ps, "unreached", NULL);
+    gc_snapunreached(T, T->gc.root);
+    gc_snapunreached(T, T->gc.rootud);
+    for(uint32_t i = 0; i < T->str.size; i++)
+    {
+        gc_snapunreached(T, T->str.hash[i]);
+    }
+    gc_snapflush(T, ps);
+    T->gc.snapbytes = NULL;
+
+    /* Sweep to make the marked objects white again */
+    T->gc.state = GCSpause;
+    gc_whiten(T);
+    T->gc.estimate = T->gc.total;
+    gc_setthreshold(T);
 }
 
 /* Free all remaining GC objects */
 void tea_gc_freeall(tea_State* T)
 {
+    gc_mergeold(T);
     GCobj* obj = T->gc.root;
     while(obj != NULL)
     {
@@ -421,8 +1288,40 @@ void tea_gc_freeall(tea_State* T)
         }
     }
 
-    /* Free the gray stack */
+    /* Free the gray stacks */
     T->allocf(T->allocd, T->gc.gray_stack, sizeof(GCobj*) * T->gc.gray_size, 0);
+    T->allocf(T->allocd, T->gc.grayagain, sizeof(GCobj*) * T->gc.grayagain_size, 0);
+    T->allocf(T->allocd, T->gc.weak, sizeof(GCobj*) * T->gc.weak_size, 0);
+    T->allocf(T->allocd, T->gc.views, sizeof(GCobj*) * T->gc.view_size, 0);
+}
+
+/* -- Write barriers ------------------------------------------------------ */
+
+/* Move the GC propagation frontier back for a black container object */
+void tea_gc_barrierback_(tea_State* T, GCobj* o)
+{
+    tea_assertT(isblack(o) && !isdead(T, o), "bad object states for backward barrier");
+    if(T->gc.state == GCSpropagate || T->gc.kind == GCKgen)
+    {
+        /* Traverse it again in the atomic phase */
+        black2gray(o);
+        gc_push(T, &T->gc.grayagain, &T->gc.grayagain_count, &T->gc.grayagain_size, o);
+    }
+    else
+    {
+        makewhite(T, o);    /* Sweeping: make it white to avoid further barriers */
+    }
+}
+
+/* Move the GC propagation frontier forward for a stored value */
+void tea_gc_barrierf(tea_State* T, GCobj* o, GCobj* v)
+{
+    tea_assertT(isblack(o) && iswhite(v) && !isdead(T, v) && !isdead(T, o),
+                "bad object states for forward barrier");
+    if(T->gc.state == GCSpropagate || T->gc.kind == GCKgen)
+        gc_mark(T, v);  /* Mark the value */
+    else
+        makewhite(T, o);    /* Sweeping: make it white to avoid further barriers */
 }
 
 /* -- Allocator -------------------------------------------------- */
@@ -431,33 +1330,59 @@ void tea_gc_freeall(tea_State* T)
 void* tea_mem_realloc(tea_State* T, void* p, size_t old_size, size_t new_size)
 {
     tea_assertT((old_size == 0) == (p == NULL), "realloc API violation");
-    T->gc.total += new_size - old_size;
-
     if(new_size > old_size)
     {
-#ifdef TEA_DEBUG_STRESS_GC
-        tea_gc_collect(T);
-#endif
-
-        if(TEA_UNLIKELY(T->gc.total > T->gc.next_gc))
-        {
-            tea_gc_collect(T);
-        }
+        tea_gc_checklimit(T, new_size - old_size);
+        tea_prof_alloc(T, new_size - old_size);
     }
+    T->gc.total += new_size - old_size;
 
-    p = T->allocf(T->allocd, p, old_size, new_size);
+    if(TEA_UNLIKELY(tea_los_islarge(T, old_size) || tea_los_islarge(T, new_size)))
+        p = tea_los_realloc(T, p, old_size, new_size);
+    else
+        p = T->allocf(T->allocd, p, old_size, new_size);
     if(p == NULL && new_size > 0)
         tea_err_mem(T);
     tea_assertT((new_size == 0) == (p == NULL), "allocf API violation");
     return p;
 }
 
+/* Small objects come from the slab allocator, unless disabled for debugging */
+#ifdef TEA_USE_SYSMALLOC
+#define gc_isslab(size) 0
+#else
+#define gc_isslab(size) ((size) <= TEA_SLAB_MAXSIZE)
+#endif
+
+/* Allocate memory for a GC object */
+void* tea_mem_allocgco(tea_State* T, size_t size)
+{
+    if(!gc_isslab(size))
+        return tea_mem_new(T, size);
+    tea_gc_checklimit(T, size);
+    tea_prof_alloc(T, size);
+    T->gc.total += size;
+    return tea_slab_alloc(T, size);
+}
+
+/* Free the memory of a GC object */
+void tea_mem_freegco(tea_State* T, void* p, size_t size)
+{
+    if(!gc_isslab(size))
+    {
+        tea_mem_free(T, p, size);
+        return;
+    }
+    T->gc.total -= size;
+    tea_slab_free(T, p, size);
+}
+
 /* Allocate new GC object and link it to the objects root */
 GCobj* tea_mem_newgco(tea_State* T, size_t size, uint8_t type)
 {
-    GCobj* obj = (GCobj*)tea_mem_realloc(T, NULL, 0, size);
+    GCobj* obj = (GCobj*)tea_mem_allocgco(T, size);
     obj->gch.gct = type;
-    obj->gch.marked = 0;
+    obj->gch.marked = tea_gc_curwhite(T);
     obj->gch.nextgc = T->gc.root;
     T->gc.root = obj;
     return obj;
@@ -474,4 +1399,4 @@ void* tea_mem_grow(tea_State* T, void* p, uint32_t* size, size_t size_elem, int
     p = tea_mem_realloc(T, p, (*size) * size_elem, new_size * size_elem);
     *size = new_size;
     return p;
-}
\ No newline at end of file
+}
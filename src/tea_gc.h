@@ -7,22 +7,110 @@
 #define _TEA_GC_H
 
 #include "tea_obj.h"
+#include "tea_los.h"
 
+/* Garbage collector states. Order matters */
+enum
+{
+    GCSpause, GCSpropagate, GCSatomic, GCSsweepstring, GCSsweep, GCSsweepud, GCSfinalize
+};
+
+/* Kinds of collection */
+enum
+{
+    GCKinc,     /* Incremental: every cycle marks the whole heap */
+    GCKgen,     /* Generational: minor cycles only mark young objects */
+    GCKmajor    /* Generational, marking a major cycle incrementally */
+};
+
+/* Pending emergency collections */
+enum
+{
+    GCEnone,
+    GCEsoft,    /* Over the soft limit: collect everything */
+    GCEhard     /* Over the hard limit on the slack: raise unless the collection frees enough */
+};
+
+/* Bitmasks for marked field of GCobj */
+#define TEA_GC_WHITE0 0x01
+#define TEA_GC_WHITE1 0x02
+#define TEA_GC_BLACK 0x04
 #define TEA_GC_FINALIZED 0x10
 #define TEA_GC_FIXED 0x20
 
+#define TEA_GC_WHITES (TEA_GC_WHITE0 | TEA_GC_WHITE1)
+#define TEA_GC_COLORS (TEA_GC_WHITES | TEA_GC_BLACK)
+
+/* Macros to test and set GC object colors */
+#define tea_gc_curwhite(T) ((T)->gc.currentwhite & TEA_GC_WHITES)
+#define tea_gc_otherwhite(T) ((T)->gc.currentwhite ^ TEA_GC_WHITES)
+#define iswhite(x) ((x)->gch.marked & TEA_GC_WHITES)
+#define isblack(x) ((x)->gch.marked & TEA_GC_BLACK)
+#define isgray(x) (!((x)->gch.marked & TEA_GC_COLORS))
+#define isdead(T, x) ((x)->gch.marked & tea_gc_otherwhite(T) & TEA_GC_WHITES)
+#define flipwhite(x) ((x)->gch.marked ^= TEA_GC_WHITES)
+#define makewhite(T, x) \
+    ((x)->gch.marked = ((x)->gch.marked & (uint8_t)~TEA_GC_COLORS) | tea_gc_curwhite(T))
+#define white2gray(x) ((x)->gch.marked &= (uint8_t)~TEA_GC_WHITES)
+#define black2gray(x) ((x)->gch.marked &= (uint8_t)~TEA_GC_BLACK)
+#define gray2black(x) ((x)->gch.marked |= TEA_GC_BLACK)
+
 #define fix_string(s) (((GCobj*)(s))->gch.marked |= TEA_GC_FIXED)
 #define mark_finalized(x) (((GCobj*)(x))->gch.marked |= TEA_GC_FINALIZED)
 
 /* Collector */
-TEA_FUNC void tea_gc_separateudata(tea_State* T);
+TEA_FUNC void tea_gc_separateudata(tea_State* T, bool all);
 TEA_FUNC void tea_gc_finalize_udata(tea_State* T);
+TEA_FUNC void tea_gc_step(tea_State* T);
+TEA_FUNC bool tea_gc_stepk(tea_State* T, size_t kb);
 TEA_FUNC void tea_gc_collect(tea_State* T);
+TEA_FUNC void tea_gc_changemode(tea_State* T, uint8_t kind);
+TEA_FUNC void tea_gc_countobj(tea_State* T, size_t* counts);
+TEA_FUNC void tea_gc_weak(tea_State* T, GCobj* o);
+TEA_FUNC void tea_gc_snapshot(tea_State* T, ProfState* ps);
+TEA_FUNC void tea_gc_setlimit(tea_State* T);
+TEA_FUNC void tea_gc_overlimit(tea_State* T, size_t size);
 TEA_FUNC void tea_gc_freeall(tea_State* T);
 
+/*
+** Run a GC step once the allocation threshold is reached. Only called at
+** safe points (calls and loop back-edges), where all live objects are
+** reachable from the stack or other roots
+*/
+#ifdef TEA_DEBUG_STRESS_GC
+#define tea_gc_due(T) (!(T)->gc.stopped || (T)->gc.emergency)
+#else
+#define tea_gc_due(T) (TEA_UNLIKELY((T)->gc.total >= (T)->gc.next_gc))
+#endif
+#define tea_gc_check(T) { if(tea_gc_due(T)) tea_gc_step(T); }
+
+/* Check the memory limits before allocating size more bytes */
+#define tea_gc_checklimit(T, size) \
+    { if(TEA_UNLIKELY((T)->gc.total + (size) > (T)->gc.memlimit)) tea_gc_overlimit(T, (size)); }
+
+/* Write barriers */
+TEA_FUNC void tea_gc_barrierback_(tea_State* T, GCobj* o);
+TEA_FUNC void tea_gc_barrierf(tea_State* T, GCobj* o, GCobj* v);
+
+/* Barrier for a store into a container object (list, map, tables, module) */
+static TEA_AINLINE void tea_gc_barrierback(tea_State* T, GCobj* o)
+{
+    if(TEA_UNLIKELY(isblack(o)))
+        tea_gc_barrierback_(T, o);
+}
+
+/* Barrier for a store of a value into a closed upvalue */
+static TEA_AINLINE void tea_gc_barrieruv(tea_State* T, GCupval* uv, cTValue* o)
+{
+    if(TEA_UNLIKELY(tvisgcv(o) && isblack(obj2gco(uv)) && iswhite(gcV(o))))
+        tea_gc_barrierf(T, obj2gco(uv), gcV(o));
+}
+
 /* Allocator */
 TEA_FUNC void* tea_mem_grow(tea_State* T, void* p, uint32_t* size, size_t size_elem, int limit);
 TEA_FUNC GCobj* tea_mem_newgco(tea_State* T, size_t size, uint8_t type);
+TEA_FUNC void* tea_mem_allocgco(tea_State* T, size_t size);
+TEA_FUNC void tea_mem_freegco(tea_State* T, void* p, size_t size);
 TEA_FUNC void* tea_mem_realloc(tea_State* T, void* p, size_t old_size, size_t new_size);
 
 #define tea_mem_new(T, size) tea_mem_realloc(T, NULL, 0, (size));
@@ -30,12 +118,16 @@ TEA_FUNC void* tea_mem_realloc(tea_State* T, void* p, size_t old_size, size_t ne
 static TEA_AINLINE void tea_mem_free(tea_State* T, void* p, size_t old_size)
 {
     T->gc.total -= old_size;
-    T->allocf(T->allocd, p, old_size, 0);
+    if(TEA_UNLIKELY(tea_los_islarge(T, old_size)))
+        tea_los_realloc(T, p, old_size, 0);
+    else
+        T->allocf(T->allocd, p, old_size, 0);
 }
 
 #define tea_mem_freet(T, p) tea_mem_free(T, (p), sizeof(*(p)))
 
 #define tea_mem_newobj(T, type, object_type) (type*)tea_mem_newgco(T, sizeof(type), object_type)
+#define tea_mem_freegcot(T, p) tea_mem_freegco(T, (p), sizeof(*(p)))
 
 #define TEA_MEM_GROW(size) \
     ((size) < 8 ? 8 : (size) * 2)
@@ -52,4 +144,4 @@ static TEA_AINLINE void tea_mem_free(tea_State* T, void* p, size_t old_size)
 #define tea_mem_freevec(T, type, p, old_count) \
     tea_mem_free(T, p, sizeof(type) * (old_count))
 
-#endif
\ No newline at end of file
+#endif
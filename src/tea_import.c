@@ -179,6 +179,7 @@ static const tea_Reg modules[] = {
     { TEA_MODULE_RANDOM, tea_import_random },
     { TEA_MODULE_DEBUG, tea_import_debug },
     { TEA_MODULE_UTF8, tea_import_utf8 },
+    { TEA_MODULE_GC, tea_import_gc },
     { NULL, NULL }
 };
 
@@ -309,7 +310,7 @@ static GCstr* imp_search_path(tea_State* T, char* dir, char* path_name)
 static GCmodule* imp_module_load(tea_State* T, GCstr* path)
 {
     GCmodule* module = tea_module_new(T, path);
-    module->path = tea_imp_dirname(T, str_datawr(path), path->len);
+    module->path = tea_imp_dirname(T, (char*)str_data(path), path->len);
     T->last_module = module;
 
     int status = tea_load_file(T, str_data(path), str_data(path));
@@ -324,7 +325,7 @@ static GCmodule* imp_module_load(tea_State* T, GCstr* path)
 
 void tea_imp_relative(tea_State* T, GCstr* dir, GCstr* path_name)
 {
-    GCstr* path = imp_search_path(T, str_datawr(dir), str_datawr(path_name));
+    GCstr* path = imp_search_path(T, (char*)str_data(dir), (char*)str_data(path_name));
     if(!path)
     {
         tea_err_callerv(T, TEA_ERR_NOPATH, str_data(path_name));
@@ -361,9 +362,11 @@ void tea_imp_logical(tea_State* T, GCstr* name)
         }
     }
 
+    /* The name, directory and path stay on the stack while searching */
+    setstrV(T, T->top++, name);
     const char* exe = setprogdir(T);
     GCstr* dir = tea_str_newlen(T, exe);
-    T->top--;
+    setstrV(T, T->top - 1, dir);
 
     const char* exts[] = { TEA_PATH_SCRIPT, TEA_PATH_LIB, TEA_PATH_PACKAGE };
     const int n = sizeof(exts) / sizeof(exts[0]);
@@ -372,7 +375,7 @@ void tea_imp_logical(tea_State* T, GCstr* name)
     for(int i = 0; i < n; i++)
     {
         const char* x = tea_push_fstring(T, "%s%c%s", exts[i], DIR_SEP, str_data(name));
-        path = imp_search_path(T, str_datawr(dir), (char*)x);
+        path = imp_search_path(T, (char*)str_data(dir), (char*)x);
         tea_pop(T, 1);
         if(path)
             break;
@@ -382,11 +385,13 @@ void tea_imp_logical(tea_State* T, GCstr* name)
     {
         tea_err_callerv(T, TEA_ERR_NOPATH, str_data(name));
     }
+    setstrV(T, T->top++, path);
 
     o = tea_tab_get(&T->modules, path);
     if(o)
     {
         T->last_module = moduleV(o);
+        T->top -= 3;
         copyTV(T, T->top++, o);
         return;
     }
@@ -398,7 +403,7 @@ void tea_imp_logical(tea_State* T, GCstr* name)
         void* lib = ll_load(T, str_data(path));
         ll_register(T, lib);
         tea_CFunction fn = ll_sym(T, lib, symname);
-        T->top--;
+        T->top -= 4;
 
         tea_push_cfunction(T, fn, 0, 0);
         tea_call(T, 0);
@@ -408,7 +413,7 @@ void tea_imp_logical(tea_State* T, GCstr* name)
     }
 
     GCmodule* module = imp_module_load(T, path);
-    T->top--;
+    T->top -= 4;
 
     setmoduleV(T, T->top++, module);
 }
@@ -170,7 +170,6 @@ static Token lex_number(LexState* ls)
     }
 
     Token tok = lex_token(ls, TK_number);
-    tv.tt = TEA_TNUM;
     copyTV(ls->T, &tok.tv, &tv);
 	return tok;
 }
@@ -849,7 +848,7 @@ void tea_lex_error(LexState* ls, LexToken tok, BCLine line, ErrMsg em, ...)
 {
     const char* tokstr = NULL;
     va_list argp;
-    char* name = str_datawr(ls->module->name);
+    const char* name = str_data(ls->module->name);
     char c = name[0];
     int off = 0;
     if(c == '?' || c == '=') off = 1;
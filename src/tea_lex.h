@@ -72,6 +72,8 @@ typedef struct VarInfo
     GCstr* name;   /* Variable name */
     bool isconst;   /* Constant variable */
     bool init;  /* Initialized variable */
+    bool hask;  /* Constant with a known value */
+    TValue k;   /* Value of the constant */
 } VarInfo;
 
 /* Teascript lexer state */
@@ -95,6 +97,7 @@ typedef struct LexState
     int braces[4];  /* Tracked string interpolations */
     int num_braces; /* Number of string interpolations */
     const char* mode;   /* Load bytecode (b) and/or source text (t) */
+    int optlevel;   /* Bytecode optimization level */
     BCInsLine* bcstack; /* Stack for bytecode instructions/line numbers */
     uint32_t sizebcstack;	/* Size of bytecode stack */
     VarInfo* vstack;  /* Variable stack */
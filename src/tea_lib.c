@@ -11,6 +11,8 @@
 
 #include "tea_lib.h"
 #include "tea_err.h"
+#include "tea_tab.h"
+#include "tea_str.h"
 
 /* -- Type checks --------------------------------------------------------- */
 
@@ -49,7 +51,7 @@ GCstr* tea_lib_checkstr(tea_State* T, int idx)
     TValue* o = T->base + idx;
     if(!(o < T->top && tvisstr(o)))
         tea_err_argt(T, idx, TEA_TYPE_STRING);
-    return strV(o);
+    return tea_str_flatten(T, strV(o));
 }
 
 GCstr* tea_lib_optstr(tea_State* T, int idx)
@@ -87,7 +89,7 @@ int tea_lib_checkopt(tea_State* T, int idx, int def, const char* lst)
     GCstr* s = def >= 0 ? tea_lib_optstr(T, idx) : tea_lib_checkstr(T, idx);
     if(s)
     {
-        const char* opt = str_data(s);
+        const char* opt = str_mem(s);
         size_t len = s->len;
         int i;
         for(i = 0; *(const uint8_t*)lst; i++)
@@ -158,6 +160,16 @@ GCproto* tea_lib_checkTproto(tea_State* T, int idx, bool notea)
     return NULL; /* Unreachable */
 }
 
+/* -- Builtin methods ----------------------------------------------------- */
+
+/* Tag the C function of a class special method, so the VM can recognize it */
+void tea_lib_setffid(tea_State* T, GCclass* klass, MMS mm, uint8_t ffid)
+{
+    TValue* o = tea_tab_get(&klass->methods, mmname_str(T, mm));
+    tea_assertT(o && tvisfunc(o) && iscfunc(funcV(o)), "bad builtin method");
+    funcV(o)->c.ffid = ffid;
+}
+
 void tea_lib_fileresult(tea_State* T, const char* fname)
 {
     int en = errno; /* Teascript API calls may change this value */
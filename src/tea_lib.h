@@ -22,6 +22,7 @@ TEA_FUNC int32_t tea_lib_checkintrange(tea_State* T, int idx, int32_t a, int32_t
 GCfunc* tea_lib_checkfunc(tea_State* T, int idx, bool notea);
 TEA_FUNC GCproto* tea_lib_checkTproto(tea_State* T, int idx, bool notea);
 
+TEA_FUNC void tea_lib_setffid(tea_State* T, GCclass* klass, MMS mm, uint8_t ffid);
 TEA_FUNC void tea_lib_fileresult(tea_State* T, const char* fname);
 
 #define tea_lib_upvalue(T, idx) (&(T)->ci->func->c.upvalues[(idx)])
@@ -33,7 +33,7 @@ GClist* tea_list_new(tea_State* T, size_t n)
 void TEA_FASTCALL tea_list_free(tea_State* T, GClist* list)
 {
     tea_mem_freevec(T, TValue, list->items, list->size);
-    tea_mem_freet(T, list);
+    tea_mem_freegcot(T, list);
 }
 
 /* Copy a list */
@@ -57,6 +57,7 @@ void tea_list_add(tea_State* T, GClist* list, cTValue* o)
     }
     copyTV(T, list_slot(list, list->len), o);
     list->len++;
+    tea_gc_barrierback(T, obj2gco(list));
 }
 
 /* Add a number to the end of a list */
@@ -83,6 +84,7 @@ void tea_list_insert(tea_State* T, GClist* list, cTValue* o, int32_t idx)
         copyTV(T, list_slot(list, i), list_slot(list, i - 1));
     }
     copyTV(T, list_slot(list, idx), o);
+    tea_gc_barrierback(T, obj2gco(list));
 }
 
 /* Delete an item from a list */
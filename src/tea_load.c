@@ -23,11 +23,20 @@
 
 /* -- Load Teascript source code and bytecode ------------------------------------- */
 
+/* Get the bytecode optimization level (O0, O1) of a load mode */
+static int load_optlevel(const char* mode)
+{
+    const char* p = mode ? strchr(mode, 'O') : NULL;
+    if(p == NULL)
+        return TEA_OPTLEVEL;
+    return (p[1] >= '0' && p[1] <= '9') ? p[1] - '0' : 1;
+}
+
 static void parser_f(tea_State* T, void* ud)
 {
     LexState* ls = (LexState*)ud;
     bool bc = tea_lex_setup(T, ls);
-    if(ls->mode && !strchr(ls->mode, bc ? 'b' : 't'))
+    if(ls->mode && strpbrk(ls->mode, "bt") && !strchr(ls->mode, bc ? 'b' : 't'))
     {
         setstrV(T, T->top++, tea_err_str(T, TEA_ERR_XMODE));
         tea_err_throw(T, TEA_ERROR_SYNTAX);
@@ -43,7 +52,7 @@ TEA_API int tea_loadx(tea_State* T, tea_Reader reader, void* data, const char* n
     setstrV(T, T->top++, mname);
     GCmodule* module = tea_module_new(T, mname);
     T->top--;
-    if(T->last_module != NULL && T->last_module->name == module->name)
+    if(T->last_module != NULL && tea_str_equal(T, T->last_module->name, module->name))
     {
         /* Already found the path */
     }
@@ -68,6 +77,7 @@ TEA_API int tea_loadx(tea_State* T, tea_Reader reader, void* data, const char* n
     ls.reader = reader;
     ls.rdata = data;
     ls.mode = mode;
+    ls.optlevel = load_optlevel(mode);
     tea_buf_init(&ls.sb);
     int status = tea_vm_pcall(T, parser_f, &ls, stack_save(T, T->top));
     tea_lex_cleanup(T, &ls);
@@ -180,6 +190,7 @@ TEA_API int tea_eval(tea_State* T, const char* s)
     ls.reader = reader_string;
     ls.rdata = &ctx;
     ls.mode = "t";
+    ls.optlevel = TEA_OPTLEVEL;
     tea_buf_init(&ls.sb);
     int status = tea_vm_pcall(T, parser_f, &ls, stack_save(T, T->top));
     tea_lex_cleanup(T, &ls);
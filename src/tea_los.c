@@ -0,0 +1,96 @@
+/*
+** tea_los.c
+** Large-object space
+*/
+
+/* To get mremap() on Linux */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#define tea_los_c
+#define TEA_CORE
+
+#include "tea_los.h"
+
+#if TEA_HASLOS
+#include <string.h>
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if TEA_HASLOS && defined(MAP_ANONYMOUS)
+
+/*
+** Blocks of at least TEA_LOS_MINSIZE bytes (list items, map entries,
+** string buffers and huge strings) bypass the allocator and get their
+** own private mapping. Growing such a block remaps its pages instead of
+** copying them, and freeing it hands the pages straight back to the OS.
+** The size of a block is always known by its owner, so the mappings need
+** no header. Only used with the default allocator
+*/
+
+static void* los_map(size_t size)
+{
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Resize a block, moving it in or out of the large-object space as needed */
+void* tea_los_realloc(tea_State* T, void* p, size_t old_size, size_t new_size)
+{
+    bool oldlarge = old_size >= TEA_LOS_MINSIZE;
+    bool newlarge = new_size >= TEA_LOS_MINSIZE;
+    void* np;
+    if(oldlarge && newlarge)
+    {
+#ifdef MREMAP_MAYMOVE
+        np = mremap(p, old_size, new_size, MREMAP_MAYMOVE);
+        if(np == MAP_FAILED)
+            return NULL;
+#else
+        np = los_map(new_size);
+        if(np == NULL)
+            return NULL;
+        memcpy(np, p, old_size < new_size ? old_size : new_size);
+        munmap(p, old_size);
+#endif
+    }
+    else if(newlarge)
+    {
+        np = los_map(new_size);
+        if(np == NULL)
+            return NULL;
+        if(p != NULL)
+        {
+            memcpy(np, p, old_size);
+            T->allocf(T->allocd, p, old_size, 0);
+        }
+    }
+    else
+    {
+        np = NULL;
+        if(new_size > 0)
+        {
+            np = T->allocf(T->allocd, NULL, 0, new_size);
+            if(np == NULL)
+                return NULL;
+            memcpy(np, p, new_size);
+        }
+        munmap(p, old_size);
+    }
+    T->gc.lototal += (newlarge ? new_size : 0) - (oldlarge ? old_size : 0);
+    return np;
+}
+
+#else
+
+/* No anonymous mappings: large blocks stay with the allocator */
+void* tea_los_realloc(tea_State* T, void* p, size_t old_size, size_t new_size)
+{
+    return T->allocf(T->allocd, p, old_size, new_size);
+}
+
+#endif
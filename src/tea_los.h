@@ -0,0 +1,28 @@
+/*
+** tea_los.h
+** Large-object space
+*/
+
+#ifndef _TEA_LOS_H
+#define _TEA_LOS_H
+
+#include "tea_def.h"
+#include "tea_obj.h"
+#include "tea_arch.h"
+
+/* Large blocks are mapped directly from the OS, unless disabled for debugging */
+#if TEA_TARGET_POSIX && !defined(TEA_USE_SYSMALLOC)
+#define TEA_HASLOS 1
+#else
+#define TEA_HASLOS 0
+#endif
+
+#if TEA_HASLOS
+#define tea_los_islarge(T, size) ((T)->gc.los && (size) >= TEA_LOS_MINSIZE)
+#else
+#define tea_los_islarge(T, size) 0
+#endif
+
+TEA_FUNC void* tea_los_realloc(tea_State* T, void* p, size_t old_size, size_t new_size);
+
+#endif
@@ -9,6 +9,7 @@
 #define TEA_CORE
 
 #include "tea_map.h"
+#include "tea_str.h"
 #include "tea_gc.h"
 #include "tea_err.h"
 
@@ -16,17 +17,29 @@
 GCmap* tea_map_new(tea_State* T)
 {
     GCmap* map = tea_mem_newobj(T, GCmap, TEA_TMAP);
+    map->weak = 0;
     map->count = 0;
     map->size = 0;
     map->entries = NULL;
     return map;
 }
 
+/* Set the weak mode of a map */
+void tea_map_setweak(tea_State* T, GCmap* map, uint8_t weak)
+{
+    if(weak && !(map->weak & MAP_WEAKREG))
+    {
+        tea_gc_weak(T, obj2gco(map));
+        map->weak |= MAP_WEAKREG;
+    }
+    map->weak = (map->weak & ~MAP_WEAKMODE) | weak;
+}
+
 /* Free a map */
 void TEA_FASTCALL tea_map_free(tea_State* T, GCmap* map)
 {
     tea_mem_freevec(T, MapEntry, map->entries, map->size);
-    tea_mem_freet(T, map);
+    tea_mem_freegcot(T, map);
 }
 
 /* Clear a map */
@@ -56,8 +69,8 @@ static TEA_INLINE uint32_t map_hash(uint64_t hash)
     return (uint32_t)(hash & 0x3fffffff);
 }
 
-/* Hash an object */
-static uint32_t map_hash_obj(TValue* tv)
+/* Hash an object. A rope key is flattened first */
+static uint32_t map_hash_obj(tea_State* T, TValue* tv)
 {
     switch(itype(tv))
     {
@@ -70,16 +83,16 @@ static uint32_t map_hash_obj(TValue* tv)
         case TEA_TPOINTER:
             return map_hash((uint64_t)pointerV(tv));
         case TEA_TSTR:
-            return strV(tv)->hash;
+            return str_hashval(tea_str_flatten(T, strV(tv)));
         default:
             return map_hash((uint64_t)gcV(tv));
     }
 }
 
 /* Find an entry in the map, skipping over tombstones and deleted entries */
-static bool map_find_entry(MapEntry* items, uint32_t size, TValue* key, MapEntry** entry)
+static bool map_find_entry(tea_State* T, MapEntry* items, uint32_t size, TValue* key, MapEntry** entry)
 {
-    uint32_t startidx = map_hash_obj(key) & (size - 1);
+    uint32_t startidx = map_hash_obj(T, key) & (size - 1);
     uint32_t idx = startidx;
     MapEntry* tombstone = NULL;
 
@@ -101,7 +114,7 @@ static bool map_find_entry(MapEntry* items, uint32_t size, TValue* key, MapEntry
                     tombstone = item;
             }
         }
-        else if(tea_obj_rawequal(&item->key, key))
+        else if(tea_obj_rawequal(T, &item->key, key))
         {
             /* We found the key */
             *entry = item;
@@ -121,7 +134,7 @@ static bool map_insert_entry(tea_State* T, MapEntry* items, uint32_t size, TValu
 {
     tea_assertT(items != NULL, "should ensure size before inserting");
     MapEntry* item;
-    if(map_find_entry(items, size, key, &item))
+    if(map_find_entry(T, items, size, key, &item))
     {
         /* Already present, so just replace the value */
         copyTV(T, &item->val, val);
@@ -138,13 +151,13 @@ static bool map_insert_entry(tea_State* T, MapEntry* items, uint32_t size, TValu
 /* -- Map getters ------------------------------------------------------ */
 
 /* Get a key in the map */
-cTValue* tea_map_get(GCmap* map, TValue* key)
+cTValue* tea_map_get(tea_State* T, GCmap* map, TValue* key)
 {
     if(map->count == 0)
         return NULL;
 
     MapEntry* item;
-    if(map_find_entry(map->entries, map->size, key, &item))
+    if(map_find_entry(T, map->entries, map->size, key, &item))
         return &item->val;
 
     return NULL;
@@ -155,7 +168,7 @@ cTValue* tea_map_getstr(tea_State* T, GCmap* map, GCstr* key)
 {
     TValue o;
     setstrV(T, &o, key);
-    return tea_map_get(map, &o);
+    return tea_map_get(T, map, &o);
 }
 
 #define MAP_MAX_LOAD 0.75
@@ -180,7 +193,7 @@ static void map_resize(tea_State* T, GCmap* map, uint32_t size)
             if(!tvisnil(&item->key))
             {
                 MapEntry* entry;
-                if(map_find_entry(entries, size, &item->key, &entry))
+                if(map_find_entry(T, entries, size, &item->key, &entry))
                 {
                     /* Already present, so just replace the value */
                     copyTV(T, &entry->val, &item->val);
@@ -217,12 +230,13 @@ TValue* tea_map_set(tea_State* T, GCmap* map, TValue* key)
     }
 
     MapEntry* item;
-    if(!map_find_entry(map->entries, map->size, key, &item))
+    if(!map_find_entry(T, map->entries, map->size, key, &item))
     {
         copyTV(T, &item->key, key);
         map->count++;
     }
 
+    tea_gc_barrierback(T, obj2gco(map));   /* The caller stores the value */
     return &item->val;
 }
 
@@ -257,7 +271,7 @@ bool tea_map_delete(tea_State* T, GCmap* map, TValue* key)
 
     /* Find the entry */
     MapEntry* item;
-    if(!map_find_entry(map->entries, map->size, key, &item))
+    if(!map_find_entry(T, map->entries, map->size, key, &item))
         return false;
 
     /* Place a tombstone in the entry */
@@ -295,12 +309,12 @@ void tea_map_merge(tea_State* T, GCmap* from, GCmap* to)
 }
 
 /* Get the successor traversal index of a key */
-uint32_t map_keyindex(GCmap* map, TValue* key)
+uint32_t map_keyindex(tea_State* T, GCmap* map, TValue* key)
 {
     if(!tvisnil(key))
     {
         MapEntry* entry;
-        if(!map_find_entry(map->entries, map->size, key, &entry))
+        if(!map_find_entry(T, map->entries, map->size, key, &entry))
         {
             return (uint32_t)~0u;
         }
@@ -311,9 +325,9 @@ uint32_t map_keyindex(GCmap* map, TValue* key)
 }
 
 /* Get the next key/value pair of a map traversal */
-int tea_map_next(GCmap* map, TValue* key, TValue* o)
+int tea_map_next(tea_State* T, GCmap* map, TValue* key, TValue* o)
 {
-    uint32_t idx = map_keyindex(map, key);
+    uint32_t idx = map_keyindex(T, map, key);
     for(; idx < map->size; idx++)
     {
         MapEntry* item = &map->entries[idx];
@@ -3,10 +3,13 @@
 ** Method handling
 */
 
+#include <string.h>
+
 #define tea_meta_c
 #define TEA_CORE
 
 #include "tea_tab.h"
+#include "tea_shape.h"
 #include "tea_str.h"
 #include "tea_gc.h"
 #include "tea_meta.h"
@@ -90,6 +93,206 @@ bool tea_meta_isclass(tea_State* T, GCclass* klass)
             klass == gcroot_rangeclass(T));
 }
 
+/* -- Inline caches ------------------------------------------------------ */
+
+/*
+** Lookup a method of a class, falling back to the metamethod mm (ACC_MM).
+** An assignment only stops at a setter, any other method is overridden
+** by the setattr metamethod
+*/
+static TValue* meta_getmethod(tea_State* T, GCclass* klass, GCstr* name, uint8_t* flags, MMS mm)
+{
+    TValue* mo = tea_tab_getx(&klass->methods, name, flags);
+    if(mm != MM__MAX && (!mo || (mm == MM_SETATTR && !(*flags & ACC_SET))))
+    {
+        TValue* mmo = tea_tab_get(&klass->methods, mmname_str(T, mm));
+        if(mmo)
+        {
+            *flags = ACC_MM;
+            return mmo;
+        }
+    }
+    return mo;
+}
+
+/* Find the entry for a receiver class or shape in an inline cache site */
+static ICEntry* meta_icprobe(tea_State* T, GCproto* pt, uint8_t ic, const void* key)
+{
+    ICEntry* e = proto_ic(pt, ic);
+    for(int i = 0; i < IC_WAYS; i++)
+    {
+        if(e[i].key == key && e[i].epoch == T->icepoch)
+        {
+            pt->ichits++;
+            return &e[i];
+        }
+    }
+    pt->icmisses++;
+    return NULL;
+}
+
+/* Age the entries of an inline cache site and reset the first one */
+static ICEntry* meta_icfill(tea_State* T, GCproto* pt, uint8_t ic, const void* key, uint8_t flags)
+{
+    ICEntry* e = proto_ic(pt, ic);
+    memmove(e + 1, e, (IC_WAYS - 1) * sizeof(ICEntry));
+    e->key = key;
+    e->epoch = T->icepoch;
+    e->flags = flags;
+    e->slot = 0;
+    setnilV(&e->val);
+    return e;
+}
+
+/* Return a cached method lookup */
+static TValue* meta_ichit(ICEntry* e, uint8_t* flags)
+{
+    if(tvisnil(&e->val))
+        return NULL;
+    *flags = e->flags;
+    return &e->val;
+}
+
+/* Cache a method lookup */
+static void meta_icmethod(tea_State* T, GCproto* pt, uint8_t ic, const void* key, TValue* mo, uint8_t flags)
+{
+    ICEntry* e = meta_icfill(T, pt, ic, key, flags);
+    if(mo) copyTV(T, &e->val, mo);
+}
+
+/*
+** Lookup a method of a class, falling back to the metamethod mm if the
+** class has no such method (marked with ACC_MM). When an inline cache
+** site of a prototype is given, the result is cached per receiver class
+*/
+TValue* tea_meta_icget(tea_State* T, GCproto* pt, uint8_t ic, GCclass* klass, GCstr* name, uint8_t* flags, MMS mm)
+{
+    TValue* mo;
+    if(pt && ic != IC_NONE)
+    {
+        ICEntry* e = meta_icprobe(T, pt, ic, klass);
+        if(e) return meta_ichit(e, flags);
+        mo = meta_getmethod(T, klass, name, flags, mm);
+        meta_icmethod(T, pt, ic, klass, mo, *flags);
+        return mo;
+    }
+    return meta_getmethod(T, klass, name, flags, mm);
+}
+
+/*
+** Lookup an attribute of an instance (marked with ACC_SLOT) or else a
+** method of its class, like tea_meta_icget. Shaped instances are cached
+** per shape, which settles both lookups at once
+*/
+TValue* tea_meta_icattr(tea_State* T, GCproto* pt, uint8_t ic, GCinstance* instance, GCstr* name, uint8_t* flags, MMS mm)
+{
+    Shape* shape = instance->shape;
+    bool cache = pt && ic != IC_NONE;
+    TValue* mo;
+    int32_t slot;
+    if(!shape)
+    {
+        mo = tea_tab_get(&instance->attrs, name);
+        if(mo)
+        {
+            *flags = ACC_SLOT;
+            return mo;
+        }
+        return tea_meta_icget(T, pt, ic, instance->klass, name, flags, mm);
+    }
+    if(cache)
+    {
+        ICEntry* e = meta_icprobe(T, pt, ic, shape);
+        if(e)
+        {
+            if(e->flags & ACC_SLOT)
+            {
+                *flags = ACC_SLOT;
+                return &instance->slots[e->slot];
+            }
+            return meta_ichit(e, flags);
+        }
+    }
+    slot = tea_shape_find(shape, name);
+    if(slot >= 0)
+    {
+        if(cache) meta_icfill(T, pt, ic, shape, ACC_SLOT)->slot = (uint16_t)slot;
+        *flags = ACC_SLOT;
+        return &instance->slots[slot];
+    }
+    mo = meta_getmethod(T, instance->klass, name, flags, mm);
+    if(cache) meta_icmethod(T, pt, ic, shape, mo, *flags);
+    return mo;
+}
+
+/*
+** Lookup the target of an attribute assignment to an instance: a setter
+** (ACC_SET) or the setattr metamethod (ACC_MM) of its class, or else
+** the attribute slot to store into (ACC_SLOT), which is added if missing.
+** Shaped instances cache the slot or the shape transition per shape
+*/
+TValue* tea_meta_icsetattr(tea_State* T, GCproto* pt, uint8_t ic, GCinstance* instance, GCstr* name, uint8_t* flags)
+{
+    Shape* shape = instance->shape;
+    bool cache = pt && ic != IC_NONE;
+    TValue* mo;
+    Shape* next;
+    int32_t slot;
+    if(!shape)
+    {
+        mo = tea_meta_icget(T, pt, ic, instance->klass, name, flags, MM_SETATTR);
+        if(mo && (*flags & (ACC_SET | ACC_MM)))
+            return mo;
+        *flags = ACC_SLOT;
+        return tea_tab_set(T, &instance->attrs, name);
+    }
+    if(cache)
+    {
+        ICEntry* e = meta_icprobe(T, pt, ic, shape);
+        if(e)
+        {
+            if(e->flags & ACC_ADD)
+            {
+                *flags = ACC_SLOT;
+                return tea_instance_setshape(T, instance, (Shape*)pointerV(&e->val));
+            }
+            if(e->flags & ACC_SLOT)
+            {
+                *flags = ACC_SLOT;
+                return &instance->slots[e->slot];
+            }
+            return meta_ichit(e, flags);
+        }
+    }
+    mo = meta_getmethod(T, instance->klass, name, flags, MM_SETATTR);
+    if(mo && (*flags & (ACC_SET | ACC_MM)))
+    {
+        if(cache) meta_icmethod(T, pt, ic, shape, mo, *flags);
+        return mo;
+    }
+    *flags = ACC_SLOT;
+    slot = tea_shape_find(shape, name);
+    if(slot >= 0)
+    {
+        if(cache) meta_icfill(T, pt, ic, shape, ACC_SLOT)->slot = (uint16_t)slot;
+        return &instance->slots[slot];
+    }
+    next = tea_shape_add(T, instance->klass, shape, name);
+    if(!next)
+    {
+        tea_instance_todict(T, instance);
+        return tea_tab_set(T, &instance->attrs, name);
+    }
+    if(cache)
+    {
+        ICEntry* e = meta_icfill(T, pt, ic, shape, ACC_SLOT | ACC_ADD);
+        setpointerV(&e->val, next);
+    }
+    return tea_instance_setshape(T, instance, next);
+}
+
+/* -- Attributes ---------------------------------------------------------- */
+
 /* Check if object has attribute */
 bool tea_meta_hasattr(tea_State* T, GCstr* name, TValue* obj)
 {
@@ -99,7 +302,7 @@ bool tea_meta_hasattr(tea_State* T, GCstr* name, TValue* obj)
         case TEA_TINSTANCE:
         {
             GCinstance* instance = instanceV(obj);
-            cTValue* o = tea_tab_get(&instance->attrs, name);
+            cTValue* o = tea_instance_get(instance, name);
             if(o) return true;
             break;
         }
@@ -117,7 +320,7 @@ bool tea_meta_hasattr(tea_State* T, GCstr* name, TValue* obj)
 }
 
 /* Get attribute from object */ 
-cTValue* tea_meta_getattr(tea_State* T, GCstr* name, TValue* obj)
+cTValue* tea_meta_getattrx(tea_State* T, GCproto* pt, uint8_t ic, GCstr* name, TValue* obj)
 {
     switch(itype(obj))
     {
@@ -126,37 +329,36 @@ cTValue* tea_meta_getattr(tea_State* T, GCstr* name, TValue* obj)
         {
             GCinstance* instance = instanceV(obj);
             uint8_t flags = ACC_GET;
-            TValue* mo = tea_tab_get(&instance->attrs, name);
-            if(mo) return mo;
-            mo = tea_tab_getx(&instance->klass->methods, name, &flags);
+            TValue* mo = tea_meta_icattr(T, pt, ic, instance, name, &flags, MM_GETATTR);
             if(mo)
             {
+                if(flags & ACC_SLOT)
+                    return mo;
+                if(flags & ACC_MM)
+                {
+                    copyTV(T, T->top++, obj);
+                    setstrV(T, T->top++, name);
+                    tea_vm_call(T, mo, 1);
+                    return --T->top;
+                }
                 if(flags & ACC_GET)
                 {
                     copyTV(T, T->top++, obj);
                     tea_vm_call(T, mo, 0);
                     return --T->top;
                 }
-                GCmethod* bound = tea_method_new(T, T->top - 1, funcV(mo));
+                GCmethod* bound = tea_method_new(T, obj, funcV(mo));
                 setmethodV(T, &T->tmptv, bound);
                 return &T->tmptv;
             }
-            mo = tea_meta_lookup(T, obj, MM_GETATTR);
-            if(mo)
-            {
-                copyTV(T, T->top++, obj);
-                setstrV(T, T->top++, name);
-                tea_vm_call(T, mo, 1);
-                return --T->top;
-            }
-            tea_err_callerv(T, TEA_ERR_METHOD, str_data(name));
+            tea_err_callerv(T, TEA_ERR_METHOD, tea_str_data(T, name));
         }
         case TEA_TMODULE:
         {
             GCmodule* module = moduleV(obj);
             cTValue* o = tea_tab_get(&module->exports, name);
             if(o) return o;
-            tea_err_callerv(T, TEA_ERR_MODATTR, str_data(module->name), str_data(name));
+            tea_err_callerv(T, TEA_ERR_MODATTR, str_data(module->name), tea_str_data(T, name));
         }
         default:
         {
@@ -164,7 +366,7 @@ cTValue* tea_meta_getattr(tea_State* T, GCstr* name, TValue* obj)
             if(klass)
             {
                 uint8_t flags = ACC_GET;
-                TValue* mo = tea_tab_getx(&klass->methods, name, &flags);
+                TValue* mo = tea_meta_icget(T, pt, ic, klass, name, &flags, MM__MAX);
                 if(mo)
                 {
                     if(flags & ACC_GET)
@@ -173,7 +375,7 @@ cTValue* tea_meta_getattr(tea_State* T, GCstr* name, TValue* obj)
                         tea_vm_call(T, mo, 0);
                         return --T->top;
                     }
-                    GCmethod* bound = tea_method_new(T, T->top - 1, funcV(mo));
+                    GCmethod* bound = tea_method_new(T, obj, funcV(mo));
                     setmethodV(T, &T->tmptv, bound);
                     return &T->tmptv;
                 }
@@ -181,11 +383,11 @@ cTValue* tea_meta_getattr(tea_State* T, GCstr* name, TValue* obj)
             break;
         }
     }
-    tea_err_callerv(T, TEA_ERR_NOATTR, tea_typename(obj), str_data(name));
+    tea_err_callerv(T, TEA_ERR_NOATTR, tea_typename(obj), tea_str_data(T, name));
 }
 
 /* Set attribute to object */
-cTValue* tea_meta_setattr(tea_State* T, GCstr* name, TValue* obj, TValue* item)
+cTValue* tea_meta_setattrx(tea_State* T, GCproto* pt, uint8_t ic, GCstr* name, TValue* obj, TValue* item)
 {
     switch(itype(obj))
     {
@@ -194,30 +396,31 @@ cTValue* tea_meta_setattr(tea_State* T, GCstr* name, TValue* obj, TValue* item)
         {
             GCinstance* instance = instanceV(obj);
             uint8_t flags = ACC_SET;
-            TValue* mo = tea_tab_getx(&instance->klass->methods, name, &flags);
-            if(mo && (flags & ACC_SET))
+            TValue* mo = tea_meta_icsetattr(T, pt, ic, instance, name, &flags);
+            if(flags & ACC_SLOT)
             {
-                copyTV(T, T->top++, obj);
-                copyTV(T, T->top++, item);
-                tea_vm_call(T, mo, 1);
-                return --T->top;
+                copyTV(T, mo, item);
+                tea_gc_barrierback(T, obj2gco(instance));
+                return item;
             }
-            mo = tea_meta_lookup(T, obj, MM_SETATTR);
-            if(mo)
-            {             
+            if(flags & ACC_MM)
+            {
                 copyTV(T, T->top++, obj);
                 setstrV(T, T->top++, name);
                 copyTV(T, T->top++, item);
                 tea_vm_call(T, mo, 2);
                 return --T->top;
             }
-            copyTV(T, tea_tab_set(T, &instance->attrs, name), item);
-            return item;
+            copyTV(T, T->top++, obj);
+            copyTV(T, T->top++, item);
+            tea_vm_call(T, mo, 1);
+            return --T->top;
         }
         case TEA_TMODULE:
         {
             GCmodule* module = moduleV(obj);
             copyTV(T, tea_tab_set(T, &module->exports, name), item);
+            tea_gc_barrierback(T, obj2gco(module));
             return item;
         }
         default:
@@ -226,7 +429,7 @@ cTValue* tea_meta_setattr(tea_State* T, GCstr* name, TValue* obj, TValue* item)
             if(klass)
             {
                 uint8_t flags = ACC_SET;
-                TValue* mo = tea_tab_getx(&klass->methods, name, &flags);
+                TValue* mo = tea_meta_icget(T, pt, ic, klass, name, &flags, MM__MAX);
                 if(mo && (flags & ACC_SET))
                 {
                     copyTV(T, T->top++, obj);
@@ -250,7 +453,7 @@ void tea_meta_delattr(tea_State* T, GCstr* name, TValue* obj)
         case TEA_TINSTANCE:
         {
             GCinstance* instance = instanceV(obj);
-            if(!tea_tab_delete(&instance->attrs, name))
+            if(!tea_instance_delete(T, instance, name))
                 break;
             return;
         }
@@ -264,7 +467,7 @@ void tea_meta_delattr(tea_State* T, GCstr* name, TValue* obj)
         default:
             break;
     }
-    tea_err_callerv(T, TEA_ERR_NOATTR, tea_typename(obj), str_data(name));
+    tea_err_callerv(T, TEA_ERR_NOATTR, tea_typename(obj), tea_str_data(T, name));
 }
 
 /* Get index from object */
@@ -344,7 +547,7 @@ cTValue* tea_meta_getindex(tea_State* T, TValue* obj, TValue* index_value)
         case TEA_TMAP:
         {
             GCmap* map = mapV(obj);
-            cTValue* o = tea_map_get(map, index_value);
+            cTValue* o = tea_map_get(T, map, index_value);
             if(o) return o;
             tea_err_msg(T, TEA_ERR_MAPKEY);
         }
@@ -362,7 +565,7 @@ cTValue* tea_meta_getindex(tea_State* T, TValue* obj, TValue* index_value)
                 return &T->tmptv;
             }
 
-            GCstr* str = strV(obj);
+            GCstr* str = tea_str_flatten(T, strV(obj));
             int32_t idx = numV(index_value);
 
             /* Allow negative indexes */
@@ -373,7 +576,7 @@ cTValue* tea_meta_getindex(tea_State* T, TValue* obj, TValue* index_value)
 
             if(idx >= 0 && idx < str->len)
             {
-                GCstr* c = tea_str_new(T, str_data(str) + idx, 1);
+                GCstr* c = tea_str_new(T, str_mem(str) + idx, 1);
                 setstrV(T, &T->tmptv, c);
                 return &T->tmptv;
             }
@@ -423,6 +626,7 @@ cTValue* tea_meta_setindex(tea_State* T, TValue* obj, TValue* index_value, TValu
             if(idx >= 0 && idx < list->len)
             {
                 copyTV(T, list_slot(list, idx), item_value);
+                tea_gc_barrierback(T, obj2gco(list));
                 return item_value;
             }
             tea_err_msg(T, TEA_ERR_IDXLIST);
@@ -13,12 +13,22 @@ TEA_FUNC TValue* tea_meta_lookup(tea_State* T, cTValue* o, MMS mm);
 TEA_FUNC GCclass* tea_meta_getclass(tea_State* T, cTValue* value);
 TEA_FUNC bool tea_meta_isclass(tea_State* T, GCclass* klass);
 
+/* Inline caches */
+TEA_FUNC TValue* tea_meta_icget(tea_State* T, GCproto* pt, uint8_t ic, GCclass* klass, GCstr* name, uint8_t* flags, MMS mm);
+TEA_FUNC TValue* tea_meta_icattr(tea_State* T, GCproto* pt, uint8_t ic, GCinstance* instance, GCstr* name, uint8_t* flags, MMS mm);
+TEA_FUNC TValue* tea_meta_icsetattr(tea_State* T, GCproto* pt, uint8_t ic, GCinstance* instance, GCstr* name, uint8_t* flags);
+
 /* Attributes */
 TEA_FUNC bool tea_meta_hasattr(tea_State* T, GCstr* name, TValue* obj);
-TEA_FUNC cTValue* tea_meta_getattr(tea_State* T, GCstr* name, TValue* obj);
-TEA_FUNC cTValue* tea_meta_setattr(tea_State* T, GCstr* name, TValue* obj, TValue* item);
+TEA_FUNC cTValue* tea_meta_getattrx(tea_State* T, GCproto* pt, uint8_t ic, GCstr* name, TValue* obj);
+TEA_FUNC cTValue* tea_meta_setattrx(tea_State* T, GCproto* pt, uint8_t ic, GCstr* name, TValue* obj, TValue* item);
 TEA_FUNC void tea_meta_delattr(tea_State* T, GCstr* name, TValue* obj);
 
+#define tea_meta_getattr(T, name, obj) \
+    tea_meta_getattrx((T), NULL, IC_NONE, (name), (obj))
+#define tea_meta_setattr(T, name, obj, item) \
+    tea_meta_setattrx((T), NULL, IC_NONE, (name), (obj), (item))
+
 /* Indexing */
 TEA_FUNC cTValue* tea_meta_getindex(tea_State* T, TValue* obj, TValue* index_value);
 TEA_FUNC cTValue* tea_meta_setindex(tea_State* T, TValue* obj, TValue* index_value, TValue* item_value);
@@ -11,7 +11,9 @@
 #include "tea_obj.h"
 #include "tea_map.h"
 #include "tea_tab.h"
+#include "tea_shape.h"
 #include "tea_strscan.h"
+#include "tea_str.h"
 
 /* Object type names */
 TEA_DATADEF const char* const tea_obj_typenames[] = {
@@ -73,13 +75,19 @@ GCclass* tea_class_new(tea_State* T, GCstr* name)
     k->super = gcroot_objclass(T);
     setnilV(&k->init);
     tea_tab_init(&k->methods);
+    k->shape = NULL;
+    k->nshapes = 0;
     return k;
 }
 
 GCinstance* tea_instance_new(tea_State* T, GCclass* klass)
 {
+    Shape* shape = tea_shape_root(T, klass);
     GCinstance* instance = tea_mem_newobj(T, GCinstance, TEA_TINSTANCE);
     instance->klass = klass;
+    instance->shape = shape;
+    instance->slots = NULL;
+    instance->size = 0;
     tea_tab_init(&instance->attrs);
     return instance;
 }
@@ -97,29 +105,32 @@ void TEA_FASTCALL tea_module_free(tea_State* T, GCmodule* module)
     tea_mem_freevec(T, TValue, module->vars, module->size);
     tea_mem_freevec(T, GCstr*, module->varnames, module->size);
     tea_tab_free(T, &module->exports);
-    tea_mem_freet(T, module);
+    tea_mem_freegcot(T, module);
 }
 
 void TEA_FASTCALL tea_range_free(tea_State* T, GCrange* range)
 {
-    tea_mem_freet(T, range);
+    tea_mem_freegcot(T, range);
 }
 
 void TEA_FASTCALL tea_class_free(tea_State* T, GCclass* klass)
 {
     tea_tab_free(T, &klass->methods);
-    tea_mem_freet(T, klass);
+    if(klass->shape)
+        tea_shape_free(T, klass->shape);
+    tea_mem_freegcot(T, klass);
 }
 
 void TEA_FASTCALL tea_instance_free(tea_State* T, GCinstance* instance)
 {
+    tea_mem_freevec(T, TValue, instance->slots, instance->size);
     tea_tab_free(T, &instance->attrs);
-    tea_mem_freet(T, instance);
+    tea_mem_freegcot(T, instance);
 }
 
 void TEA_FASTCALL tea_method_free(tea_State* T, GCmethod* method)
 {
-    tea_mem_freet(T, method);
+    tea_mem_freegcot(T, method);
 }
 
 /* Return pointer to object or its object data */
@@ -140,7 +151,7 @@ static bool obj_range_equal(GCrange* a, GCrange* b)
     return a->start == b->start && a->end == b->end && a->step == b->step;
 }
 
-static bool obj_list_equal(GClist* a, GClist* b)
+static bool obj_list_equal(tea_State* T, GClist* a, GClist* b)
 {
     if(a == b)
         return true;
@@ -150,7 +161,7 @@ static bool obj_list_equal(GClist* a, GClist* b)
 
     for(int i = 0; i < a->len; i++)
     {
-        if(!tea_obj_equal(list_slot(a, i), list_slot(b, i)))
+        if(!tea_obj_equal(T, list_slot(a, i), list_slot(b, i)))
         {
             return false;
         }
@@ -159,7 +170,7 @@ static bool obj_list_equal(GClist* a, GClist* b)
     return true;
 }
 
-static bool obj_map_equal(GCmap* a, GCmap* b)
+static bool obj_map_equal(tea_State* T, GCmap* a, GCmap* b)
 {
     if(a == b)
         return true;
@@ -179,13 +190,13 @@ static bool obj_map_equal(GCmap* a, GCmap* b)
             continue;
         }
 
-        cTValue* value = tea_map_get(b, &entry->key);
+        cTValue* value = tea_map_get(T, b, &entry->key);
         if(!value)
         {
             return false;
         }
 
-        if(!tea_obj_equal(&entry->val, value))
+        if(!tea_obj_equal(T, &entry->val, value))
         {
             return false;
         }
@@ -195,7 +206,7 @@ static bool obj_map_equal(GCmap* a, GCmap* b)
 }
 
 /* Compare two values */
-bool tea_obj_equal(cTValue* a, cTValue* b)
+bool tea_obj_equal(tea_State* T, cTValue* a, cTValue* b)
 {
     if(itype(a) != itype(b))
         return false;
@@ -209,19 +220,21 @@ bool tea_obj_equal(cTValue* a, cTValue* b)
             return numV(a) == numV(b);
         case TEA_TPOINTER:
             return pointerV(a) == pointerV(b);
+        case TEA_TSTR:
+            return tea_str_equal(T, strV(a), strV(b));
         case TEA_TRANGE:
             return obj_range_equal(rangeV(a), rangeV(b));
         case TEA_TLIST:
-            return obj_list_equal(listV(a), listV(b));
+            return obj_list_equal(T, listV(a), listV(b));
         case TEA_TMAP:
-            return obj_map_equal(mapV(a), mapV(b));
+            return obj_map_equal(T, mapV(a), mapV(b));
         default:
             return gcV(a) == gcV(b);
     }
 }
 
 /* Compare two values without additional checks */
-bool tea_obj_rawequal(cTValue* a, cTValue* b)
+bool tea_obj_rawequal(tea_State* T, cTValue* a, cTValue* b)
 {
     if(itype(a) != itype(b))
         return false;
@@ -235,13 +248,15 @@ bool tea_obj_rawequal(cTValue* a, cTValue* b)
             return numV(a) == numV(b);
         case TEA_TPOINTER:
             return pointerV(a) == pointerV(b);
+        case TEA_TSTR:
+            return tea_str_equal(T, strV(a), strV(b));
         default:
             return gcV(a) == gcV(b);
     }
 }
 
 /* Attempt to convert a value into a number */
-double tea_obj_tonum(TValue* o, bool* x)
+double tea_obj_tonum(tea_State* T, TValue* o, bool* x)
 {
     if(x != NULL)
         *x = true;
@@ -257,9 +272,10 @@ double tea_obj_tonum(TValue* o, bool* x)
         {
             GCstr* str = strV(o);
             TValue tv;
+            tea_str_data(T, str);   /* The scan stops at the terminating '\0' */
             if(tea_strscan_num(str, &tv))
             {
-                return tv.value.n;
+                return numV(&tv);
             }
         /* Fallback */
         }
@@ -14,6 +14,18 @@
 
 typedef union GCobj GCobj;
 
+#if TEA_NANBOX
+/*
+** NaN-boxed value. Numbers are stored as plain doubles. All other values
+** live in the NaN space above the hardware-generated NaNs: the upper 17
+** bits hold the internal tag, the lower 47 bits hold the payload
+*/
+typedef union
+{
+    uint64_t u64;
+    double n;
+} TValue;
+#else
 /* Tagged value */
 typedef struct
 {
@@ -26,6 +38,7 @@ typedef struct
         GCobj* gc;
     } value;
 } TValue;
+#endif
 
 typedef const TValue cTValue;
 
@@ -93,12 +106,49 @@ typedef struct GCstr
 {
     GCheader;
     uint8_t reserved;   /* Used by lexer for fast lookup of reserved words */
+    uint8_t interned;   /* In the string interning table, unique by content */
     StrHash hash;  /* Hash of string */
     uint32_t len;    /* Size of string */
+    uint8_t kind;   /* Representation of the contents, see below */
 } GCstr;
 
-#define str_data(s) ((const char*)((s) + 1))
+/* String representations */
+#define STR_FLAT 0  /* Contents follow the header */
+#define STR_ROPE 1  /* Deferred concatenation, a StrRope follows */
+#define STR_VIEW 2  /* Part of another string, a StrView follows */
+
+/* Parts of a deferred concatenation, flattened by tea_str_flatten() */
+typedef struct StrRope
+{
+    GCstr* left;    /* Parts, NULL once flattened */
+    GCstr* right;
+    char* data;     /* Flattened contents, NULL until then */
+} StrRope;
+
+/* Contents shared with another string, copied by tea_str_data() when they must be terminated */
+typedef struct StrView
+{
+    GCstr* parent;  /* String holding the contents, NULL once copied */
+    const char* data;   /* Contents, in the parent or in the copy */
+} StrView;
+
+#define str_rope(s) ((StrRope*)((s) + 1))
+#define str_view(s) ((StrView*)((s) + 1))
+/* A rope that was not flattened yet, its contents and hash are unknown */
+#define str_isrope(s) ((s)->kind == STR_ROPE && str_rope(s)->data == NULL)
+/* A view that was not copied yet, its contents are not terminated */
+#define str_isview(s) ((s)->kind == STR_VIEW && str_view(s)->parent != NULL)
 #define str_datawr(s) ((char*)((s) + 1))
+/* Contents of a string, not necessarily terminated by a '\0' */
+#define str_mem(s) \
+    (TEA_LIKELY((s)->kind == STR_FLAT) ? (const char*)((s) + 1) : \
+     (tea_assertX(!str_isrope(s), "contents of a rope that was not flattened"), \
+      (s)->kind == STR_ROPE ? (const char*)str_rope(s)->data : str_view(s)->data))
+/* Contents of a string, terminated by a '\0' */
+#define str_data(s) \
+    (tea_assertX(!str_isview(s), "terminated contents of a view"), str_mem(s))
+#define str_hashval(s) \
+    (tea_assertX(!str_isrope(s), "hash of a rope that was not flattened"), (s)->hash)
 #define strVdata(o) str_data(strV(o))
 
 /* -- Hash table -------------------------------------------------- */
@@ -107,6 +157,9 @@ typedef struct GCstr
 #define ACC_STATIC 0x1
 #define ACC_GET 0x2
 #define ACC_SET 0x4
+#define ACC_MM 0x8  /* Metamethod fallback, only set by inline caches */
+#define ACC_SLOT 0x10   /* Instance attribute, only set by inline caches */
+#define ACC_ADD 0x20    /* Instance shape transition, only set by inline caches */
 
 /* Hash node */
 typedef struct
@@ -156,6 +209,22 @@ typedef struct
 
 /* -- Prototype object -------------------------------------------------- */
 
+/* Number of receiver classes cached per inline cache site */
+#define IC_WAYS 4
+
+/* Operand for an attribute access without an inline cache site */
+#define IC_NONE 0xff
+
+/* Inline cache entry for class method lookups */
+typedef struct ICEntry
+{
+    const void* key;    /* Receiver class or instance shape */
+    uint32_t epoch; /* Inline cache epoch of the lookup */
+    uint8_t flags;  /* Accessor flags of the method, or ACC_SLOT */
+    uint16_t slot;  /* Instance attribute slot (ACC_SLOT) */
+    TValue val; /* Cached method, nil if missing, or next shape (ACC_ADD) */
+} ICEntry;
+
 typedef struct
 {
     GCheader;
@@ -169,6 +238,10 @@ typedef struct
     uint32_t sizek;    /* Number of constants */
     TValue* k;  /* Constants used by the function */
     uint16_t* uv;   /* Upvalue list */
+    uint32_t sizeic;    /* Number of inline cache sites */
+    ICEntry* ic;    /* Inline cache sites, IC_WAYS entries each */
+    uint32_t ichits;    /* Number of inline cache hits */
+    uint32_t icmisses;  /* Number of inline cache misses */
     /* ------ The following fields are for debugging/tracebacks only ------ */
     BCLine firstline;   /* First line of the code this function was defined in */
     BCLine numline; /* Number of lines for the function definition */
@@ -185,6 +258,7 @@ typedef struct
 #define proto_kgc(pt, i) (&((pt)->k[(i)]))
 #define proto_bc(pt) ((BCIns*)((char*)(pt) + sizeof(GCproto)))
 #define proto_bcpos(pt, pc) ((BCPos)((pc) - proto_bc(pt)))
+#define proto_ic(pt, i) (&((pt)->ic[(i) * IC_WAYS]))
 
 /* -- Upvalue object -------------------------------------------------- */
 
@@ -235,8 +309,12 @@ typedef union
 
 #define FF_TEA  0
 #define FF_C  1
+/* Builtin iterators, run natively by BC_FORITER */
+#define FF_ITER_LIST  2
+#define FF_ITER_MAP  3
+#define FF_ITER_STR  4
 #define isteafunc(fn)   ((fn)->c.ffid == FF_TEA)
-#define iscfunc(fn)     ((fn)->c.ffid == FF_C)
+#define iscfunc(fn)     ((fn)->c.ffid != FF_TEA)
 #define funcproto(fn)   (funcV(fn)->t.pt)
 #define sizeCfunc(n)    (sizeof(GCfuncC) - sizeof(TValue) + sizeof(TValue) * (n))
 #define sizeTfunc(n)    (sizeof(GCfuncT) - sizeof(GCupval*) + sizeof(GCupval*) * (n))
@@ -265,13 +343,30 @@ typedef struct
 typedef struct
 {
     GCheader;
+    uint8_t weak;   /* Weak mode (MAP_WEAK*) */
     uint32_t count;  /* Number of map fields */
     uint32_t size;
     MapEntry* entries;
 } GCmap;
 
+/* Weak map modes */
+#define MAP_WEAKKEY 0x01    /* Keys don't keep their entries alive */
+#define MAP_WEAKVAL 0x02    /* Values don't keep their entries alive */
+#define MAP_WEAKMODE (MAP_WEAKKEY | MAP_WEAKVAL)
+#define MAP_WEAKREG 0x80    /* Map is in the list of weak objects */
+
 /* -- Class object -------------------------------------------------- */
 
+/* Attribute layout shared by instances of a class */
+typedef struct Shape
+{
+    struct Shape* parent;   /* Layout without the last attribute */
+    struct Shape* kids; /* First transition to a larger layout */
+    struct Shape* next; /* Next sibling transition of the parent */
+    GCstr* key; /* Last attribute added, NULL for the root */
+    uint32_t nslots;    /* Number of attribute slots */
+} Shape;
+
 typedef struct GCclass
 {
     GCheader;
@@ -279,6 +374,8 @@ typedef struct GCclass
     struct GCclass* super;  /* Inherited class or NULL */
     TValue init; /* Cached */
     Tab methods;
+    Shape* shape;   /* Root of the instance layout tree */
+    uint32_t nshapes;   /* Number of instance layouts */
 } GCclass;
 
 /* -- Instance object -------------------------------------------------- */
@@ -287,7 +384,10 @@ typedef struct
 {
     GCheader;
     GCclass* klass; /* Instance class */
-    Tab attrs;    /* Instance attributes */
+    Shape* shape;   /* Attribute layout, NULL for a dictionary */
+    TValue* slots;  /* Attribute values, laid out by shape */
+    uint32_t size;  /* Size of slots array */
+    Tab attrs;    /* Instance attributes in dictionary mode */
 } GCinstance;
 
 /* -- Userdata object ----------------------------------------------------- */
@@ -297,6 +397,9 @@ typedef struct GCudata
 {
     GCheader;
     GCclass* klass;
+    Shape* shape;   /* Always NULL */
+    TValue* slots;
+    uint32_t size;
     Tab attrs;
     uint8_t udtype; /* Userdata type */
     uint8_t nuvals;    /* Number of uservalues */
@@ -310,6 +413,7 @@ enum
     UDTYPE_USERDATA,    /* Regular userdata */
     UDTYPE_IOFILE,  /* io module FILE */
     UDTYPE_BUFFER,  /* String buffer */
+    UDTYPE_WEAKREF, /* Weak reference to its single uservalue */
     UDTYPE__MAX
 };
 
@@ -395,17 +499,62 @@ typedef enum
 #define gcroot_rangeclass(T) (gco2class((T)->gcroot[GCROOT_KLRANGE]))
 #define gcroot_objclass(T) (gco2class((T)->gcroot[GCROOT_KLOBJ]))
 
+typedef struct SlabPage SlabPage;
+typedef struct SlabChunk SlabChunk;
+typedef struct ProfState ProfState;
+
 /* Garbage collector state */
 typedef struct GCState
 {
     GCobj* root;    /* List of (almost) all collectable objects */
     size_t total; /* Memory currently allocated */
-    size_t next_gc; /* Memory threshold to activate GC */
+    size_t next_gc; /* Memory threshold to run a GC step */
+    size_t estimate;    /* Estimate of memory actually in use */
+    size_t debt;    /* Debt (how much GC is behind schedule) */
+    size_t lastmajor;   /* Memory in use after the last major collection */
+    uint8_t currentwhite;   /* Current white color */
+    uint8_t state;  /* GC state */
+    uint8_t kind;   /* Kind of collection (incremental or generational) */
+    uint32_t sweepstr;  /* Sweep position in string table */
+    GCobj** sweep;  /* Sweep position in root list */
+    GCobj* oldroot; /* List of old objects (generational) */
+    GCobj* oldud;   /* List of old userdata (generational) */
     uint32_t gray_count; /* Number of grayed GC objects */
     uint32_t gray_size;
     GCobj** gray_stack; /* List of gray objects */
+    uint32_t grayagain_count;   /* Number of objects grayed by barriers */
+    uint32_t grayagain_size;
+    GCobj** grayagain;  /* List of objects to traverse again atomically */
+    uint32_t weak_count;    /* Number of weak maps and weak references */
+    uint32_t weak_size;
+    GCobj** weak;   /* List of weak maps and weak references */
+    uint32_t view_count;    /* Number of views with an unmarked parent */
+    uint32_t view_size;
+    GCobj** views;  /* List of views with an unmarked parent */
     GCobj* rootud;  /* (Separated) list of all userdata */
     GCobj* mmudata; /* List of userdata to be GC */
+    uint32_t pause; /* Pause between successive GC cycles (in %) */
+    uint32_t stepmul;   /* GC step multiplier (in %) */
+    uint32_t minormul;  /* Heap growth before a minor collection (in %) */
+    uint32_t majormul;  /* Heap growth before a major collection (in %) */
+    uint8_t stopped;    /* GC steps stopped by the user */
+    size_t cycles;  /* Number of completed GC cycles */
+    size_t minors;  /* Number of minor collections */
+    size_t freed;   /* Bytes freed by the last cycle */
+    size_t cyclefreed;  /* Bytes freed by the current cycle */
+    size_t totalfreed;  /* Bytes freed since the state was created */
+    double pausetime;   /* Seconds spent in the collector */
+    SlabPage* slab[TEA_SLAB_NCLASS];    /* Slab pages with room per size class */
+    SlabPage* slabfree; /* Unused slab pages */
+    SlabChunk* slabchunks;  /* List of all slab chunks */
+    uint8_t los;    /* Large-object space enabled */
+    size_t lototal; /* Bytes in the large-object space */
+    size_t softlimit;   /* Memory use triggering emergency collections */
+    size_t hardlimit;   /* Memory use raising memory errors */
+    size_t memlimit;    /* Memory use at which the allocator checks the limits */
+    uint8_t emergency;  /* Full collection due at the next safe point (GCE*) */
+    size_t profleft;    /* Bytes left until the next allocation sample */
+    size_t* snapbytes;  /* Bytes marked per type while taking a heap snapshot */
 } GCState;
 
 /* String interning state */
@@ -439,6 +588,7 @@ struct tea_State
     SBuf tmpbuf;    /* Termorary string buffer */
     SBuf strbuf;    /* Termorary tostring conversion buffer */
     TValue tmptv;   /* Temporary TValue */
+    uint32_t icepoch;   /* Inline cache epoch, bumped to flush all sites */
     TValue nilval; /* A nil value */
     TValue registrytv;  /* Anchor for registry */
     GCmodule* last_module;    /* Last cached module */
@@ -452,6 +602,7 @@ struct tea_State
     char** argv;
     int argf;
     struct tea_handle* handle;  /* Dynamic library handles still open */
+    ProfState* prof;    /* Allocation profiler and heap snapshots */
 };
 
 #define curr_func(T) (T->ci->func)
@@ -471,8 +622,11 @@ typedef struct GChead
     GCheader;
 } GChead;
 
-/* The klass and attrs fields MUST be at the same offset */
+/* The klass, shape and attrs fields MUST be at the same offset */
 TEA_STATIC_ASSERT(offsetof(GCinstance, klass) == offsetof(GCudata, klass));
+TEA_STATIC_ASSERT(offsetof(GCinstance, shape) == offsetof(GCudata, shape));
+TEA_STATIC_ASSERT(offsetof(GCinstance, slots) == offsetof(GCudata, slots));
+TEA_STATIC_ASSERT(offsetof(GCinstance, size) == offsetof(GCudata, size));
 TEA_STATIC_ASSERT(offsetof(GCinstance, attrs) == offsetof(GCudata, attrs));
 
 union GCobj
@@ -511,32 +665,81 @@ union GCobj
 
 /* -- TValue getters/setters -------------------------------------------------- */
 
+#if TEA_NANBOX
+
+/* NaN-boxing layout */
+#define NB_TAGSHIFT 47
+#define NB_PAYLOAD (((uint64_t)1 << NB_TAGSHIFT) - 1)
+
+/* Boxed tag of an internal object tag. Numbers have no boxed tag */
+#define NB_ITAG(t) ((uint32_t)(0x1ffff - (t) + ((t) > TEA_TNUM)))
+#define NB_BOX(t, p) (((uint64_t)NB_ITAG(t) << NB_TAGSHIFT) | (uint64_t)(p))
+#define NB_NUMMAX NB_BOX(TEA_TMETHOD, 0)  /* Every number is below this */
+
+/* All boxed tags must lie above the negative quiet NaN (0x1fff0) */
+TEA_STATIC_ASSERT(NB_ITAG(TEA_TMETHOD) > 0x1fff0);
+
+#define nbitag(o) ((uint32_t)((o)->u64 >> NB_TAGSHIFT))
+
+/* Get the internal object tag of a value */
+static TEA_AINLINE uint32_t itype(cTValue* o)
+{
+    uint32_t t;
+    if(o->u64 < NB_NUMMAX)
+        return TEA_TNUM;
+    t = 0x1ffff - nbitag(o);
+    return t + (t >= TEA_TNUM);
+}
+
+/* Macros to test types */
+#define tvistt(o, t) (nbitag(o) == NB_ITAG(t))
+#define tvisnil(o) ((o)->u64 == NB_BOX(TEA_TNIL, 0))
+#define tvisfalse(o) ((o)->u64 == NB_BOX(TEA_TBOOL, 0))
+#define tvistrue(o) ((o)->u64 == NB_BOX(TEA_TBOOL, 1))
+#define tvisnum(o) ((o)->u64 < NB_NUMMAX)
+#define tvisgcv(o) \
+    ((uint32_t)(nbitag(o) - NB_ITAG(TEA_TMETHOD)) <= \
+        NB_ITAG(TEA_TSTR) - NB_ITAG(TEA_TMETHOD))
+
+/* Macros to get tagged values */
+#define boolV(o) ((bool)((o)->u64 & 1))
+#define numV(o) ((o)->n)
+#define pointerV(o) ((void*)(uintptr_t)((o)->u64 & NB_PAYLOAD))
+#define gcV(o) ((GCobj*)(uintptr_t)((o)->u64 & NB_PAYLOAD))
+
+#else
+
 /* Macros to test types */
 #define itype(o) ((o)->tt)
+#define tvistt(o, t) (itype(o) == (t))
 #define tvisnil(o) (itype(o) == TEA_TNIL)
-#define tvisbool(o) (itype(o) == TEA_TBOOL)
 #define tvisfalse(o) ((itype(o) == TEA_TBOOL) && (!boolV(o)))
 #define tvistrue(o) ((itype(o) == TEA_TBOOL) && (boolV(o)))
 #define tvisnum(o) (itype(o) == TEA_TNUM)
-#define tvispointer(o) (itype(o) == TEA_TPOINTER)
 #define tvisgcv(o) (itype(o) >= TEA_TSTR)
-#define tvisstr(o) (itype(o) == TEA_TSTR)
-#define tvisrange(o) (itype(o) == TEA_TRANGE)
-#define tvisfunc(o) (itype(o) == TEA_TFUNC)
-#define tvismodule(o) (itype(o) == TEA_TMODULE)
-#define tvislist(o) (itype(o) == TEA_TLIST)
-#define tvismap(o) (itype(o) == TEA_TMAP)
-#define tvisclass(o) (itype(o) == TEA_TCLASS)
-#define tvisinstance(o) (itype(o) == TEA_TINSTANCE)
-#define tvismethod(o) (itype(o) == TEA_TMETHOD)
-#define tvisproto(o) (itype(o) == TEA_TPROTO)
-#define tvisudata(o) (itype(o) == TEA_TUDATA)
 
 /* Macros to get tagged values */
 #define boolV(o) ((o)->value.b)
 #define numV(o) ((o)->value.n)
 #define pointerV(o) ((o)->value.p)
 #define gcV(o) ((o)->value.gc)
+
+#endif
+
+#define tvisbool(o) tvistt(o, TEA_TBOOL)
+#define tvispointer(o) tvistt(o, TEA_TPOINTER)
+#define tvisstr(o) tvistt(o, TEA_TSTR)
+#define tvisrange(o) tvistt(o, TEA_TRANGE)
+#define tvisfunc(o) tvistt(o, TEA_TFUNC)
+#define tvismodule(o) tvistt(o, TEA_TMODULE)
+#define tvislist(o) tvistt(o, TEA_TLIST)
+#define tvismap(o) tvistt(o, TEA_TMAP)
+#define tvisclass(o) tvistt(o, TEA_TCLASS)
+#define tvisinstance(o) tvistt(o, TEA_TINSTANCE)
+#define tvismethod(o) tvistt(o, TEA_TMETHOD)
+#define tvisproto(o) tvistt(o, TEA_TPROTO)
+#define tvisudata(o) tvistt(o, TEA_TUDATA)
+
 #define strV(o) (&gcV(o)->str)
 #define rangeV(o) (&gcV(o)->range)
 #define funcV(o) (&gcV(o)->func)
@@ -550,18 +753,44 @@ union GCobj
 #define udataV(o) (&gcV(o)->ud)
 
 /* Macros to set tagged values */
+#if TEA_NANBOX
+#define setnilV(o) ((o)->u64 = NB_BOX(TEA_TNIL, 0))
+#define setfalseV(o) ((o)->u64 = NB_BOX(TEA_TBOOL, 0))
+#define settrueV(o) ((o)->u64 = NB_BOX(TEA_TBOOL, 1))
+#define setboolV(o, x) ((o)->u64 = NB_BOX(TEA_TBOOL, !!(x)))
+#define setnumV(o, x) ((o)->n = (x))
+#define setnanV(o) ((o)->u64 = U64x(fff80000,00000000))
+#define tvisnan(o) ((o)->n != (o)->n)
+
+/* NaNs from outside may carry a payload that looks like a tagged value */
+#define canonnumV(o) { TValue* _tv = (o); if(TEA_UNLIKELY(tvisnan(_tv))) setnanV(_tv); }
+
+static TEA_AINLINE void setpointerV(TValue* o, void* p)
+{
+    tea_assertX(((uintptr_t)p >> NB_TAGSHIFT) == 0, "pointer out of NaN-boxing range");
+    o->u64 = NB_BOX(TEA_TPOINTER, (uintptr_t)p);
+}
+
+static TEA_AINLINE void setgcV(tea_State* T, TValue* o, GCobj* v, uint8_t tt)
+{
+    tea_assertT(((uintptr_t)v >> NB_TAGSHIFT) == 0, "GC object out of NaN-boxing range");
+    o->u64 = NB_BOX(tt, (uintptr_t)v);
+}
+#else
 #define setnilV(o) ((o)->tt = TEA_TNIL)
 #define setfalseV(o) { TValue* _tv = (o); _tv->value.b = false; _tv->tt = TEA_TBOOL; }
 #define settrueV(o) { TValue* _tv = (o); _tv->value.b = true; _tv->tt = TEA_TBOOL; }
 #define setboolV(o, x) { TValue* _tv = (o); _tv->value.b = (x); _tv->tt = TEA_TBOOL; }
 #define setnumV(o, x) { TValue* _tv = (o); _tv->value.n = (x); _tv->tt = TEA_TNUM; }
 #define setpointerV(o, x) { TValue* _tv = (o); _tv->value.p = (x); _tv->tt = TEA_TPOINTER; }
+#define canonnumV(o) UNUSED(o)
 
 static TEA_AINLINE void setgcV(tea_State* T, TValue* o, GCobj* v, uint8_t tt)
 {
     o->value.gc = v;
     o->tt = tt;
 }
+#endif
 
 #define define_setV(name, type, tag) \
 static TEA_AINLINE void name(tea_State* T, TValue* o, const type* v) \
@@ -594,8 +823,12 @@ static TEA_AINLINE void setint64V(TValue* o, int64_t i)
 /* Copy tagged values */
 static TEA_AINLINE void copyTV(tea_State* T, TValue* o1, cTValue* o2)
 {
+#if TEA_NANBOX
+    o1->u64 = o2->u64;
+#else
     o1->value = o2->value;
     o1->tt = o2->tt;
+#endif
 }
 
 /* Names for internal and external object tags */
@@ -619,9 +852,9 @@ TEA_FUNC void TEA_FASTCALL tea_method_free(tea_State* T, GCmethod* method);
 /* -- Object and value handling --------------------------------------- */
 
 TEA_FUNC const void* tea_obj_pointer(cTValue* v);
-TEA_FUNC bool tea_obj_equal(cTValue* a, cTValue* b);
-TEA_FUNC bool tea_obj_rawequal(cTValue* a, cTValue* b);
-TEA_FUNC double tea_obj_tonum(TValue* o, bool* x);
+TEA_FUNC bool tea_obj_equal(tea_State* T, cTValue* a, cTValue* b);
+TEA_FUNC bool tea_obj_rawequal(tea_State* T, cTValue* a, cTValue* b);
+TEA_FUNC double tea_obj_tonum(tea_State* T, TValue* o, bool* x);
 
 static TEA_AINLINE bool tea_obj_isfalse(cTValue* o)
 {
@@ -51,6 +51,8 @@ typedef struct
     bool isupval;
     bool isconst;
     bool init;
+    bool hask;  /* Constant with a known value */
+    TValue k;   /* Value of the constant */
 } Local;
 
 typedef struct
@@ -98,6 +100,9 @@ typedef struct ArgCtx
     int num;
 } ArgCtx;
 
+#define NO_BCPOS (~(BCPos)0)
+#define BC_MAXFUSE 4    /* Max. number of instructions fused into one */
+
 /* Per-function state */
 typedef struct FuncState
 {
@@ -114,6 +119,9 @@ typedef struct FuncState
     uint8_t numparams;  /* Number of parameters */
     uint8_t numopts;    /* Number of optional parameters */
     uint32_t nuv;    /* Number of upvalues */
+    uint32_t nic;   /* Number of inline cache sites */
+    BCPos lasttarget;   /* Last jump target */
+    BCPos lastins[BC_MAXFUSE];  /* Start of the last emitted instructions */
     GCstr* name;    /* Name of prototype function */
     int max_slots; /* Stack max size */
     KlassState* klass; /* Current class state */
@@ -206,7 +214,7 @@ static uint8_t const_num(FuncState* fs, TValue* n)
 {
     tea_State* T = fs->T;
     GCmap* kt = fs->kt;
-    TValue* o = (TValue*)tea_map_get(kt, n);
+    TValue* o = (TValue*)tea_map_get(T, kt, n);
     if(o && tvisnum(o))
         return (uint8_t)numV(o);
     o = tea_map_set(T, kt, n);
@@ -221,7 +229,7 @@ static uint8_t const_gc(FuncState* fs, GCobj* obj, uint32_t tt)
     GCmap* kt = fs->kt;
     TValue key, *o;
     setgcV(T, &key, obj, tt);
-    o = (TValue*)tea_map_get(kt, &key);
+    o = (TValue*)tea_map_get(T, kt, &key);
     if(o && tvisnum(o))
         return (uint8_t)numV(o);
     o = tea_map_set(T, kt, &key);
@@ -235,12 +243,28 @@ static uint8_t const_str(FuncState* fs, GCstr* str)
     return const_gc(fs, (GCobj*)str, TEA_TSTR);
 }
 
+/* Get the value of a number/string constant */
+static bool const_get(FuncState* fs, uint8_t k, TValue* o)
+{
+    GCmap* kt = fs->kt;
+    for(uint32_t i = 0; i < kt->size; i++)
+    {
+        MapEntry* n = &kt->entries[i];
+        if(!tvisnil(&n->key) && tvisnum(&n->val) && numV(&n->val) == k)
+        {
+            copyTV(fs->T, o, &n->key);
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Anchor string constant to avoid GC */
 GCstr* tea_parse_keepstr(LexState* ls, const char* str, size_t len)
 {
     tea_State* T = ls->T;
     GCmap* kt = ls->fs->kt;
-    GCstr* s = tea_str_new(T, str, len);
+    GCstr* s = tea_str_newintern(T, str, len);  /* Names are compared by identity */
     TValue* tv = (TValue*)tea_map_getstr(T, kt, s);
     if(!tv)
     {
@@ -284,9 +308,25 @@ static const int bc_effects[] = {
 #undef BCEFFECT
 };
 
+/* Operand byte count of each bytecode instruction */
+static const int bc_argcount[] = {
+#define BCARG(_, __, argcount) argcount,
+    BCDEF(BCARG)
+#undef BCARG
+};
+
+/* Record the start of a new instruction */
+static void bcemit_mark(FuncState* fs)
+{
+    for(int i = BC_MAXFUSE - 1; i > 0; i--)
+        fs->lastins[i] = fs->lastins[i - 1];
+    fs->lastins[0] = fs->pc;
+}
+
 /* Emit bytecode instruction */
 static void bcemit_op(FuncState* fs, BCOp op)
 {
+    bcemit_mark(fs);
     bcemit_byte(fs, op);
     fs->max_slots += bc_effects[op];
 }
@@ -294,17 +334,200 @@ static void bcemit_op(FuncState* fs, BCOp op)
 /* Emit 2 bytecode instructions */
 static void bcemit_ops(FuncState* fs, BCOp op1, BCOp op2)
 {
-    bcemit_bytes(fs, op1, op2);
-    fs->max_slots += bc_effects[op1] + bc_effects[op2];
+    bcemit_op(fs, op1);
+    bcemit_op(fs, op2);
 }
 
 /* Emit a bytecode instruction with a byte argument */
 static void bcemit_arg(FuncState* fs, BCOp op, uint8_t byte)
 {
+    bcemit_mark(fs);
     bcemit_bytes(fs, op, byte);
     fs->max_slots += bc_effects[op];
 }
 
+/* -- Superinstructions --------------------------------------------------- */
+
+/*
+** Check if the last n emitted instructions are contiguous, end at the
+** current position and contain no jump target. Returns their start
+*/
+static BCPos bcfuse_check(FuncState* fs, int n)
+{
+    BCPos pc = fs->pc;
+    for(int i = 0; i < n; i++)
+    {
+        BCPos start = fs->lastins[i];
+        if(start == NO_BCPOS || start + 1 + bc_argcount[fs->bcbase[start].ins] != pc)
+            return NO_BCPOS;
+        pc = start;
+    }
+    return pc >= fs->lasttarget ? pc : NO_BCPOS;
+}
+
+/* Get the opcode of the i-th last emitted instruction */
+#define bcfuse_op(fs, i) ((fs)->bcbase[(fs)->lastins[i]].ins)
+
+/* Get an operand of the i-th last emitted instruction */
+#define bcfuse_arg(fs, i, n) ((fs)->bcbase[(fs)->lastins[i] + (n)].ins)
+
+/* Replace the last n instructions with a fused instruction at start */
+static void bcfuse_begin(FuncState* fs, int n, BCPos start, BCOp op)
+{
+    for(int i = 0; i < BC_MAXFUSE; i++)
+        fs->lastins[i] = i + n - 1 < BC_MAXFUSE ? fs->lastins[i + n - 1] : NO_BCPOS;
+    fs->lastins[0] = start;
+    fs->pc = start;
+    bcemit_byte(fs, op);
+}
+
+/* Fuse GETLOCAL+GETATTR into GETLOCALATTR */
+static bool bcfuse_getattr(FuncState* fs, uint8_t name)
+{
+    BCPos start = bcfuse_check(fs, 1);
+    if(start == NO_BCPOS || bcfuse_op(fs, 0) != BC_GETLOCAL)
+        return false;
+    uint8_t slot = bcfuse_arg(fs, 0, 1);
+    bcfuse_begin(fs, 1, start, BC_GETLOCALATTR);
+    bcemit_bytes(fs, slot, name);
+    fs->max_slots += bc_effects[BC_GETATTR];
+    return true;
+}
+
+/* Fuse GETLOCAL+CONSTANT+ADD+SETLOCAL+POP into INCLOCAL */
+static bool bcfuse_pop(FuncState* fs)
+{
+    BCPos start = bcfuse_check(fs, 4);
+    if(start == NO_BCPOS ||
+        bcfuse_op(fs, 3) != BC_GETLOCAL || bcfuse_op(fs, 2) != BC_CONSTANT ||
+        bcfuse_op(fs, 1) != BC_ADD || bcfuse_op(fs, 0) != BC_SETLOCAL ||
+        bcfuse_arg(fs, 3, 1) != bcfuse_arg(fs, 0, 1))
+        return false;
+    uint8_t slot = bcfuse_arg(fs, 0, 1);
+    uint8_t k = bcfuse_arg(fs, 2, 1);
+    bcfuse_begin(fs, 4, start, BC_INCLOCAL);
+    bcemit_bytes(fs, slot, k);
+    fs->max_slots += bc_effects[BC_POP];
+    return true;
+}
+
+/*
+** Fuse GETLOCAL+GETLOCAL+ISxx+JMPFALSE+POP into ISxxJMP.
+** Returns the position of the jump offset or NO_BCPOS
+*/
+static BCPos bcfuse_branch(FuncState* fs)
+{
+    BCPos start = bcfuse_check(fs, 3);
+    BCOp op;
+    if(start == NO_BCPOS ||
+        bcfuse_op(fs, 2) != BC_GETLOCAL || bcfuse_op(fs, 1) != BC_GETLOCAL)
+        return NO_BCPOS;
+    switch(bcfuse_op(fs, 0))
+    {
+        case BC_ISLT: op = BC_ISLTJMP; break;
+        case BC_ISLE: op = BC_ISLEJMP; break;
+        case BC_ISGT: op = BC_ISGTJMP; break;
+        case BC_ISGE: op = BC_ISGEJMP; break;
+        default: return NO_BCPOS;
+    }
+    uint8_t slot1 = bcfuse_arg(fs, 2, 1);
+    uint8_t slot2 = bcfuse_arg(fs, 1, 1);
+    bcfuse_begin(fs, 3, start, op);
+    bcemit_bytes(fs, slot1, slot2);
+    bcemit_bytes(fs, 0xff, 0xff);
+    fs->max_slots += bc_effects[BC_JMPFALSE] + bc_effects[BC_POP];
+    return fs->pc - 2;
+}
+
+/* Drop the last n instructions, starting at start */
+static void bcfuse_drop(FuncState* fs, int n, BCPos start)
+{
+    for(int i = 0; i < BC_MAXFUSE; i++)
+        fs->lastins[i] = i + n < BC_MAXFUSE ? fs->lastins[i + n] : NO_BCPOS;
+    fs->pc = start;
+}
+
+/* Drop a trailing RANGE, leaving its operands on the stack */
+static bool bcfuse_range(FuncState* fs)
+{
+    BCPos start = bcfuse_check(fs, 1);
+    if(start == NO_BCPOS || bcfuse_op(fs, 0) != BC_RANGE)
+        return false;
+    bcfuse_drop(fs, 1, start);
+    fs->max_slots -= bc_effects[BC_RANGE];
+    return true;
+}
+
+/*
+** Drop a trailing GETATTR whose result is about to be called, leaving
+** the object as the callee of an INVOKE
+*/
+static bool bcfuse_invoke(FuncState* fs, uint8_t* name, uint8_t* ic)
+{
+    BCPos start = bcfuse_check(fs, 1);
+    if(start == NO_BCPOS)
+        return false;
+    switch(bcfuse_op(fs, 0))
+    {
+        case BC_GETATTR:
+            *name = bcfuse_arg(fs, 0, 1);
+            *ic = bcfuse_arg(fs, 0, 2);
+            bcfuse_drop(fs, 1, start);
+            break;
+        case BC_GETLOCALATTR:
+        {
+            uint8_t slot = bcfuse_arg(fs, 0, 1);
+            *name = bcfuse_arg(fs, 0, 2);
+            *ic = bcfuse_arg(fs, 0, 3);
+            bcfuse_begin(fs, 1, start, BC_GETLOCAL);
+            bcemit_byte(fs, slot);
+            break;
+        }
+        default:
+            return false;
+    }
+    fs->max_slots -= bc_effects[BC_GETATTR];
+    return true;
+}
+
+/*
+** Drop a trailing load of the superclass and GETSUPER whose result is
+** about to be called. The load is moved after the arguments of a SUPER
+*/
+static bool bcfuse_super(FuncState* fs, uint8_t* name, uint8_t* load)
+{
+    BCPos start = bcfuse_check(fs, 2);
+    if(start == NO_BCPOS || bcfuse_op(fs, 0) != BC_GETSUPER)
+        return false;
+    switch(bcfuse_op(fs, 1))
+    {
+        case BC_GETLOCAL: case BC_GETUPVAL: case BC_GETMODULE: case BC_GETGLOBAL:
+            break;
+        default:
+            return false;
+    }
+    load[0] = bcfuse_op(fs, 1);
+    load[1] = bcfuse_arg(fs, 1, 1);
+    *name = bcfuse_arg(fs, 0, 1);
+    bcfuse_drop(fs, 2, start);
+    fs->max_slots -= bc_effects[load[0]] + bc_effects[BC_GETSUPER];
+    return true;
+}
+
+/* Emit the operand of a new inline cache site */
+static void bcemit_ic(FuncState* fs)
+{
+    bcemit_byte(fs, fs->nic < IC_NONE ? fs->nic++ : IC_NONE);
+}
+
+/* Emit an attribute access instruction with its inline cache site */
+static void bcemit_attr(FuncState* fs, BCOp op, uint8_t name)
+{
+    if(!(op == BC_GETATTR && bcfuse_getattr(fs, name)))
+        bcemit_arg(fs, op, name);
+    bcemit_ic(fs);
+}
+
 /* Emit a loop instruction */
 static void bcemit_loop(FuncState* fs, BCPos start)
 {
@@ -324,6 +547,25 @@ static BCPos bcemit_jump(FuncState* fs, BCOp op)
     return fs->pc - 2;
 }
 
+/* Emit a jump if the condition is false, popping it otherwise */
+static BCPos bcemit_branch(FuncState* fs)
+{
+    BCPos jmp = bcfuse_branch(fs);
+    if(jmp == NO_BCPOS)
+    {
+        jmp = bcemit_jump(fs, BC_JMPFALSE);
+        bcemit_op(fs, BC_POP);
+    }
+    return jmp;
+}
+
+/* Emit a pop instruction */
+static void bcemit_pop(FuncState* fs)
+{
+    if(!bcfuse_pop(fs))
+        bcemit_op(fs, BC_POP);
+}
+
 /* Emit a return instruction */
 static void bcemit_return(FuncState* fs)
 {
@@ -338,14 +580,6 @@ static void bcemit_return(FuncState* fs)
     bcemit_op(fs, BC_RETURN);
 }
 
-/* Emit an invoke instruction */
-static void bcemit_invoke(FuncState* fs, int args, const char* name)
-{
-    GCstr* str = tea_str_new(fs->T, name, strlen(name));
-    bcemit_arg(fs, BC_INVOKE, const_str(fs, str));
-    bcemit_byte(fs, args);
-}
-
 static void bcemit_num(FuncState* fs, double n)
 {
     TValue tv; setnumV(&tv, n);
@@ -366,6 +600,486 @@ static void bcpatch_jump(FuncState* fs, BCPos ofs)
         error(fs, TEA_ERR_XJUMP);
     fs->bcbase[ofs].ins = (jmp >> 8) & 0xff;
     fs->bcbase[ofs + 1].ins = jmp & 0xff;
+    fs->lasttarget = fs->pc;
+}
+
+/* Get the current position as a jump target */
+static BCPos bctarget(FuncState* fs)
+{
+    return fs->lasttarget = fs->pc;
+}
+
+/* -- Constant folding ---------------------------------------------------- */
+
+/* Emit an instruction loading a constant value */
+static void bcemit_k(FuncState* fs, cTValue* o)
+{
+    if(tvisnil(o))
+        bcemit_op(fs, BC_KNIL);
+    else if(tvisbool(o))
+        bcemit_op(fs, boolV(o) ? BC_KTRUE : BC_KFALSE);
+    else if(tvisnum(o))
+        bcemit_arg(fs, BC_CONSTANT, const_num(fs, (TValue*)o));
+    else
+        bcemit_arg(fs, BC_CONSTANT, const_str(fs, strV(o)));
+}
+
+/* Get the value loaded by the i-th last emitted instruction, if constant */
+static bool bcfold_get(FuncState* fs, int i, TValue* o)
+{
+    switch(bcfuse_op(fs, i))
+    {
+        case BC_KNIL:
+            setnilV(o);
+            return true;
+        case BC_KTRUE:
+            setboolV(o, true);
+            return true;
+        case BC_KFALSE:
+            setboolV(o, false);
+            return true;
+        case BC_CONSTANT:
+            return const_get(fs, bcfuse_arg(fs, i, 1), o);
+        default:
+            return false;
+    }
+}
+
+/* Replace the last n constant loads with a folded value */
+static void bcfold_emit(FuncState* fs, int n, BCPos start, cTValue* o, BCOp op)
+{
+    int slots = fs->max_slots + bc_effects[op];
+    for(int i = 0; i < BC_MAXFUSE; i++)
+        fs->lastins[i] = i + n < BC_MAXFUSE ? fs->lastins[i + n] : NO_BCPOS;
+    fs->pc = start;
+    bcemit_k(fs, o);
+    fs->max_slots = slots;  /* Same stack effect as the unfolded instructions */
+}
+
+/* Check that a number is a valid bitwise operand */
+#define bcfold_isbit(n) ((n) >= 0 && (n) <= UINT32_MAX)
+
+/* Fold an arithmetic operation on two numbers */
+static bool bcfold_num(BCOp op, double a, double b, TValue* o)
+{
+    double n;
+    switch(op)
+    {
+        case BC_ADD: n = a + b; break;
+        case BC_SUB: n = a - b; break;
+        case BC_MUL: n = a * b; break;
+        case BC_DIV:
+            if(b == 0) return false;   /* Keep the division by zero at runtime */
+            n = a / b;
+            break;
+        case BC_MOD:
+            if(b == 0) return false;
+            n = fmod(a, b);
+            break;
+        case BC_POW: n = pow(a, b); break;
+        case BC_ISLT: setboolV(o, a < b); return true;
+        case BC_ISLE: setboolV(o, a <= b); return true;
+        case BC_ISGT: setboolV(o, a > b); return true;
+        case BC_ISGE: setboolV(o, a >= b); return true;
+        case BC_BAND:
+        case BC_BOR:
+        case BC_BXOR:
+        case BC_LSHIFT:
+        case BC_RSHIFT:
+        {
+            if(!bcfold_isbit(a) || !bcfold_isbit(b)) return false;
+            uint32_t x = (uint32_t)a, y = (uint32_t)b;
+            switch(op)
+            {
+                case BC_BAND: n = x & y; break;
+                case BC_BOR: n = x | y; break;
+                case BC_BXOR: n = x ^ y; break;
+                case BC_LSHIFT: if(y >= 32) return false; n = x << y; break;
+                default: if(y >= 32) return false; n = x >> y; break;
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+    /* NaN and -0 can't be keys of the constant table */
+    if(n != n || (n == 0 && signbit(n)))
+        return false;
+    setnumV(o, n);
+    return true;
+}
+
+/* Fold a binary operation on the last two emitted constants */
+static bool bcfold_binop(FuncState* fs, BCOp op)
+{
+    TValue a, b, o;
+    BCPos start;
+    if(fs->ls->optlevel == 0 || (start = bcfuse_check(fs, 2)) == NO_BCPOS ||
+        !bcfold_get(fs, 1, &a) || !bcfold_get(fs, 0, &b))
+        return false;
+    if(op == BC_ISEQ)
+    {
+        setboolV(&o, tea_obj_equal(fs->T, &a, &b));
+    }
+    else if(tvisnum(&a) && tvisnum(&b))
+    {
+        if(!bcfold_num(op, numV(&a), numV(&b), &o))
+            return false;
+    }
+    else if(op == BC_ADD && tvisstr(&a) && tvisstr(&b))
+    {
+        GCstr* s1 = strV(&a);
+        GCstr* s2 = strV(&b);
+        char* buf = tea_buf_tmp(fs->T, s1->len + s2->len);
+        memcpy(buf, str_data(s1), s1->len);
+        memcpy(buf + s1->len, str_data(s2), s2->len);
+        setstrV(fs->T, &o, tea_parse_keepstr(fs->ls, buf, s1->len + s2->len));
+    }
+    else
+    {
+        return false;
+    }
+    bcfold_emit(fs, 2, start, &o, op);
+    return true;
+}
+
+/* Fold a unary operation on the last emitted constant */
+static bool bcfold_unop(FuncState* fs, BCOp op)
+{
+    TValue a, o;
+    BCPos start;
+    if(fs->ls->optlevel == 0 || (start = bcfuse_check(fs, 1)) == NO_BCPOS ||
+        !bcfold_get(fs, 0, &a))
+        return false;
+    switch(op)
+    {
+        case BC_NOT:
+            setboolV(&o, tea_obj_isfalse(&a));
+            break;
+        case BC_NEG:
+            if(!tvisnum(&a) || numV(&a) == 0) return false;
+            setnumV(&o, -numV(&a));
+            break;
+        case BC_BNOT:
+            if(!tvisnum(&a) || !bcfold_isbit(numV(&a))) return false;
+            setnumV(&o, ~(uint32_t)numV(&a));
+            break;
+        default:
+            return false;
+    }
+    bcfold_emit(fs, 1, start, &o, op);
+    return true;
+}
+
+/* Emit a binary operator, folding constant operands */
+static void bcemit_binop(FuncState* fs, BCOp op)
+{
+    if(!bcfold_binop(fs, op))
+        bcemit_op(fs, op);
+}
+
+/* Emit a unary operator, folding a constant operand */
+static void bcemit_unop(FuncState* fs, BCOp op)
+{
+    if(!bcfold_unop(fs, op))
+        bcemit_op(fs, op);
+}
+
+/* -- Bytecode optimizer -------------------------------------------------- */
+
+/* Flags of bytecode positions */
+#define BCOPT_INS 0x01  /* Start of an instruction */
+#define BCOPT_TARGET 0x02   /* Target of a jump */
+#define BCOPT_LIVE 0x04 /* Reachable instruction */
+#define BCOPT_DEAD 0x08 /* Removed instruction */
+
+#define BCOPT_MAXPASS 8 /* Max. # of optimizer passes */
+#define BCOPT_MAXCHAIN 8    /* Max. # of jumps followed by threading */
+
+/* Get the length of the instruction at a position */
+static TEA_AINLINE BCPos bcopt_len(BCInsLine* bc, BCPos pc)
+{
+    return 1 + bc_argcount[bc[pc].ins];
+}
+
+/* Get the offset of the jump operand of an instruction, or 0 */
+static BCPos bcopt_ofspos(BCIns op)
+{
+    switch(op)
+    {
+        case BC_JMP:
+        case BC_JMPFALSE:
+        case BC_JMPNIL:
+        case BC_JMPCMP:
+        case BC_LOOP:
+        case BC_SPREAD:
+            return 1;
+        case BC_FORPREP:
+        case BC_FORLOOP:
+            return 2;
+        case BC_FORITER:
+        case BC_ISLTJMP:
+        case BC_ISLEJMP:
+        case BC_ISGTJMP:
+        case BC_ISGEJMP:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+/* Get the target of a jump, relative to the end of the instruction */
+static BCPos bcopt_target(BCInsLine* bc, BCPos pc)
+{
+    BCPos o = pc + bcopt_ofspos(bc[pc].ins);
+    BCPos ofs = (bc[o].ins << 8) | bc[o + 1].ins;
+    BCPos end = pc + bcopt_len(bc, pc);
+    return bc[pc].ins == BC_LOOP ? end - ofs : end + ofs;
+}
+
+/* Retarget a jump. Returns false if the target is out of range */
+static bool bcopt_settarget(BCInsLine* bc, BCPos pc, BCPos end, BCPos target)
+{
+    BCPos o = pc + bcopt_ofspos(bc[pc].ins);
+    BCPos ofs;
+    if(bc[pc].ins == BC_LOOP)
+    {
+        if(target > end) return false;
+        ofs = end - target;
+    }
+    else
+    {
+        if(target < end) return false;
+        ofs = target - end;
+    }
+    if(ofs > UINT16_MAX) return false;
+    bc[o].ins = (ofs >> 8) & 0xff;
+    bc[o + 1].ins = ofs & 0xff;
+    return true;
+}
+
+/* Follow a jump through unconditional jumps it lands on */
+static bool bcopt_thread(BCInsLine* bc, BCPos pc)
+{
+    BCIns op = bc[pc].ins;
+    BCPos end = pc + bcopt_len(bc, pc);
+    BCPos target = bcopt_target(bc, pc), t = target;
+    for(int i = 0; i < BCOPT_MAXCHAIN; i++)
+    {
+        BCIns top = bc[t].ins;
+        /* A falsy value stays falsy at a chained JMPFALSE */
+        if(top != BC_JMP && top != BC_LOOP && !(op == BC_JMPFALSE && top == BC_JMPFALSE))
+            break;
+        BCPos next = bcopt_target(bc, t);
+        if(next == t || (op == BC_LOOP ? next > end : next < end))
+            break;
+        t = next;
+    }
+    return t != target && bcopt_settarget(bc, pc, end, t);
+}
+
+/* Check whether an instruction only pushes a value without side effects */
+static bool bcopt_ispure(BCIns op)
+{
+    return op == BC_GETLOCAL || op == BC_GETUPVAL || op == BC_GETMODULE ||
+           op == BC_CONSTANT || op == BC_KNIL || op == BC_KTRUE || op == BC_KFALSE;
+}
+
+/* Get the load matching a store instruction, or 0 */
+static BCIns bcopt_load(BCIns op)
+{
+    switch(op)
+    {
+        case BC_SETLOCAL: return BC_GETLOCAL;
+        case BC_SETUPVAL: return BC_GETUPVAL;
+        case BC_SETMODULE: return BC_GETMODULE;
+        default: return 0;
+    }
+}
+
+/* Mark an instruction as removed */
+static void bcopt_kill(BCInsLine* bc, uint8_t* flags, BCPos pc)
+{
+    BCPos end = pc + bcopt_len(bc, pc);
+    for(; pc < end; pc++)
+        flags[pc] |= BCOPT_DEAD;
+}
+
+/* Mark reachable instructions */
+static void bcopt_live(BCInsLine* bc, uint8_t* flags, BCPos n)
+{
+    bool changed;
+    flags[0] |= BCOPT_LIVE;
+    do
+    {
+        changed = false;
+        for(BCPos pc = 0; pc < n; pc += bcopt_len(bc, pc))
+        {
+            BCIns op = bc[pc].ins;
+            BCPos end = pc + bcopt_len(bc, pc);
+            if(!(flags[pc] & BCOPT_LIVE))
+                continue;
+            if(!(flags[pc] & BCOPT_DEAD) && bcopt_ofspos(op) && op != BC_SPREAD)
+            {
+                BCPos t = bcopt_target(bc, pc);
+                if(!(flags[t] & BCOPT_LIVE))
+                {
+                    flags[t] |= BCOPT_LIVE;
+                    changed |= t < pc;
+                }
+                if(op == BC_JMP || op == BC_LOOP)
+                    continue;
+            }
+            else if(op == BC_RETURN && !(flags[pc] & BCOPT_DEAD))
+            {
+                continue;
+            }
+            if(end < n)
+                flags[end] |= BCOPT_LIVE;
+        }
+    }
+    while(changed);
+}
+
+/* Run one pass of the optimizer. Returns true if anything changed */
+static bool bcopt_pass(FuncState* fs, uint8_t* flags, BCPos* map)
+{
+    BCInsLine* bc = fs->bcbase;
+    BCPos n = fs->pc, pc, j;
+    bool changed = false;
+    memset(flags, 0, n);
+
+    /* Mark instructions and jump targets, thread jump chains */
+    for(pc = 0; pc < n; pc += bcopt_len(bc, pc))
+    {
+        BCIns op = bc[pc].ins;
+        flags[pc] |= BCOPT_INS;
+        if(bcopt_ofspos(op) && op != BC_SPREAD)
+        {
+            changed |= bcopt_thread(bc, pc);
+            flags[bcopt_target(bc, pc)] |= BCOPT_TARGET;
+        }
+    }
+    tea_assertFS(pc == n, "bad bytecode length");
+
+    /* Fold branches on constants */
+    for(pc = 0; pc < n; pc += bcopt_len(bc, pc))
+    {
+        BCIns op = bc[pc].ins;
+        BCPos next = pc + 1;
+        if(next >= n || bc[next].ins != BC_JMPFALSE || (flags[next] & BCOPT_TARGET))
+            continue;
+        if(op == BC_KTRUE && next + 3 < n && bc[next + 3].ins == BC_POP &&
+           !(flags[next + 3] & BCOPT_TARGET))
+        {
+            /* KTRUE, JMPFALSE, POP never branches */
+            bcopt_kill(bc, flags, pc);
+            bcopt_kill(bc, flags, next);
+            bcopt_kill(bc, flags, next + 3);
+            pc = next + 3;
+            changed = true;
+        }
+        else if(op == BC_KFALSE || op == BC_KNIL)
+        {
+            /* Always branches, keeping the value for the target */
+            bc[next].ins = BC_JMP;
+            changed = true;
+        }
+    }
+
+    /* Remove unreachable code */
+    bcopt_live(bc, flags, n);
+    for(pc = 0; pc < n; pc += bcopt_len(bc, pc))
+    {
+        if(!(flags[pc] & BCOPT_LIVE) ||
+           (bc[pc].ins == BC_JMP && bcopt_target(bc, pc) == pc + 3))
+        {
+            if(!(flags[pc] & BCOPT_DEAD))
+            {
+                bcopt_kill(bc, flags, pc);
+                changed = true;
+            }
+        }
+    }
+
+    /* Remove values that are pushed and popped right away */
+    for(pc = 0; pc < n; pc += bcopt_len(bc, pc))
+    {
+        BCIns op = bc[pc].ins;
+        BCPos next = pc + bcopt_len(bc, pc);
+        if((flags[pc] & BCOPT_DEAD) || next >= n ||
+           (flags[next] & (BCOPT_TARGET | BCOPT_DEAD)) || bc[next].ins != BC_POP)
+            continue;
+        if(bcopt_ispure(op))
+        {
+            /* Push, POP */
+            bcopt_kill(bc, flags, pc);
+            bcopt_kill(bc, flags, next);
+            pc = next;
+            changed = true;
+        }
+        else if(bcopt_load(op))
+        {
+            /* Store x, POP, load x keeps the stored value */
+            BCPos load = next + 1;
+            if(load + 1 < n && bc[load].ins == bcopt_load(op) &&
+               bc[load + 1].ins == bc[pc + 1].ins &&
+               !(flags[load] & (BCOPT_TARGET | BCOPT_DEAD)))
+            {
+                bcopt_kill(bc, flags, next);
+                bcopt_kill(bc, flags, load);
+                pc = load;
+                changed = true;
+            }
+        }
+    }
+
+    if(!changed)
+        return false;
+
+    /* Map old positions to new ones, removed code maps to what follows it */
+    for(pc = 0, j = 0; pc < n; pc++)
+    {
+        map[pc] = j;
+        if(!(flags[pc] & BCOPT_DEAD)) j++;
+    }
+    map[n] = j;
+
+    /* Relocate the jumps and compact the bytecode */
+    for(pc = 0; pc < n; pc += bcopt_len(bc, pc))
+    {
+        if(!(flags[pc] & BCOPT_DEAD) && bcopt_ofspos(bc[pc].ins))
+        {
+            BCPos t = map[bcopt_target(bc, pc)];
+            bool ok = bcopt_settarget(bc, pc, map[pc] + bcopt_len(bc, pc), t);
+            tea_assertFS(ok, "bad jump relocation");
+            UNUSED(ok);
+        }
+    }
+    for(pc = 0; pc < n; pc++)
+    {
+        if(!(flags[pc] & BCOPT_DEAD))
+            bc[map[pc]] = bc[pc];
+    }
+    fs->pc = j;
+    return true;
+}
+
+/* Optimize the bytecode of a function */
+static void bcopt_run(FuncState* fs)
+{
+    BCPos n = fs->pc;
+    BCPos* map;
+    uint8_t* flags;
+    if(fs->ls->optlevel == 0)
+        return;
+    map = (BCPos*)tea_buf_tmp(fs->T, (n + 1) * sizeof(BCPos) + n);
+    flags = (uint8_t*)(map + n + 1);
+    for(int i = 0; i < BCOPT_MAXPASS; i++)
+    {
+        if(!bcopt_pass(fs, flags, map))
+            break;
+    }
 }
 
 /* -- Function state management ------------------------------------------- */
@@ -412,6 +1126,16 @@ static void fs_fixup_uv(FuncState* fs, GCproto* pt, uint16_t* uv)
     memcpy(uv, fs->uvmap, fs->nuv * sizeof(uint16_t));
 }
 
+/* Fixup inline cache sites for prototype */
+static void fs_fixup_ic(FuncState* fs, GCproto* pt, ICEntry* ic)
+{
+    pt->ic = ic;
+    pt->sizeic = fs->nic;
+    pt->ichits = 0;
+    pt->icmisses = 0;
+    memset(ic, 0, fs->nic * IC_WAYS * sizeof(ICEntry));
+}
+
 /* Prepare lineinfo for prototype */
 static size_t fs_prep_line(FuncState* fs, BCLine numline)
 {
@@ -468,13 +1192,17 @@ static GCproto* fs_finish(LexState* ls, BCLine line)
     tea_State* T = ls->T;
     FuncState* fs = ls->fs;
     BCLine numline = line - fs->linedefined;
-    size_t sizept, ofsk, ofsuv, ofsli;
+    size_t sizept, ofsk, ofsuv, ofsic, ofsli;
     GCproto* pt;
 
+    bcopt_run(fs);
+
     /* Calculate total size of prototype including all colocated arrays */
     sizept = sizeof(GCproto) + fs->pc * sizeof(BCIns);
     ofsk = sizept; sizept += fs->nk * sizeof(TValue);
     ofsuv = sizept; sizept += fs->nuv * sizeof(uint16_t);
+    sizept = (sizept + 7) & ~(size_t)7;
+    ofsic = sizept; sizept += fs->nic * IC_WAYS * sizeof(ICEntry);
     ofsli = sizept; sizept += fs_prep_line(fs, numline);
 
     /* Allocate new prototype and initialize fields */
@@ -489,6 +1217,7 @@ static GCproto* fs_finish(LexState* ls, BCLine line)
     fs_fixup_bc(fs, pt, (BCIns*)((char*)pt + sizeof(GCproto)), fs->pc);
     fs_fixup_k(fs, pt, (void*)((char*)pt + ofsk));
     fs_fixup_uv(fs, pt, (uint16_t*)((char*)pt + ofsuv));
+    fs_fixup_ic(fs, pt, (ICEntry*)((char*)pt + ofsic));
     fs_fixup_line(fs, pt, (void*)((char*)pt + ofsli), numline);
 
     T->top--;   /* Pop table of constants */
@@ -513,6 +1242,10 @@ static void fs_init(LexState* ls, FuncState* fs, FuncInfo info)
     fs->pc = 0;
     fs->nk = 0;
     fs->nuv = 0;
+    fs->nic = 0;
+    fs->lasttarget = 0;
+    for(int i = 0; i < BC_MAXFUSE; i++)
+        fs->lastins[i] = NO_BCPOS;
     fs->flags = 0;
     fs->info = info;
     fs->local_count = 1;
@@ -550,6 +1283,7 @@ static void fs_init(LexState* ls, FuncState* fs, FuncInfo info)
     local->init = true;
     local->isconst = false;
     local->isupval = false;
+    local->hask = false;
 
     switch(info)
     {
@@ -607,17 +1341,10 @@ static void scope_end(FuncState* fs)
 
 /* -- Loop handling -------------------------------------------------- */
 
-/* Arg count of each bytecode instruction */
-static const int bc_argcount[] = {
-#define BCARG(_, __, argcount) argcount,
-    BCDEF(BCARG)
-#undef BCARG
-};
-
 /* Begin a loop */
 static void loop_begin(FuncState* fs, Loop* loop)
 {
-    loop->start = fs->pc;
+    loop->start = bctarget(fs);
     loop->scope_depth = fs->scope_depth;
     loop->prev = fs->loop;
     fs->loop = loop;
@@ -725,6 +1452,23 @@ static void var_mark(FuncState* fs, bool isconst)
     }
 }
 
+/* Record the known value of the last defined constant */
+static void var_setk(FuncState* fs, cTValue* o)
+{
+    if(fs->scope_depth == 0)
+    {
+        VarInfo* v = &fs->ls->vstack[fs->ls->vtop - 1];
+        v->hask = true;
+        copyTV(fs->T, &v->k, o);
+    }
+    else
+    {
+        Local* local = &fs->locals[fs->local_count - 1];
+        local->hask = true;
+        copyTV(fs->T, &local->k, o);
+    }
+}
+
 /* Add a local variable */
 static int var_add_local(FuncState* fs, Token tok)
 {
@@ -741,6 +1485,7 @@ static int var_add_local(FuncState* fs, Token tok)
     local->isupval = false;
     local->isconst = false;
     local->init = false;
+    local->hask = false;
     return fs->local_count - 1;
 }
 
@@ -782,6 +1527,7 @@ static void var_add_var(FuncState* fs, Token* tok, bool init)
     v->name = strV(&tok->tv);
     v->isconst = false;
     v->init = init;
+    v->hask = false;
 }
 
 /* Declare a variable */
@@ -811,6 +1557,28 @@ static void var_define(FuncState* fs, Token* tok, bool isconst, bool export)
     }
 }
 
+/* Lookup the known value of a constant, without capturing it as upvalue */
+static bool var_lookup_k(FuncState* fs, Token* tok, TValue* o)
+{
+    int idx;
+    for(FuncState* f = fs; f != NULL; f = f->prev)
+    {
+        idx = var_lookup_local(f, tok);
+        if(idx != -1)
+        {
+            if(!f->locals[idx].hask)
+                return false;
+            copyTV(fs->T, o, &f->locals[idx].k);
+            return true;
+        }
+    }
+    idx = var_lookup_var(fs, tok);
+    if(idx == -1 || !fs->ls->vstack[idx].hask)
+        return false;
+    copyTV(fs->T, o, &fs->ls->vstack[idx].k);
+    return true;
+}
+
 /* Find get/set bytecodes for variable */
 static int var_find(FuncState* fs, Token* tok, bool assign, uint8_t* getbc, uint8_t* setbc)
 {
@@ -880,6 +1648,7 @@ static void var_fixup_end(FuncState* fs)
         mod->varnames[i] = name;
         setnilV(&mod->vars[i]);
     }
+    tea_gc_barrierback(T, obj2gco(mod));
 }
 
 /* -- Expressions --------------------------------------------------------- */
@@ -891,8 +1660,7 @@ static void expr_prec(FuncState* fs, Prec prec);
 /* Parse logical and expression */
 static void expr_and(FuncState* fs, bool assign)
 {
-    BCPos jmp = bcemit_jump(fs, BC_JMPFALSE);
-    bcemit_op(fs, BC_POP);
+    BCPos jmp = bcemit_branch(fs);
     expr_prec(fs, PREC_AND);
     bcpatch_jump(fs, jmp);
 }
@@ -923,58 +1691,59 @@ static void expr_binary(FuncState* fs, bool assign)
     switch(tok)
     {
         case TK_noteq:
-            bcemit_ops(fs, BC_ISEQ, BC_NOT);
+            bcemit_binop(fs, BC_ISEQ);
+            bcemit_unop(fs, BC_NOT);
             break;
         case TK_eq:
-            bcemit_op(fs, BC_ISEQ);
+            bcemit_binop(fs, BC_ISEQ);
             break;
         case TK_is:
             bcemit_op(fs, BC_IS);
             break;
         case '>':
-            bcemit_op(fs, BC_ISGT);
+            bcemit_binop(fs, BC_ISGT);
             break;
         case TK_ge:
-            bcemit_op(fs, BC_ISGE);
+            bcemit_binop(fs, BC_ISGE);
             break;
         case '<':
-            bcemit_op(fs, BC_ISLT);
+            bcemit_binop(fs, BC_ISLT);
             break;
         case TK_le:
-            bcemit_op(fs, BC_ISLE);
+            bcemit_binop(fs, BC_ISLE);
             break;
         case '+':
-            bcemit_op(fs, BC_ADD);
+            bcemit_binop(fs, BC_ADD);
             break;
         case '-':
-            bcemit_op(fs, BC_SUB);
+            bcemit_binop(fs, BC_SUB);
             break;
         case '*':
-            bcemit_op(fs, BC_MUL);
+            bcemit_binop(fs, BC_MUL);
             break;
         case '/':
-            bcemit_op(fs, BC_DIV);
+            bcemit_binop(fs, BC_DIV);
             break;
         case '%':
-            bcemit_op(fs, BC_MOD);
+            bcemit_binop(fs, BC_MOD);
             break;
         case TK_pow:
-            bcemit_op(fs, BC_POW);
+            bcemit_binop(fs, BC_POW);
             break;
         case '&':
-            bcemit_op(fs, BC_BAND);
+            bcemit_binop(fs, BC_BAND);
             break;
         case '|':
-            bcemit_op(fs, BC_BOR);
+            bcemit_binop(fs, BC_BOR);
             break;
         case '^':
-            bcemit_op(fs, BC_BXOR);
+            bcemit_binop(fs, BC_BXOR);
             break;
         case TK_rshift:
-            bcemit_op(fs, BC_RSHIFT);
+            bcemit_binop(fs, BC_RSHIFT);
             break;
         case TK_lshift:
-            bcemit_op(fs, BC_LSHIFT);
+            bcemit_binop(fs, BC_LSHIFT);
             break;
         case TK_in:
             bcemit_op(fs, BC_IN);
@@ -991,11 +1760,8 @@ static void expr(FuncState* fs);
 /* Parse ternary expression ? : */
 static void expr_ternary(FuncState* fs, bool assign)
 {
-    /* Jump to else branch if the condition is false */
-    BCPos else_jmp = bcemit_jump(fs, BC_JMPFALSE);
-
-    /* Pop the condition */
-    bcemit_op(fs, BC_POP);
+    /* Jump to else branch if the condition is false, pop it otherwise */
+    BCPos else_jmp = bcemit_branch(fs);
     expr(fs);
 
     BCPos end_jmp = bcemit_jump(fs, BC_JMP);
@@ -1056,8 +1822,27 @@ static void expr_call(FuncState* fs, bool assign)
 {
     ArgCtx ctx;
     ctx.num = 0;
-    uint8_t nargs = parse_args(fs, &ctx);
-    bcemit_arg(fs, BC_CALL, nargs);
+    uint8_t nargs, name, ic, load[2];
+    if(bcfuse_invoke(fs, &name, &ic))
+    {
+        /* (obj.name)() -> obj.name() */
+        nargs = parse_args(fs, &ctx);
+        bcemit_arg(fs, BC_INVOKE, name);
+        bcemit_bytes(fs, ic, nargs);
+    }
+    else if(bcfuse_super(fs, &name, load))
+    {
+        /* (super.name)() -> super.name() */
+        nargs = parse_args(fs, &ctx);
+        bcemit_arg(fs, (BCOp)load[0], load[1]);
+        bcemit_arg(fs, BC_SUPER, name);
+        bcemit_byte(fs, nargs);
+    }
+    else
+    {
+        nargs = parse_args(fs, &ctx);
+        bcemit_arg(fs, BC_CALL, nargs);
+    }
     arg_patch(fs, &ctx, nargs);
 }
 
@@ -1118,7 +1903,7 @@ static void expr_dot(FuncState* fs, bool assign)
         }
         else
         {
-            bcemit_arg(fs, BC_INVOKE, name);
+            bcemit_attr(fs, BC_INVOKE, name);
             bcemit_byte(fs, nargs);
         }
         arg_patch(fs, &sp, nargs);
@@ -1129,19 +1914,19 @@ static void expr_dot(FuncState* fs, bool assign)
     if(assign && lex_match(fs, '='))
     {
         expr(fs);
-        bcemit_arg(fs, BC_SETATTR, name);
+        bcemit_attr(fs, BC_SETATTR, name);
     }
     else if(assign && (bc = tok2bcassign(fs)))
     {
         tea_lex_next(fs->ls);
-        bcemit_arg(fs, BC_PUSHATTR, name);
+        bcemit_attr(fs, BC_PUSHATTR, name);
         expr(fs);
         bcemit_op(fs, bc);
-        bcemit_arg(fs, BC_SETATTR, name);
+        bcemit_attr(fs, BC_SETATTR, name);
     }
     else
     {
-        bcemit_arg(fs, BC_GETATTR, name);
+        bcemit_attr(fs, BC_GETATTR, name);
     }
 }
 
@@ -1335,22 +2120,39 @@ static void expr_str(FuncState* fs, bool assign)
     bcemit_str(fs, &tv);
 }
 
+/* Push a literal part of an interpolated string, skipping empty ones */
+static int interpolation_part(FuncState* fs, int n)
+{
+    TValue* o = &fs->ls->prev.tv;
+    if(strV(o)->len == 0)
+        return n;
+    bcemit_str(fs, o);
+    return n + 1;
+}
+
+/* Concatenate the parts of an interpolated string, keeping room for more */
+static int interpolation_flush(FuncState* fs, int n)
+{
+    if(n < TEA_MAX_CONCAT)
+        return n;
+    bcemit_arg(fs, BC_CONCAT, (uint8_t)n);
+    return 1;
+}
+
 /* Parse interpolated string expression */
 static void expr_interpolation(FuncState* fs, bool assign)
 {
-    bcemit_op(fs, BC_LIST);
+    int n = 0;
     do
     {
-        bcemit_str(fs, &fs->ls->prev.tv);
-        bcemit_op(fs, BC_LISTITEM);
+        n = interpolation_flush(fs, interpolation_part(fs, n));
         expr(fs);
-        bcemit_op(fs, BC_LISTITEM);
+        n = interpolation_flush(fs, n + 1);
     }
     while(lex_match(fs, TK_interpolation));
     lex_consume(fs, TK_string);
-    bcemit_str(fs, &fs->ls->prev.tv);
-    bcemit_op(fs, BC_LISTITEM);
-    bcemit_invoke(fs, 0, "join");
+    n = interpolation_part(fs, n);
+    bcemit_arg(fs, BC_CONCAT, (uint8_t)n);
 }
 
 static void check_const(FuncState* fs, uint8_t set_op, int arg)
@@ -1384,6 +2186,14 @@ static void check_const(FuncState* fs, uint8_t set_op, int arg)
 static void parse_named(FuncState* fs, Token name, bool assign)
 {
     uint8_t getbc, setbc;
+    TValue k;
+    if(!(assign && (lex_check(fs, '=') || tok2bcassign(fs))) && var_lookup_k(fs, &name, &k))
+    {
+        /* Propagate the value of a constant */
+        bcemit_k(fs, &k);
+        return;
+    }
+
     int arg = var_find(fs, &name, lex_check(fs, '='), &getbc, &setbc);
 
     BCOp bc;
@@ -1508,13 +2318,13 @@ static void expr_unary(FuncState* fs, bool assign)
     {
         case TK_not:
         case '!':
-            bcemit_op(fs, BC_NOT);
+            bcemit_unop(fs, BC_NOT);
             break;
         case '-':
-            bcemit_op(fs, BC_NEG);
+            bcemit_unop(fs, BC_NEG);
             break;
         case '~':
-            bcemit_op(fs, BC_BNOT);
+            bcemit_unop(fs, BC_BNOT);
             break;
         default:
             tea_assertFS(0, "unknown unary op");
@@ -2018,13 +2828,13 @@ static void parse_function_assign(FuncState* fs, BCLine line)
         uint8_t k = const_str(fs, strV(&fs->ls->prev.tv));
         if(!lex_check(fs, '('))
         {
-            bcemit_arg(fs, BC_GETATTR, k);
+            bcemit_attr(fs, BC_GETATTR, k);
             parse_function_assign(fs, line);
         }
         else
         {
             parse_body(fs->ls, FUNC_NORMAL, line);
-            bcemit_arg(fs, BC_SETATTR, k);
+            bcemit_attr(fs, BC_SETATTR, k);
             bcemit_op(fs, BC_POP);
             return;
         }
@@ -2064,6 +2874,14 @@ static void parse_function(FuncState* fs, bool export)
     var_define(fs, &name, false, export);
 }
 
+/* Parse an expression, getting its value if it's a single constant */
+static bool expr_k(FuncState* fs, TValue* o)
+{
+    BCPos start = fs->pc;
+    expr(fs);
+    return fs->ls->optlevel > 0 && bcfuse_check(fs, 1) == start && bcfold_get(fs, 0, o);
+}
+
 /* Parse 'var' or 'const' declaration */
 static void parse_var(FuncState* fs, bool isconst, bool export)
 {
@@ -2104,9 +2922,12 @@ static void parse_var(FuncState* fs, bool isconst, bool export)
                 error(fs, TEA_ERR_XSINGLEREST);
             }
 
+            TValue k;
             var_declare(fs, &vars[0]);
-            expr(fs);
+            bool hask = expr_k(fs, &k);
             var_define(fs, &vars[0], isconst, export);
+            if(isconst && hask)
+                var_setk(fs, &k);
 
             if(lex_match(fs, ','))
             {
@@ -2116,8 +2937,10 @@ static void parse_var(FuncState* fs, bool isconst, bool export)
                     Token tok = fs->ls->prev;
                     var_declare(fs, &tok);
                     lex_consume(fs, '=');
-                    expr(fs);
+                    hask = expr_k(fs, &k);
                     var_define(fs, &tok, isconst, export);
+                    if(isconst && hask)
+                        var_setk(fs, &k);
                 }
                 while(lex_match(fs, ','));
             }
@@ -2185,7 +3008,53 @@ finish:
 static void parse_expr_stmt(FuncState* fs)
 {
     expr(fs);
-    bcemit_op(fs, BC_POP);
+    bcemit_pop(fs);
+}
+
+/* Parse numeric 'for' over a range literal */
+static void parse_for_range(FuncState* fs, Token var, bool isconst)
+{
+    /* The start, limit and step of the range become hidden variables */
+    int idx_slot = var_add_local(fs, lex_synthetic(fs, "idx "));
+    var_mark(fs, false);
+    var_add_local(fs, lex_synthetic(fs, "limit "));
+    var_mark(fs, false);
+    var_add_local(fs, lex_synthetic(fs, "step "));
+    var_mark(fs, false);
+
+    /* Check the first iteration, skipping the FORLOOP */
+    bcemit_arg(fs, BC_FORPREP, (uint8_t)idx_slot);
+    bcemit_bytes(fs, 0xff, 0xff);
+    BCPos prep_jmp = fs->pc - 2;
+
+    Loop loop;
+    loop_begin(fs, &loop);
+
+    loop.end = -1;
+
+    /* Step the counter, pushing it as the loop variable */
+    bcemit_arg(fs, BC_FORLOOP, (uint8_t)idx_slot);
+    bcemit_bytes(fs, 0xff, 0xff);
+    BCPos loop_jmp = fs->pc - 2;
+
+    scope_begin(fs);
+
+    var_declare(fs, &var);
+    var_define(fs, &var, isconst, false);
+
+    fs->loop->body = bctarget(fs);
+    parse_code(fs);
+
+    /* Loop variable */
+    scope_end(fs);
+
+    bcemit_loop(fs, fs->loop->start);
+    bcpatch_jump(fs, prep_jmp);
+    bcpatch_jump(fs, loop_jmp);
+    loop_end(fs);
+
+    /* Hidden variables */
+    scope_end(fs);
 }
 
 /* Parse iterable 'for' */
@@ -2209,12 +3078,18 @@ static void parse_for_in(FuncState* fs, Token var, bool isconst)
     lex_consume(fs, TK_in);
 
     expr(fs);
+    if(varnum == 1 && bcfuse_range(fs))
+    {
+        parse_for_range(fs, var, isconst);
+        return;
+    }
+
     int seq_slot = var_add_local(fs, lex_synthetic(fs, "seq "));
     var_mark(fs, false);
 
     /* Get the iterator */
     bcemit_arg(fs, BC_GETITER, seq_slot);
-    int iter_slot = var_add_local(fs, lex_synthetic(fs, "iter "));
+    var_add_local(fs, lex_synthetic(fs, "iter "));
     var_mark(fs, false);
 
     Loop loop;
@@ -2222,9 +3097,11 @@ static void parse_for_in(FuncState* fs, Token var, bool isconst)
 
     loop.end = -1;
 
-    /* Call the iterator, if nil it means the loop is over */
-    bcemit_arg(fs, BC_FORITER, iter_slot);
-    BCPos end_jpm = bcemit_jump(fs, BC_JMPNIL);
+    /* Step the iterator, leaving the loop when it is over */
+    bcemit_arg(fs, BC_FORITER, (uint8_t)seq_slot);
+    bcemit_byte(fs, (uint8_t)varnum);
+    bcemit_bytes(fs, 0xff, 0xff);
+    BCPos end_jpm = fs->pc - 2;
 
     scope_begin(fs);
 
@@ -2237,7 +3114,7 @@ static void parse_for_in(FuncState* fs, Token var, bool isconst)
         var_define(fs, &vars[i], isconst, false);
     }
 
-    fs->loop->body = fs->pc;
+    fs->loop->body = bctarget(fs);
     parse_code(fs);
 
     /* Loop variable */
@@ -2308,21 +3185,20 @@ static void parse_for(FuncState* fs)
     expr(fs);
     lex_consume(fs, ';');
 
-    fs->loop->end = bcemit_jump(fs, BC_JMPFALSE);
-    bcemit_op(fs, BC_POP); /* Condition */
+    fs->loop->end = bcemit_branch(fs);
 
     BCPos body_jmp = bcemit_jump(fs, BC_JMP);
 
-    BCPos inc_start = fs->pc;
+    BCPos inc_start = bctarget(fs);
     expr(fs);
-    bcemit_op(fs, BC_POP);
+    bcemit_pop(fs);
 
     bcemit_loop(fs, fs->loop->start);
     fs->loop->start = inc_start;
 
     bcpatch_jump(fs, body_jmp);
 
-    fs->loop->body = fs->pc;
+    fs->loop->body = bctarget(fs);
 
     int inner_var = -1;
     if(loop_var != -1)
@@ -2383,8 +3259,7 @@ static void parse_if(FuncState* fs)
     tea_lex_next(fs->ls);  /* Skip 'if' */
     expr(fs);
 
-    BCPos else_jmp = bcemit_jump(fs, BC_JMPFALSE);
-    bcemit_op(fs, BC_POP);
+    BCPos else_jmp = bcemit_branch(fs);
     
     parse_code(fs);
 
@@ -2602,11 +3477,10 @@ static void parse_while(FuncState* fs)
     }
 
     /* Jump ot of the loop if the condition is false */
-    fs->loop->end = bcemit_jump(fs, BC_JMPFALSE);
-    bcemit_op(fs, BC_POP);
+    fs->loop->end = bcemit_branch(fs);
 
     /* Compile the body */
-    fs->loop->body = fs->pc;
+    fs->loop->body = bctarget(fs);
     parse_code(fs);
 
     /* Loop back to the start */
@@ -2622,14 +3496,13 @@ static void parse_do(FuncState* fs)
 
     tea_lex_next(fs->ls);  /* Skip 'do' */
 
-    fs->loop->body = fs->pc;
+    fs->loop->body = bctarget(fs);
     parse_code(fs);
 
     lex_consume(fs, TK_while);
     expr(fs);
 
-    fs->loop->end = bcemit_jump(fs, BC_JMPFALSE);
-    bcemit_op(fs, BC_POP);
+    fs->loop->end = bcemit_branch(fs);
 
     bcemit_loop(fs, fs->loop->start);
     loop_end(fs);
@@ -0,0 +1,204 @@
+/*
+** tea_pool.c
+** Pooled allocator with bulk release
+*/
+
+#define tea_pool_c
+#define TEA_CORE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tea_pool.h"
+
+/*
+** An allocator for states that are created, run for a short while and
+** closed. Every state gets its own pool, so no locking is needed. Blocks
+** up to POOL_MEDMAX bytes are carved from big chunks and recycled through
+** free lists per size class. The allocator is always told the size of a
+** block, so small blocks need no header. Larger blocks come from malloc()
+** and are linked into a list. Closing the state hands the chunks and the
+** large blocks back at once, without freeing each object on its own.
+** Memory is only reused within a size class, which does not suit states
+** that live long and change what they allocate
+*/
+
+#define POOL_ALIGN 16   /* Alignment and step of the small size classes */
+#define POOL_SMALLMAX 512   /* Max. size of the small size classes */
+#define POOL_MEDMAX (32 * 1024) /* Max. size of pooled blocks */
+#define POOL_NSMALL (POOL_SMALLMAX / POOL_ALIGN)
+#define POOL_NCLASS (POOL_NSMALL + 6)   /* Plus powers of two up to POOL_MEDMAX */
+#define POOL_CHUNKSIZE (256 * 1024) /* Size of the chunks blocks are carved from */
+
+#define pool_round(n) (((n) + (POOL_ALIGN - 1)) & ~(size_t)(POOL_ALIGN - 1))
+
+/* Block on a free list */
+typedef struct PoolFree
+{
+    struct PoolFree* next;
+} PoolFree;
+
+/* Header of a chunk */
+typedef struct PoolChunk
+{
+    struct PoolChunk* next;
+} PoolChunk;
+
+/* Header of a large block */
+typedef struct PoolBig
+{
+    struct PoolBig* prev;
+    struct PoolBig* next;
+} PoolBig;
+
+#define POOL_CHUNKHDR pool_round(sizeof(PoolChunk))
+#define POOL_BIGHDR pool_round(sizeof(PoolBig))
+
+struct Pool
+{
+    PoolFree* free[POOL_NCLASS];    /* Free blocks per size class */
+    char* bump; /* Unused part of the current chunk */
+    char* end;
+    PoolChunk* chunks;  /* List of all chunks */
+    PoolBig big;    /* Sentinel of the list of large blocks */
+};
+
+/* Get the size class of a pooled block and its rounded size */
+static uint32_t pool_class(size_t size, size_t* csize)
+{
+    if(size <= POOL_SMALLMAX)
+    {
+        *csize = pool_round(size);
+        return (uint32_t)(*csize / POOL_ALIGN) - 1;
+    }
+    uint32_t idx = POOL_NSMALL;
+    size_t n = POOL_SMALLMAX * 2;
+    while(n < size)
+    {
+        n <<= 1;
+        idx++;
+    }
+    *csize = n;
+    return idx;
+}
+
+/* Allocate a pooled block */
+static void* pool_get(Pool* pool, size_t size)
+{
+    size_t csize;
+    uint32_t idx = pool_class(size, &csize);
+    PoolFree* b = pool->free[idx];
+    if(b != NULL)
+    {
+        pool->free[idx] = b->next;
+        return b;
+    }
+    if((size_t)(pool->end - pool->bump) < csize)
+    {
+        PoolChunk* chunk = (PoolChunk*)malloc(POOL_CHUNKSIZE);
+        if(chunk == NULL)
+            return NULL;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        pool->bump = (char*)chunk + POOL_CHUNKHDR;
+        pool->end = (char*)chunk + POOL_CHUNKSIZE;
+    }
+    void* p = pool->bump;
+    pool->bump += csize;
+    return p;
+}
+
+/* Free a pooled block */
+static void pool_put(Pool* pool, void* p, size_t size)
+{
+    size_t csize;
+    uint32_t idx = pool_class(size, &csize);
+    PoolFree* b = (PoolFree*)p;
+    b->next = pool->free[idx];
+    pool->free[idx] = b;
+}
+
+/* Allocate or resize a large block */
+static void* pool_big(Pool* pool, void* p, size_t size)
+{
+    PoolBig* old = p ? (PoolBig*)((char*)p - POOL_BIGHDR) : NULL;
+    PoolBig* b = (PoolBig*)realloc(old, POOL_BIGHDR + size);
+    if(b == NULL)
+        return NULL;
+    if(old == NULL)
+    {
+        b->prev = &pool->big;
+        b->next = pool->big.next;
+    }
+    b->prev->next = b;
+    b->next->prev = b;
+    return (char*)b + POOL_BIGHDR;
+}
+
+/* Free a large block */
+static void pool_bigfree(void* p)
+{
+    PoolBig* b = (PoolBig*)((char*)p - POOL_BIGHDR);
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+    free(b);
+}
+
+/* Allocator function of pooled states */
+void* tea_pool_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    Pool* pool = (Pool*)ud;
+    size_t ocsize, ncsize;
+    if(ptr == NULL)
+        osize = 0;
+    if(osize > POOL_MEDMAX && nsize > POOL_MEDMAX)
+        return pool_big(pool, ptr, nsize);
+    if(osize > 0 && nsize > 0 && osize <= POOL_MEDMAX && nsize <= POOL_MEDMAX &&
+       pool_class(osize, &ocsize) == pool_class(nsize, &ncsize))
+        return ptr;     /* Still fits in its block */
+    void* p = NULL;
+    if(nsize > 0)
+    {
+        p = nsize > POOL_MEDMAX ? pool_big(pool, NULL, nsize) : pool_get(pool, nsize);
+        if(p == NULL)
+            return NULL;
+        if(osize > 0)
+            memcpy(p, ptr, osize < nsize ? osize : nsize);
+    }
+    if(osize > POOL_MEDMAX)
+        pool_bigfree(ptr);
+    else if(osize > 0)
+        pool_put(pool, ptr, osize);
+    return p;
+}
+
+/* Create an empty pool */
+Pool* tea_pool_new(void)
+{
+    Pool* pool = (Pool*)malloc(sizeof(Pool));
+    if(pool == NULL)
+        return NULL;
+    memset(pool, 0, sizeof(Pool));
+    pool->big.prev = pool->big.next = &pool->big;
+    return pool;
+}
+
+/* Release a pool and every block allocated from it */
+void tea_pool_release(Pool* pool)
+{
+    PoolChunk* chunk = pool->chunks;
+    while(chunk != NULL)
+    {
+        PoolChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    PoolBig* b = pool->big.next;
+    while(b != &pool->big)
+    {
+        PoolBig* next = b->next;
+        free(b);
+        b = next;
+    }
+    free(pool);
+}
@@ -0,0 +1,17 @@
+/*
+** tea_pool.h
+** Pooled allocator with bulk release
+*/
+
+#ifndef _TEA_POOL_H
+#define _TEA_POOL_H
+
+#include "tea_def.h"
+
+typedef struct Pool Pool;
+
+TEA_FUNC Pool* tea_pool_new(void);
+TEA_FUNC void* tea_pool_alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+TEA_FUNC void tea_pool_release(Pool* pool);
+
+#endif
@@ -0,0 +1,284 @@
+/*
+** tea_prof.c
+** Allocation profiler and heap snapshots
+*/
+
+#define tea_prof_c
+#define TEA_CORE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tea_prof.h"
+#include "tea_gc.h"
+#include "tea_err.h"
+#include "tea_debug.h"
+
+/*
+** The profiler counts down the bytes allocated by the GC allocator and
+** records the call stack whenever the countdown runs out. Each sample
+** stands for all bytes allocated since the previous one. Samples with
+** the same stack are merged and written out as folded stacks, one
+** "frame;frame;frame bytes" line per stack, which is the input format
+** of the usual flame graph tools. Heap snapshots use the same format,
+** with the retaining root and the object type in place of the frames
+*/
+
+/* -- Folded stack tables ------------------------------------------------- */
+
+static uint32_t prof_hash(const char* s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Resize the hash part of a table. The table is left alone on failure */
+static bool prof_resize(tea_State* T, ProfTab* tab, uint32_t size)
+{
+    ProfNode* node = (ProfNode*)T->allocf(T->allocd, NULL, 0, sizeof(ProfNode) * size);
+    if(node == NULL)
+        return false;
+    memset(node, 0, sizeof(ProfNode) * size);
+    for(uint32_t i = 0; i < tab->size; i++)
+    {
+        ProfNode* n = &tab->node[i];
+        if(n->key == NULL)
+            continue;
+        uint32_t j = n->hash & (size - 1);
+        while(node[j].key != NULL)
+            j = (j + 1) & (size - 1);
+        node[j] = *n;
+    }
+    T->allocf(T->allocd, tab->node, sizeof(ProfNode) * tab->size, 0);
+    tab->node = node;
+    tab->size = size;
+    return true;
+}
+
+/* Free all keys of a table */
+static void prof_freetab(tea_State* T, ProfTab* tab)
+{
+    for(uint32_t i = 0; i < tab->size; i++)
+    {
+        ProfNode* n = &tab->node[i];
+        if(n->key != NULL)
+            T->allocf(T->allocd, n->key, n->len, 0);
+    }
+    T->allocf(T->allocd, tab->node, sizeof(ProfNode) * tab->size, 0);
+    tab->node = NULL;
+    tab->size = tab->num = 0;
+}
+
+/* Add bytes to a folded stack. Silently dropped if out of memory */
+void tea_prof_add(tea_State* T, ProfTab* tab, const char* key, size_t len, size_t bytes)
+{
+    if((tab->num + 1) * 4 > tab->size * 3 &&
+       !prof_resize(T, tab, tab->size ? tab->size * 2 : 64))
+        return;
+    uint32_t hash = prof_hash(key, len);
+    uint32_t mask = tab->size - 1;
+    ProfNode* n;
+    for(uint32_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        n = &tab->node[i];
+        if(n->key == NULL)
+            break;
+        if(n->hash == hash && n->len == len && memcmp(n->key, key, len) == 0)
+        {
+            n->bytes += bytes;
+            return;
+        }
+    }
+    char* k = (char*)T->allocf(T->allocd, NULL, 0, len);
+    if(k == NULL)
+        return;
+    memcpy(k, key, len);
+    n->key = k;
+    n->len = (uint32_t)len;
+    n->hash = hash;
+    n->bytes = bytes;
+    tab->num++;
+}
+
+/* Append to a key. Silently truncated if out of memory */
+void tea_prof_putmem(tea_State* T, ProfBuf* pb, const char* s, size_t len)
+{
+    if(pb->len + len > pb->size)
+    {
+        size_t size = pb->size ? pb->size : 128;
+        while(size < pb->len + len)
+            size <<= 1;
+        char* b = (char*)T->allocf(T->allocd, pb->b, pb->size, size);
+        if(b == NULL)
+            return;
+        pb->b = b;
+        pb->size = size;
+    }
+    memcpy(pb->b + pb->len, s, len);
+    pb->len += len;
+}
+
+/* Append the function name and the current line of a frame */
+void tea_prof_putframe(tea_State* T, ProfBuf* pb, CallInfo* ci)
+{
+    char buf[32];
+    GCfunc* fn = ci->func;
+    if(fn == NULL || iscfunc(fn))
+    {
+        tea_prof_putlit(T, pb, "[C]");
+        return;
+    }
+    GCproto* pt = fn->t.pt;
+    GCstr* module = fn->t.module->name;
+    BCPos pc = ci->ip > proto_bc(pt) ? (BCPos)(ci->ip - proto_bc(pt) - 1) : 0;
+    int n = snprintf(buf, sizeof(buf), ":%d)", (int)tea_debug_line(pt, pc));
+    tea_prof_putmem(T, pb, str_data(pt->name), pt->name->len);
+    tea_prof_putlit(T, pb, " (");
+    tea_prof_putmem(T, pb, str_data(module), module->len);
+    tea_prof_putmem(T, pb, buf, (size_t)n);
+}
+
+/* Sort folded stacks by key */
+static int prof_cmp(const void* a, const void* b)
+{
+    const ProfNode* x = *(const ProfNode* const*)a;
+    const ProfNode* y = *(const ProfNode* const*)b;
+    int c = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+    if(c != 0)
+        return c;
+    return x->len < y->len ? -1 : x->len > y->len;
+}
+
+/* Write a table as sorted folded stacks */
+static int prof_write(tea_State* T, ProfTab* tab, tea_Writer writer, void* data)
+{
+    ProfState* ps = T->prof;
+    if(tab->num == 0)
+        return 0;
+    if(ps->sortsize < tab->num)
+    {
+        ProfNode** sorted = (ProfNode**)T->allocf(T->allocd, ps->sorted,
+                                sizeof(ProfNode*) * ps->sortsize, sizeof(ProfNode*) * tab->num);
+        if(sorted == NULL)
+            tea_err_mem(T);
+        ps->sorted = sorted;
+        ps->sortsize = tab->num;
+    }
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < tab->size; i++)
+    {
+        if(tab->node[i].key != NULL)
+            ps->sorted[n++] = &tab->node[i];
+    }
+    qsort(ps->sorted, n, sizeof(ProfNode*), prof_cmp);
+    for(uint32_t i = 0; i < n; i++)
+    {
+        char buf[32];
+        ProfNode* node = ps->sorted[i];
+        int len = snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)node->bytes);
+        int status = writer(T, data, node->key, node->len);
+        if(status == 0)
+            status = writer(T, data, buf, (size_t)len);
+        if(status != 0)
+            return status;
+    }
+    return 0;
+}
+
+/* -- Allocation profiler ------------------------------------------------- */
+
+/* Get the profiler state, creating it on first use */
+static ProfState* prof_state(tea_State* T)
+{
+    if(T->prof == NULL)
+    {
+        ProfState* ps = (ProfState*)T->allocf(T->allocd, NULL, 0, sizeof(ProfState));
+        if(ps == NULL)
+            tea_err_mem(T);
+        memset(ps, 0, sizeof(ProfState));
+        T->prof = ps;
+    }
+    return T->prof;
+}
+
+/* Start sampling allocations, dropping the samples of a previous run */
+void tea_prof_start(tea_State* T, size_t interval)
+{
+    ProfState* ps = prof_state(T);
+    prof_freetab(T, &ps->samples);
+    ps->interval = interval ? interval : TEA_PROF_INTERVAL;
+    T->gc.profleft = ps->interval;
+}
+
+/* Stop sampling allocations. The samples are kept until the next start */
+void tea_prof_stop(tea_State* T)
+{
+    if(T->prof != NULL)
+        T->prof->interval = 0;
+    T->gc.profleft = SIZE_MAX;
+}
+
+/* Record the call stack of an allocation of size bytes */
+void tea_prof_sample(tea_State* T, size_t size)
+{
+    ProfState* ps = T->prof;
+    if(ps == NULL || ps->interval == 0)
+    {
+        T->gc.profleft = SIZE_MAX;
+        return;
+    }
+    size_t bytes = ps->interval - T->gc.profleft + size;
+    T->gc.profleft = ps->interval;
+    ProfBuf* pb = &ps->key;
+    pb->len = 0;
+    for(CallInfo* ci = T->ci_base + 1; ci <= T->ci; ci++)
+    {
+        if(pb->len > 0)
+            tea_prof_putlit(T, pb, ";");
+        tea_prof_putframe(T, pb, ci);
+    }
+    if(pb->len == 0)
+        tea_prof_putlit(T, pb, "[C]");
+    tea_prof_add(T, &ps->samples, pb->b, pb->len, bytes);
+}
+
+/* Write the allocation samples as folded stacks */
+int tea_prof_dump(tea_State* T, tea_Writer writer, void* data)
+{
+    if(T->prof == NULL)
+        return 0;
+    return prof_write(T, &T->prof->samples, writer, data);
+}
+
+/* -- Heap snapshots ------------------------------------------------------ */
+
+/* Write the live heap by retaining root and type as folded stacks */
+int tea_prof_snapshot(tea_State* T, tea_Writer writer, void* data)
+{
+    ProfState* ps = prof_state(T);
+    prof_freetab(T, &ps->snapshot);
+    tea_gc_snapshot(T, ps);
+    int status = prof_write(T, &ps->snapshot, writer, data);
+    prof_freetab(T, &ps->snapshot);
+    return status;
+}
+
+/* Free the profiler state */
+void tea_prof_free(tea_State* T)
+{
+    ProfState* ps = T->prof;
+    if(ps == NULL)
+        return;
+    prof_freetab(T, &ps->samples);
+    prof_freetab(T, &ps->snapshot);
+    T->allocf(T->allocd, ps->key.b, ps->key.size, 0);
+    T->allocf(T->allocd, ps->sorted, sizeof(ProfNode*) * ps->sortsize, 0);
+    T->allocf(T->allocd, ps, sizeof(ProfState), 0);
+    T->prof = NULL;
+}
@@ -0,0 +1,73 @@
+/*
+** tea_prof.h
+** Allocation profiler and heap snapshots
+*/
+
+#ifndef _TEA_PROF_H
+#define _TEA_PROF_H
+
+#include "tea_def.h"
+#include "tea_obj.h"
+
+/* Bytes attributed to a folded stack */
+typedef struct ProfNode
+{
+    char* key;  /* Frames separated by ';', outermost first */
+    uint32_t len;
+    uint32_t hash;
+    size_t bytes;
+} ProfNode;
+
+/* Hash table of folded stacks */
+typedef struct ProfTab
+{
+    ProfNode* node;
+    uint32_t size;
+    uint32_t num;
+} ProfTab;
+
+/* Growable buffer for building keys */
+typedef struct ProfBuf
+{
+    char* b;
+    size_t len;
+    size_t size;
+} ProfBuf;
+
+/*
+** Profiler state. Only ever allocated with the allocator function
+** and not accounted to the GC, so the profiler does not profile itself
+*/
+struct ProfState
+{
+    size_t interval;    /* Sampling interval in bytes, 0 if stopped */
+    ProfTab samples;    /* Allocation samples */
+    ProfTab snapshot;   /* Last heap snapshot */
+    ProfBuf key;    /* Key of the current sample or snapshot root */
+    ProfNode** sorted;  /* Nodes of a table sorted for writing */
+    uint32_t sortsize;
+    size_t snapbytes[TEA_TMETHOD + 1];  /* Bytes marked per type */
+};
+
+TEA_FUNC void tea_prof_putmem(tea_State* T, ProfBuf* pb, const char* s, size_t len);
+TEA_FUNC void tea_prof_putframe(tea_State* T, ProfBuf* pb, CallInfo* ci);
+TEA_FUNC void tea_prof_add(tea_State* T, ProfTab* tab, const char* key, size_t len, size_t bytes);
+
+TEA_FUNC void tea_prof_start(tea_State* T, size_t interval);
+TEA_FUNC void tea_prof_stop(tea_State* T);
+TEA_FUNC void tea_prof_sample(tea_State* T, size_t size);
+TEA_FUNC int tea_prof_dump(tea_State* T, tea_Writer writer, void* data);
+TEA_FUNC int tea_prof_snapshot(tea_State* T, tea_Writer writer, void* data);
+TEA_FUNC void tea_prof_free(tea_State* T);
+
+#define tea_prof_putlit(T, pb, s) (tea_prof_putmem(T, pb, "" s, sizeof(s) - 1))
+
+/*
+** Charge an allocation to the profiler. While no profile is running,
+** the countdown starts at SIZE_MAX and never runs out in practice
+*/
+#define tea_prof_alloc(T, size) \
+    { if(TEA_UNLIKELY((T)->gc.profleft <= (size))) tea_prof_sample(T, (size)); \
+      else (T)->gc.profleft -= (size); }
+
+#endif
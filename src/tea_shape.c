@@ -0,0 +1,162 @@
+/*
+** tea_shape.c
+** Instance attribute layouts (shapes)
+*/
+
+#define tea_shape_c
+#define TEA_CORE
+
+#include "tea_gc.h"
+#include "tea_tab.h"
+#include "tea_shape.h"
+#include "tea_str.h"
+
+/* -- Shapes -------------------------------------------------------------- */
+
+/* Create a new shape */
+static Shape* shape_new(tea_State* T, Shape* parent, GCstr* key)
+{
+    Shape* shape = (Shape*)tea_mem_new(T, sizeof(Shape));
+    shape->parent = parent;
+    shape->kids = NULL;
+    shape->next = NULL;
+    shape->key = key;
+    shape->nslots = parent ? parent->nslots + 1 : 0;
+    return shape;
+}
+
+/* Get the root shape of the instances of a class */
+Shape* tea_shape_root(tea_State* T, GCclass* klass)
+{
+    if(TEA_UNLIKELY(!klass->shape))
+    {
+        klass->shape = shape_new(T, NULL, NULL);
+        klass->nshapes = 1;
+    }
+    return klass->shape;
+}
+
+/*
+** Get the shape adding an attribute to a shape, following or creating
+** the transition. Returns NULL if the layout grew too large
+*/
+Shape* tea_shape_add(tea_State* T, GCclass* klass, Shape* shape, GCstr* key)
+{
+    Shape* kid;
+    key = tea_str_intern(T, key);
+    for(kid = shape->kids; kid != NULL; kid = kid->next)
+    {
+        if(kid->key == key)
+            return kid;
+    }
+    if(shape->nslots >= TEA_MAX_SHAPE || klass->nshapes >= TEA_MAX_SHAPES)
+        return NULL;
+    kid = shape_new(T, shape, key);
+    kid->next = shape->kids;
+    shape->kids = kid;
+    klass->nshapes++;
+    tea_gc_barrierback(T, obj2gco(klass));  /* The class marks the keys */
+    return kid;
+}
+
+/* Find the slot of an attribute in a shape, or -1 */
+int32_t tea_shape_find(Shape* shape, GCstr* key)
+{
+    for(; shape->key != NULL; shape = shape->parent)
+    {
+        if(tea_str_eqkey(shape->key, key))
+            return shape->nslots - 1;
+    }
+    return -1;
+}
+
+/* Free a shape and all its transitions */
+void tea_shape_free(tea_State* T, Shape* shape)
+{
+    Shape* kid = shape->kids;
+    while(kid != NULL)
+    {
+        Shape* next = kid->next;
+        tea_shape_free(T, kid);
+        kid = next;
+    }
+    tea_mem_free(T, shape, sizeof(Shape));
+}
+
+/* -- Instance attributes ------------------------------------------------- */
+
+/* Get an attribute of an instance */
+TValue* tea_instance_get(GCinstance* instance, GCstr* key)
+{
+    if(instance->shape)
+    {
+        int32_t slot = tea_shape_find(instance->shape, key);
+        return slot >= 0 ? &instance->slots[slot] : NULL;
+    }
+    return tea_tab_get(&instance->attrs, key);
+}
+
+/*
+** Move an instance to a shape with one more attribute.
+** Returns the new (nil) slot
+*/
+TValue* tea_instance_setshape(tea_State* T, GCinstance* instance, Shape* shape)
+{
+    uint32_t slot = shape->nslots - 1;
+    tea_assertT(shape->parent == instance->shape, "bad shape transition");
+    if(slot >= instance->size)
+    {
+        uint32_t size = instance->size < 4 ? 4 : instance->size * 2;
+        instance->slots = tea_mem_reallocvec(T, TValue, instance->slots, instance->size, size);
+        instance->size = size;
+    }
+    setnilV(&instance->slots[slot]);
+    instance->shape = shape;
+    return &instance->slots[slot];
+}
+
+/* Set an attribute of an instance */
+TValue* tea_instance_set(tea_State* T, GCinstance* instance, GCstr* key)
+{
+    if(instance->shape)
+    {
+        Shape* shape;
+        int32_t slot = tea_shape_find(instance->shape, key);
+        if(slot >= 0)
+            return &instance->slots[slot];
+        shape = tea_shape_add(T, instance->klass, instance->shape, key);
+        if(shape)
+            return tea_instance_setshape(T, instance, shape);
+        tea_instance_todict(T, instance);
+    }
+    return tea_tab_set(T, &instance->attrs, key);
+}
+
+/* Delete an attribute of an instance */
+bool tea_instance_delete(tea_State* T, GCinstance* instance, GCstr* key)
+{
+    if(instance->shape)
+    {
+        if(tea_shape_find(instance->shape, key) < 0)
+            return false;
+        tea_instance_todict(T, instance);
+    }
+    return tea_tab_delete(&instance->attrs, key);
+}
+
+/* Convert a shaped instance to a dictionary of attributes */
+void tea_instance_todict(tea_State* T, GCinstance* instance)
+{
+    Shape* shape = instance->shape;
+    tea_assertT(shape != NULL, "instance is not shaped");
+    /* The GC marks both the slots and the table during the conversion */
+    for(; shape->key != NULL; shape = shape->parent)
+    {
+        copyTV(T, tea_tab_set(T, &instance->attrs, shape->key),
+                &instance->slots[shape->nslots - 1]);
+    }
+    instance->shape = NULL;
+    tea_mem_freevec(T, TValue, instance->slots, instance->size);
+    instance->slots = NULL;
+    instance->size = 0;
+}
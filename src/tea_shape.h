@@ -0,0 +1,25 @@
+/*
+** tea_shape.h
+** Instance attribute layouts (shapes)
+*/
+
+#ifndef _TEA_SHAPE_H
+#define _TEA_SHAPE_H
+
+#include "tea_def.h"
+#include "tea_obj.h"
+
+/* Shapes */
+TEA_FUNC Shape* tea_shape_root(tea_State* T, GCclass* klass);
+TEA_FUNC Shape* tea_shape_add(tea_State* T, GCclass* klass, Shape* shape, GCstr* key);
+TEA_FUNC int32_t tea_shape_find(Shape* shape, GCstr* key);
+TEA_FUNC void tea_shape_free(tea_State* T, Shape* shape);
+
+/* Instance attributes */
+TEA_FUNC TValue* tea_instance_get(GCinstance* instance, GCstr* key);
+TEA_FUNC TValue* tea_instance_set(tea_State* T, GCinstance* instance, GCstr* key);
+TEA_FUNC TValue* tea_instance_setshape(tea_State* T, GCinstance* instance, Shape* shape);
+TEA_FUNC bool tea_instance_delete(tea_State* T, GCinstance* instance, GCstr* key);
+TEA_FUNC void tea_instance_todict(tea_State* T, GCinstance* instance);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+** tea_slab.c
+** Size-class slab allocator for small GC objects
+*/
+
+#define tea_slab_c
+#define TEA_CORE
+
+#include "tea_slab.h"
+#include "tea_err.h"
+
+/*
+** Small GC objects are carved out of fixed-size pages. Every page holds
+** objects of a single size class and starts with a header that keeps its
+** own free list, so allocating an object is a free list pop and freeing it
+** a push. The page of an object is found by masking its address, which
+** requires the pages to be aligned to their size. Pages are allocated in
+** chunks from the pluggable allocator and handed back once a whole chunk
+** is unused.
+*/
+
+#define SLAB_PAGEBITS 12
+#define SLAB_PAGESIZE (1u << SLAB_PAGEBITS)     /* 4 KB pages */
+#define SLAB_CHUNKPAGES 32  /* Pages per chunk */
+#define SLAB_CLASSBITS 4
+#define SLAB_HDRSIZE ((sizeof(SlabPage) + 15) & ~(size_t)15)
+
+#define slab_class(size) ((uint32_t)((size) - 1) >> SLAB_CLASSBITS)
+#define slab_size(cls) ((size_t)((cls) + 1) << SLAB_CLASSBITS)
+#define slab_page(p) ((SlabPage*)((uintptr_t)(p) & ~(uintptr_t)(SLAB_PAGESIZE - 1)))
+
+/* Chunk of pages */
+struct SlabChunk
+{
+    SlabChunk* next;    /* Next chunk */
+    char* mem;  /* Memory block as returned by the allocator */
+    uint32_t nfree;     /* Number of unused pages */
+};
+
+/* Page header */
+struct SlabPage
+{
+    SlabPage* next;     /* Next page in the class or unused page list */
+    SlabPage* prev;     /* Previous page in the class or unused page list */
+    SlabChunk* chunk;   /* Chunk holding the page */
+    void* free;     /* List of freed objects */
+    char* bump;     /* First never allocated object */
+    uint32_t used;  /* Number of allocated objects */
+    uint32_t cls;   /* Size class */
+};
+
+TEA_STATIC_ASSERT((TEA_SLAB_MAXSIZE >> SLAB_CLASSBITS) == TEA_SLAB_NCLASS);
+
+/* Check whether a page has no room left */
+static TEA_AINLINE bool slab_full(SlabPage* page)
+{
+    return page->free == NULL &&
+           page->bump + slab_size(page->cls) > (char*)page + SLAB_PAGESIZE;
+}
+
+/* Link a page at the head of a page list */
+static void slab_link(SlabPage** list, SlabPage* page)
+{
+    page->prev = NULL;
+    page->next = *list;
+    if(*list)
+        (*list)->prev = page;
+    *list = page;
+}
+
+/* Unlink a page from a page list */
+static void slab_unlink(SlabPage** list, SlabPage* page)
+{
+    if(page->prev)
+        page->prev->next = page->next;
+    else
+        *list = page->next;
+    if(page->next)
+        page->next->prev = page->prev;
+}
+
+/* Allocate a new chunk and add its pages to the unused page list */
+static void slab_newchunk(tea_State* T)
+{
+    SlabChunk* chunk = (SlabChunk*)T->allocf(T->allocd, NULL, 0, sizeof(SlabChunk));
+    if(chunk == NULL)
+        tea_err_mem(T);
+    /* One extra page of slack to align the pages */
+    char* mem = (char*)T->allocf(T->allocd, NULL, 0, (SLAB_CHUNKPAGES + 1) * SLAB_PAGESIZE);
+    if(mem == NULL)
+    {
+        T->allocf(T->allocd, chunk, sizeof(SlabChunk), 0);
+        tea_err_mem(T);
+    }
+    chunk->mem = mem;
+    chunk->nfree = SLAB_CHUNKPAGES;
+    chunk->next = T->gc.slabchunks;
+    T->gc.slabchunks = chunk;
+    char* p = (char*)slab_page(mem + SLAB_PAGESIZE - 1);
+    for(uint32_t i = 0; i < SLAB_CHUNKPAGES; i++, p += SLAB_PAGESIZE)
+    {
+        SlabPage* page = (SlabPage*)p;
+        page->chunk = chunk;
+        slab_link(&T->gc.slabfree, page);
+    }
+}
+
+/* Take an unused page for a size class */
+static SlabPage* slab_newpage(tea_State* T, uint32_t cls)
+{
+    if(T->gc.slabfree == NULL)
+        slab_newchunk(T);
+    SlabPage* page = T->gc.slabfree;
+    slab_unlink(&T->gc.slabfree, page);
+    page->chunk->nfree--;
+    page->free = NULL;
+    page->bump = (char*)page + SLAB_HDRSIZE;
+    page->used = 0;
+    page->cls = cls;
+    slab_link(&T->gc.slab[cls], page);
+    return page;
+}
+
+/* Allocate an object of at most TEA_SLAB_MAXSIZE bytes */
+void* tea_slab_alloc(tea_State* T, size_t size)
+{
+    tea_assertT(size > 0 && size <= TEA_SLAB_MAXSIZE, "bad slab object size");
+    uint32_t cls = slab_class(size);
+    SlabPage* page = T->gc.slab[cls];
+    if(TEA_UNLIKELY(page == NULL))
+        page = slab_newpage(T, cls);
+    void* p = page->free;
+    if(p != NULL)
+    {
+        page->free = *(void**)p;
+    }
+    else
+    {
+        p = page->bump;
+        page->bump += slab_size(cls);
+    }
+    page->used++;
+    if(slab_full(page))
+        slab_unlink(&T->gc.slab[cls], page);   /* Only pages with room are kept */
+    return p;
+}
+
+/* Free an object allocated with tea_slab_alloc */
+void tea_slab_free(tea_State* T, void* p, size_t size)
+{
+    SlabPage* page = slab_page(p);
+    tea_assertT(page->cls == slab_class(size), "bad slab object size");
+    UNUSED(size);
+    bool full = slab_full(page);
+    *(void**)p = page->free;
+    page->free = p;
+    if(--page->used == 0)
+    {
+        /* Give the page back to the unused page list */
+        if(!full)
+            slab_unlink(&T->gc.slab[page->cls], page);
+        page->chunk->nfree++;
+        slab_link(&T->gc.slabfree, page);
+    }
+    else if(full)
+    {
+        slab_link(&T->gc.slab[page->cls], page);
+    }
+}
+
+/* Release completely unused chunks */
+void tea_slab_shrink(tea_State* T)
+{
+    SlabChunk** pp = &T->gc.slabchunks;
+    SlabChunk* chunk;
+    while((chunk = *pp) != NULL)
+    {
+        if(chunk->nfree == SLAB_CHUNKPAGES)
+        {
+            char* p = (char*)slab_page(chunk->mem + SLAB_PAGESIZE - 1);
+            for(uint32_t i = 0; i < SLAB_CHUNKPAGES; i++, p += SLAB_PAGESIZE)
+            {
+                slab_unlink(&T->gc.slabfree, (SlabPage*)p);
+            }
+            *pp = chunk->next;
+            T->allocf(T->allocd, chunk->mem, (SLAB_CHUNKPAGES + 1) * SLAB_PAGESIZE, 0);
+            T->allocf(T->allocd, chunk, sizeof(SlabChunk), 0);
+        }
+        else
+        {
+            pp = &chunk->next;
+        }
+    }
+}
+
+/* Free all chunks */
+void tea_slab_freeall(tea_State* T)
+{
+    SlabChunk* chunk = T->gc.slabchunks;
+    while(chunk != NULL)
+    {
+        SlabChunk* next = chunk->next;
+        T->allocf(T->allocd, chunk->mem, (SLAB_CHUNKPAGES + 1) * SLAB_PAGESIZE, 0);
+        T->allocf(T->allocd, chunk, sizeof(SlabChunk), 0);
+        chunk = next;
+    }
+    T->gc.slabchunks = NULL;
+    T->gc.slabfree = NULL;
+    for(uint32_t i = 0; i < TEA_SLAB_NCLASS; i++)
+    {
+        T->gc.slab[i] = NULL;
+    }
+}
@@ -0,0 +1,17 @@
+/*
+** tea_slab.h
+** Size-class slab allocator for small GC objects
+*/
+
+#ifndef _TEA_SLAB_H
+#define _TEA_SLAB_H
+
+#include "tea_def.h"
+#include "tea_obj.h"
+
+TEA_FUNC void* tea_slab_alloc(tea_State* T, size_t size);
+TEA_FUNC void tea_slab_free(tea_State* T, void* p, size_t size);
+TEA_FUNC void tea_slab_shrink(tea_State* T);
+TEA_FUNC void tea_slab_freeall(tea_State* T);
+
+#endif
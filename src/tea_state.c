@@ -24,6 +24,9 @@
 #include "tea_map.h"
 #include "tea_func.h"
 #include "tea_import.h"
+#include "tea_slab.h"
+#include "tea_prof.h"
+#include "tea_pool.h"
 
 /* -- Stack handling -------------------------------------------------- */
 
@@ -162,6 +165,12 @@ static void cpteaopen(tea_State* T, void* ud)
 
 static void state_close(tea_State* T)
 {
+    if(T->allocf == tea_pool_alloc)
+    {
+        /* Everything but library handles lives in the pool, released by the caller */
+        tea_imp_freehandle(T);
+        return;
+    }
     tea_buf_free(T, &T->tmpbuf);
     tea_buf_free(T, &T->strbuf);
     tea_tab_free(T, &T->modules);
@@ -169,6 +178,8 @@ static void state_close(tea_State* T)
     tea_gc_freeall(T);
     tea_imp_freehandle(T);  /* Close pending library handles */
     tea_str_freetab(T);
+    tea_slab_freeall(T);
+    tea_prof_free(T);
     tea_mem_freevec(T, CallInfo, T->ci_base, T->ci_size);   /* Free CallInfo array */
     tea_mem_freevec(T, TValue, T->stack, T->stack_size);    /* Free stack array */
     tea_assertT(T->str.num == 0, "leaked %d strings", T->str.num);
@@ -186,10 +197,22 @@ TEA_API tea_State* tea_new_state(tea_Alloc allocf, void* ud)
     memset(T, 0, sizeof(*T));
     T->allocf = allocf;
     T->allocd = ud;
+    T->gc.los = (allocf == mem_alloc);  /* Custom allocators see every block */
     T->gc.next_gc = 1024 * 1024;
+    T->gc.currentwhite = TEA_GC_WHITE0;
+    T->gc.state = GCSpause;
+    T->gc.pause = TEA_GC_PAUSE;
+    T->gc.stepmul = TEA_GC_STEPMUL;
+    T->gc.minormul = TEA_GC_MINORMUL;
+    T->gc.majormul = TEA_GC_MAJORMUL;
+    T->gc.softlimit = SIZE_MAX;
+    T->gc.hardlimit = SIZE_MAX;
+    T->gc.memlimit = SIZE_MAX;
+    T->gc.profleft = SIZE_MAX;
     T->panic = panic;
     T->strempty.gct = TEA_TSTR;
     T->strempty.marked = TEA_GC_FIXED;
+    T->strempty.interned = 1;
     tea_buf_init(&T->tmpbuf);
     tea_buf_init(&T->strbuf);
     tea_tab_init(&T->modules);
@@ -205,6 +228,18 @@ TEA_API tea_State* tea_new_state(tea_Alloc allocf, void* ud)
     return T;
 }
 
+/* Create a state with its own pooled allocator, released at once on close */
+TEA_API tea_State* tea_new_pooled_state(void)
+{
+    Pool* pool = tea_pool_new();
+    if(pool == NULL)
+        return NULL;
+    tea_State* T = tea_new_state(tea_pool_alloc, pool);
+    if(T == NULL)
+        tea_pool_release(pool);
+    return T;
+}
+
 static void cpfinalize(tea_State* T, void* ud)
 {
     UNUSED(ud);
@@ -214,7 +249,7 @@ static void cpfinalize(tea_State* T, void* ud)
 TEA_API void tea_close(tea_State* T)
 {
     tea_func_closeuv(T, T->stack);
-    tea_gc_separateudata(T);
+    tea_gc_separateudata(T, true);
     do
     {
         T->ci = T->ci_base;
@@ -223,5 +258,8 @@ TEA_API void tea_close(tea_State* T)
     }
     while(tea_err_protected(T, cpfinalize, NULL) != 0);
     tea_assertT(T->gc.mmudata == NULL, "lost userdata finalizers");
+    Pool* pool = T->allocf == tea_pool_alloc ? (Pool*)T->allocd : NULL;
     state_close(T);
+    if(pool != NULL)
+        tea_pool_release(pool);
 }
\ No newline at end of file
@@ -45,21 +45,90 @@ GCstr* tea_str_slice(tea_State* T, GCstr* str, GCrange* range)
     }
     else
     {
-        return tea_str_new(T, str_data(str) + start, end - start);
+        return tea_str_sub(T, str, start, end - start);
     }
 }
 
 /* -- String hashing ------------------------------------------------------ */
 
+/*
+** Strings are hashed a 64 bit word at a time, with unaligned loads and
+** overlapping reads for the tail instead of a byte loop. Long strings
+** only have their head, their tail and words spread evenly across the
+** middle hashed, so hashing a huge string costs no more than a short
+** one. Strings which differ only in the skipped bytes share a hash and
+** fall back to the memcmp() in the interning table. The hash has no
+** random seed and is the same on every run
+*/
+
+#define STR_HASHK 0x9e3779b97f4a7c15ull
+#define STR_HASHFULL 256    /* Max. length of strings hashed in full */
+#define STR_HASHEDGE 64     /* Bytes hashed at each end of a long string */
+#define STR_HASHSAMPLES 16  /* Words sampled from the middle of a long string */
+
+static TEA_AINLINE uint64_t str_getu64(const char* p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static TEA_AINLINE uint32_t str_getu32(const char* p)
+{
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static TEA_AINLINE uint64_t str_mix(uint64_t h, uint64_t w)
+{
+    return ((h << 5) ^ (h >> 59) ^ w) * STR_HASHK;
+}
+
+/* Hash the words of a block of at least 8 bytes, the last one overlapping */
+static TEA_AINLINE uint64_t str_hashblock(uint64_t h, const char* p, uint32_t len)
+{
+    const char* e = p + len - 8;
+    for(; p < e; p += 8)
+        h = str_mix(h, str_getu64(p));
+    return str_mix(h, str_getu64(e));
+}
+
 static StrHash str_hash(const char* key, uint32_t len)
 {
-    StrHash hash = 2166136261u;
-    for(uint32_t i = 0; i < len; i++)
+    uint64_t h = STR_HASHK ^ len;
+    if(len >= 8)
     {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
+        if(TEA_LIKELY(len <= STR_HASHFULL))
+        {
+            h = str_hashblock(h, key, len);
+        }
+        else
+        {
+            uint32_t step = (len - 2 * STR_HASHEDGE) / (STR_HASHSAMPLES + 1);
+            const char* p = key + STR_HASHEDGE;
+            h = str_hashblock(h, key, STR_HASHEDGE);
+            for(uint32_t i = 0; i < STR_HASHSAMPLES; i++)
+            {
+                p += step;
+                h = str_mix(h, str_getu64(p));
+            }
+            h = str_hashblock(h, key + len - STR_HASHEDGE, STR_HASHEDGE);
+        }
     }
-    return hash;
+    else if(len >= 4)
+    {
+        h = str_mix(h, str_getu32(key) | ((uint64_t)str_getu32(key + len - 4) << 32));
+    }
+    else if(len > 0)
+    {
+        h = str_mix(h, (uint8_t)key[0] | ((uint32_t)(uint8_t)key[len >> 1] << 8) |
+                       ((uint32_t)(uint8_t)key[len - 1] << 16));
+    }
+    /* Fold the high bits into the low bits used by the hash tables */
+    h ^= h >> 32;
+    h *= STR_HASHK;
+    return (StrHash)(h ^ (h >> 29));
 }
 
 /* -- String interning ---------------------------------------------------- */
@@ -92,10 +161,12 @@ void tea_str_resize(tea_State* T, uint32_t newsize)
 /* Allocate a new string and add to string interning table */
 static GCstr* str_alloc(tea_State* T, const char* chars, uint32_t len, StrHash hash)
 {
-    GCstr* s = (GCstr*)tea_mem_new(T, tea_str_size(len));
+    GCstr* s = (GCstr*)tea_mem_allocgco(T, tea_str_size(len));
     s->gct = TEA_TSTR;
-    s->marked = 0;
+    s->marked = tea_gc_curwhite(T);
     s->reserved = 0;
+    s->interned = 1;
+    s->kind = STR_FLAT;
     s->len = len;
     s->hash = hash;
     memcpy(str_datawr(s), chars, len);
@@ -105,34 +176,74 @@ static GCstr* str_alloc(tea_State* T, const char* chars, uint32_t len, StrHash h
     s->nextgc = T->str.hash[hash];
     T->str.hash[hash] = obj2gco(s);
     T->str.num++;
-    if(T->str.num > T->str.size)
+    if(T->str.num > T->str.size && T->gc.state != GCSsweepstring)
     {
         tea_str_resize(T, T->str.size << 1);    /* Grow string hash table */
     }
     return s; /* Return newly interned string */
 }
 
-/* Intern a string and/or return string object */
+/* Find or create the interned string with the given contents */
+static GCstr* str_intern(tea_State* T, const char* chars, uint32_t len, StrHash hash)
+{
+    /* Check if the string has already been interned */
+    GCobj* obj = T->str.hash[hash & (T->str.size - 1)];
+    while(obj != NULL)
+    {
+        GCstr* sx = gco2str(obj);
+        if(sx->hash == hash && sx->len == len 
+            && memcmp(chars, str_data(sx), len) == 0)
+        {
+            if(isdead(T, obj))
+                flipwhite(obj);     /* Resurrect if dead */
+            return sx;  /* Return existing string */
+        }
+        obj = obj->gch.nextgc;
+    }
+    /* Otherwise allocate a new string */
+    return str_alloc(T, chars, len, hash);
+}
+
+/*
+** Create a string. Short strings are interned. Longer ones, usually file
+** contents or the results of buffers, are not. They skip the lookup in
+** the interning table and the growth of the table, and are linked into
+** the list of GC objects instead. They are interned on demand once they
+** are used as attribute keys (see tea_str_intern)
+*/
 GCstr* tea_str_new(tea_State* T, const char* chars, size_t lenx)
 {
     if(lenx - 1 < TEA_MAX_STR - 1)
     {
         uint32_t len = (uint32_t)lenx;
         StrHash hash = str_hash(chars, len);
-        /* Check if the string has already been interned */
-        GCobj* obj = T->str.hash[hash & (T->str.size - 1)];
-        while(obj != NULL)
-        {
-            GCstr* sx = gco2str(obj);
-            if(sx->hash == hash && sx->len == len 
-                && memcmp(chars, str_data(sx), len) == 0)
-            {
-                return sx;  /* Return existing string */
-            }
-            obj = obj->gch.nextgc;
-        }
-        /* Otherwise allocate a new string */
-        return str_alloc(T, chars, len, hash);
+        if(TEA_LIKELY(len <= TEA_MAX_SHORTSTR))
+            return str_intern(T, chars, len, hash);
+        GCstr* s = (GCstr*)tea_mem_newgco(T, tea_str_size(len), TEA_TSTR);
+        s->reserved = 0;
+        s->interned = 0;
+        s->kind = STR_FLAT;
+        s->len = len;
+        s->hash = hash;
+        memcpy(str_datawr(s), chars, len);
+        str_datawr(s)[len] = '\0';
+        return s;
+    }
+    else
+    {
+        if(lenx)
+            tea_err_msg(T, TEA_ERR_STROV);
+        return &T->strempty;
+    }
+}
+
+/* Create an interned string of any length */
+GCstr* tea_str_newintern(tea_State* T, const char* chars, size_t lenx)
+{
+    if(lenx - 1 < TEA_MAX_STR - 1)
+    {
+        uint32_t len = (uint32_t)lenx;
+        return str_intern(T, chars, len, str_hash(chars, len));
     }
     else
     {
@@ -142,10 +253,141 @@ GCstr* tea_str_new(tea_State* T, const char* chars, size_t lenx)
     }
 }
 
+/* Get the interned string with the contents of a string */
+GCstr* tea_str_intern(tea_State* T, GCstr* str)
+{
+    if(TEA_LIKELY(str->interned))
+        return str;
+    tea_str_flatten(T, str);
+    return str_intern(T, str_mem(str), str->len, str->hash);
+}
+
+/* -- Ropes --------------------------------------------------------------- */
+
+/*
+** Concatenations with a long result are deferred. The result is a rope
+** which only references its two parts, so appending to a string in a
+** loop no longer copies and hashes the whole string on every step. The
+** contents and the hash of a rope are unknown until tea_str_flatten()
+** copies the parts into a buffer and releases them. Whoever reads a
+** string which may be a rope, hashes it or uses it as a key flattens it
+** first, with a state at hand
+*/
+GCstr* tea_str_newrope(tea_State* T, GCstr* left, GCstr* right)
+{
+    size_t len = (size_t)left->len + right->len;
+    if(len >= TEA_MAX_STR)
+        tea_err_msg(T, TEA_ERR_STROV);
+    GCstr* s = (GCstr*)tea_mem_newgco(T, sizeof(GCstr) + sizeof(StrRope), TEA_TSTR);
+    s->reserved = 0;
+    s->interned = 0;
+    s->kind = STR_ROPE;
+    s->len = (uint32_t)len;
+    s->hash = 0;
+    StrRope* r = str_rope(s);
+    r->left = left;
+    r->right = right;
+    r->data = NULL;
+    return s;
+}
+
+/* Copy the contents of a rope, only recursing into the shorter part */
+static void str_ropecopy(char* p, GCstr* s)
+{
+    while(s->kind == STR_ROPE && str_rope(s)->data == NULL)
+    {
+        GCstr* left = str_rope(s)->left;
+        GCstr* right = str_rope(s)->right;
+        if(left->len <= right->len)
+        {
+            str_ropecopy(p, left);
+            p += left->len;
+            s = right;
+        }
+        else
+        {
+            str_ropecopy(p + left->len, right);
+            s = left;
+        }
+    }
+    memcpy(p, str_mem(s), s->len);
+}
+
+/* Flatten a rope, computing its hash */
+void tea_str_flattenrope(tea_State* T, GCstr* s)
+{
+    StrRope* r = str_rope(s);
+    char* p = tea_mem_newvec(T, char, s->len + 1);
+    str_ropecopy(p, s);
+    p[s->len] = '\0';
+    s->hash = str_hash(p, s->len);
+    r->data = p;
+    r->left = r->right = NULL;
+}
+
+/* -- Views --------------------------------------------------------------- */
+
+/*
+** Long parts of a string are views. A view only references the string
+** holding the contents, so splitting or slicing a large input copies
+** nothing. Views of a view share the contents of the original string.
+** A view is not terminated by a '\0', so internal users pass the length
+** along and read it through str_mem(), which keeps it shared. Users that
+** need a C string get one from tea_str_data(), which copies the view.
+** The GC copies the views of a string that is not reachable otherwise,
+** so a short part does not keep a large input alive
+*/
+GCstr* tea_str_sub(tea_State* T, GCstr* str, uint32_t start, uint32_t len)
+{
+    if(len == str->len)
+        return str;
+    tea_str_flatten(T, str);
+    const char* p = str_mem(str) + start;
+    if(len <= TEA_MAX_SHORTSTR)
+        return tea_str_new(T, p, len);
+    GCstr* parent = str;
+    if(str->kind == STR_VIEW && str_view(str)->parent != NULL)
+        parent = str_view(str)->parent;
+    GCstr* s = (GCstr*)tea_mem_newgco(T, sizeof(GCstr) + sizeof(StrView), TEA_TSTR);
+    s->reserved = 0;
+    s->interned = 0;
+    s->kind = STR_VIEW;
+    s->len = len;
+    s->hash = str_hash(p, len);
+    StrView* v = str_view(s);
+    v->parent = parent;
+    v->data = p;
+    return s;
+}
+
+/* Copy the contents of a view, releasing its parent */
+void tea_str_viewcopy(tea_State* T, GCstr* s)
+{
+    StrView* v = str_view(s);
+    char* p = tea_mem_newvec(T, char, s->len + 1);
+    memcpy(p, v->data, s->len);
+    p[s->len] = '\0';
+    v->data = p;
+    v->parent = NULL;
+}
+
 void TEA_FASTCALL tea_str_free(tea_State* T, GCstr* str)
 {
-    T->str.num--;
-    tea_mem_free(T, str, tea_str_size(str->len));
+    if(str->interned)
+        T->str.num--;
+    if(str->kind == STR_ROPE)
+    {
+        StrRope* r = str_rope(str);
+        if(r->data != NULL)
+            tea_mem_freevec(T, char, r->data, str->len + 1);
+    }
+    else if(str->kind == STR_VIEW)
+    {
+        StrView* v = str_view(str);
+        if(v->parent == NULL)
+            tea_mem_freevec(T, char, (char*)v->data, str->len + 1);
+    }
+    tea_mem_freegco(T, str, tea_str_objsize(str));
 }
 
 void TEA_FASTCALL tea_str_init(tea_State* T)
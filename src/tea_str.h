@@ -13,10 +13,16 @@
 
 /* String helpers */
 TEA_FUNC GCstr* tea_str_slice(tea_State* T, GCstr* str, GCrange* range);
+TEA_FUNC GCstr* tea_str_sub(tea_State* T, GCstr* str, uint32_t start, uint32_t len);
 
 /* String interning */
 TEA_FUNC void tea_str_resize(tea_State* T, uint32_t newsize);
 TEA_FUNC GCstr* tea_str_new(tea_State* T, const char* chars, size_t lenx);
+TEA_FUNC GCstr* tea_str_newintern(tea_State* T, const char* chars, size_t lenx);
+TEA_FUNC GCstr* tea_str_intern(tea_State* T, GCstr* str);
+TEA_FUNC GCstr* tea_str_newrope(tea_State* T, GCstr* left, GCstr* right);
+TEA_FUNC void tea_str_flattenrope(tea_State* T, GCstr* s);
+TEA_FUNC void tea_str_viewcopy(tea_State* T, GCstr* s);
 TEA_FUNC void TEA_FASTCALL tea_str_free(tea_State* T, GCstr* str);
 TEA_FUNC void TEA_FASTCALL tea_str_init(tea_State* T);
 
@@ -25,5 +31,44 @@ TEA_FUNC void TEA_FASTCALL tea_str_init(tea_State* T);
 #define tea_str_newlit(T, s) (tea_str_new(T, "" s, (sizeof(s)/sizeof(char))-1))
 #define tea_str_newlen(T, s) (tea_str_new(T, s, strlen(s)))
 #define tea_str_size(len) (sizeof(GCstr) + (len) + 1)
+#define tea_str_objsize(s) \
+    ((s)->kind == STR_FLAT ? tea_str_size((s)->len) : \
+     sizeof(GCstr) + ((s)->kind == STR_ROPE ? sizeof(StrRope) : sizeof(StrView)))
+
+/* Flatten a string if it is a rope, before reading or hashing it */
+static TEA_AINLINE GCstr* tea_str_flatten(tea_State* T, GCstr* s)
+{
+    if(TEA_UNLIKELY(str_isrope(s)))
+        tea_str_flattenrope(T, s);
+    return s;
+}
+
+/* Get the contents of a string terminated by a '\0', copying a view */
+static TEA_AINLINE const char* tea_str_data(tea_State* T, GCstr* s)
+{
+    tea_str_flatten(T, s);
+    if(TEA_UNLIKELY(str_isview(s)))
+        tea_str_viewcopy(T, s);
+    return str_data(s);
+}
+
+/* Compare the contents of two flattened strings */
+#define tea_str_eqdata(a, b) \
+    ((a)->len == (b)->len && str_hashval(a) == str_hashval(b) && \
+     memcmp(str_mem(a), str_mem(b), (a)->len) == 0)
+
+/* Compare two strings. Interned strings are equal only to themselves */
+static TEA_AINLINE bool tea_str_equal(tea_State* T, GCstr* a, GCstr* b)
+{
+    if(a == b)
+        return true;
+    if((a->interned & b->interned) || a->len != b->len)
+        return false;
+    return tea_str_eqdata(tea_str_flatten(T, a), tea_str_flatten(T, b));
+}
+
+/* Compare a key with an interned key */
+#define tea_str_eqkey(k, key) \
+    ((k) == (key) || (TEA_UNLIKELY(!(key)->interned) && tea_str_eqdata((k), (key))))
 
 #endif
\ No newline at end of file
@@ -179,9 +179,9 @@ const char* tea_strfmt_wstrnum(tea_State* T, cTValue* o, int* len)
     SBuf* sb;
     if(tvisstr(o))
     {
-        GCstr* str = strV(o);
+        GCstr* str = tea_str_flatten(T, strV(o));
         *len = str->len;
-        return str_data(str);
+        return str_mem(str);
     }
     else if(tvisnum(o))
     {
@@ -394,7 +394,7 @@ int tea_strfmt_putarg(tea_State* T, SBuf* sb, int arg, int retry)
     GCstr* fmt = tea_lib_checkstr(T, arg);
     FormatState fs;
     SFormat sf;
-    tea_strfmt_init(&fs, str_data(fmt), fmt->len);
+    tea_strfmt_init(&fs, str_mem(fmt), fmt->len);
     while((sf = strfmt_parse(&fs)) != STRFMT_EOF)
     {
         if(sf == STRFMT_LIT)
@@ -448,9 +448,9 @@ int tea_strfmt_putarg(tea_State* T, SBuf* sb, int arg, int retry)
                     }
                     if(TEA_LIKELY(tvisstr(o)))
                     {
-                        GCstr* str = strV(o);
+                        GCstr* str = tea_str_flatten(T, strV(o));
                         len = str->len;
-                        s = str_data(str);
+                        s = str_mem(str);
                     }
                     else if(tvisbuf(o))
                     {
@@ -576,7 +576,7 @@ end:
     }
     for(int i = 0; i < st->top; i++)
     {
-        if(tea_obj_rawequal(st->tvs[i], o))
+        if(tea_obj_rawequal(T, st->tvs[i], o))
             goto end;
     }
     if(st->top < TEA_MAX_SDEPTH)
@@ -102,7 +102,7 @@ static void strscan_double(uint64_t x, TValue* o, int32_t ex2, int32_t neg)
     n = (double)(int64_t)x;
     if(neg) n = -n;
     if(ex2) n = ldexp(n, ex2);
-    o->value.n = n;
+    setnumV(o, n);
 }
 
 /* Parse hexadecimal number */
@@ -234,7 +234,7 @@ static StrScanFmt strscan_dec(const uint8_t* p, TValue* o, StrScanFmt fmt, uint3
             {
                 n = (double)(int64_t)x;
                 if(neg) n = -n;
-                o->value.n = n;
+                setnumV(o, n);
                 return fmt;
             }
         }
@@ -250,15 +250,12 @@ static StrScanFmt strscan_dec(const uint8_t* p, TValue* o, StrScanFmt fmt, uint3
         /* Handle simple overflow/underflow */
         if(idig > 310 / 2)
         {
-            if(neg)
-                o->value.n = -INFINITY;
-            else
-                o->value.n = INFINITY;
+            setnumV(o, neg ? -INFINITY : INFINITY);
             return fmt;
         }
         else if(idig < -326 / 2)
         {
-            o->value.n = neg ? -0.0 : 0.0;
+            setnumV(o, neg ? -0.0 : 0.0);
             return fmt;
         }
 
@@ -397,11 +394,10 @@ StrScanFmt tea_strscan_scan(const uint8_t* p, size_t len, TValue* o, uint32_t op
         if(TEA_UNLIKELY(*p >= 'A'))
         {
             /* Parse "infinity" or "nan" */
-            TValue tmp;
-            tmp.value.n = NAN;
+            double n = NAN;
             if(casecmp(p[0], 'i') && casecmp(p[1], 'n') && casecmp(p[2], 'f'))
             {
-                if(neg) tmp.value.n = -INFINITY; else tmp.value.n = INFINITY;
+                n = neg ? -INFINITY : INFINITY;
                 p += 3;
                 if(casecmp(p[0], 'i') && casecmp(p[1], 'n') && casecmp(p[2], 'i') &&
                     casecmp(p[3], 't') && casecmp(p[4], 'y'))
@@ -414,7 +410,7 @@ StrScanFmt tea_strscan_scan(const uint8_t* p, size_t len, TValue* o, uint32_t op
             while(tea_char_isspace(*p)) p++;
             if(*p || p < pe)
                 return STRSCAN_ERROR;
-            o->value.n = tmp.value.n;
+            setnumV(o, n);
             return STRSCAN_NUM;
         }
     }
@@ -524,12 +520,12 @@ StrScanFmt tea_strscan_scan(const uint8_t* p, size_t len, TValue* o, uint32_t op
         {
             if((opt & STRSCAN_OPT_TONUM))
             {
-                o->value.n = neg ? -(double)x : (double)x;
+                setnumV(o, neg ? -(double)x : (double)x);
                 return STRSCAN_NUM;
             }
             else if(x == 0 && neg) 
             {
-                o->value.n = -0.0;
+                setnumV(o, -0.0);
                 return STRSCAN_NUM;
             } 
         }
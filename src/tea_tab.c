@@ -8,6 +8,7 @@
 
 #include "tea_gc.h"
 #include "tea_tab.h"
+#include "tea_str.h"
 
 /* Initialize a table */
 void tea_tab_init(Tab* tab)
@@ -29,7 +30,7 @@ void tea_tab_free(tea_State* T, Tab* tab)
 /* Find an entry in the table */
 static TabEntry* tab_findkey(TabEntry* entries, uint32_t size, GCstr* key)
 {
-    uint32_t idx = key->hash & (size - 1);
+    uint32_t idx = str_hashval(key) & (size - 1);
     TabEntry* tombstone = NULL;
 
     while(true)
@@ -49,7 +50,7 @@ static TabEntry* tab_findkey(TabEntry* entries, uint32_t size, GCstr* key)
                     tombstone = entry;
             }
         }
-        else if(entry->key == key)
+        else if(tea_str_eqkey(entry->key, key))
         {
             /* We found the key */
             return entry;
@@ -114,6 +115,7 @@ static void tab_resize(tea_State* T, Tab* tab, uint32_t size)
 /* Set a key in the table */
 TValue* tea_tab_set(tea_State* T, Tab* tab, GCstr* key)
 {
+    key = tea_str_intern(T, key);   /* Keys are unique, lookups may use any copy */
     if(tab->count + 1 > tab->size * TABLE_MAX_LOAD)
     {
         uint32_t size = TEA_MEM_GROW(tab->size);
@@ -154,6 +156,7 @@ TValue* tea_tab_getx(Tab* tab, GCstr* key, uint8_t* flags)
 /* Set a key in the table with accessor flags */
 TValue* tea_tab_setx(tea_State* T, Tab* tab, GCstr* key, uint8_t flags)
 {
+    key = tea_str_intern(T, key);
     if(tab->count + 1 > tab->size * TABLE_MAX_LOAD)
     {
         uint32_t size = TEA_MEM_GROW(tab->size);
@@ -12,14 +12,17 @@
 
 GCudata* tea_udata_new(tea_State* T, size_t len, uint8_t nuvals)
 {
-    GCudata* ud = (GCudata*)tea_mem_new(T, tea_udata_size(len, nuvals));
+    GCudata* ud = (GCudata*)tea_mem_allocgco(T, tea_udata_size(len, nuvals));
     ud->gct = TEA_TUDATA;
-    ud->marked = 0;
+    ud->marked = tea_gc_curwhite(T);
     ud->udtype = UDTYPE_USERDATA;
     ud->nuvals = nuvals;
     ud->len = len;
     ud->fd = NULL;
     ud->klass = gcroot_objclass(T);
+    ud->shape = NULL;
+    ud->slots = NULL;
+    ud->size = 0;
     tea_tab_init(&ud->attrs);
     TValue* uvs = ud_uvalues(ud);
     for(int i = 0; i < nuvals; i++)
@@ -34,5 +37,5 @@ void TEA_FASTCALL tea_udata_free(tea_State* T, GCudata* ud)
 {
     if(ud->fd) ud->fd(ud_data(ud));
     tea_tab_free(T, &ud->attrs);
-    tea_mem_free(T, ud, tea_udata_size(ud->len, ud->nuvals));
+    tea_mem_freegco(T, ud, tea_udata_size(ud->len, ud->nuvals));
 }
\ No newline at end of file
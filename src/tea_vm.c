@@ -21,6 +21,9 @@
 #include "tea_tab.h"
 #include "tea_list.h"
 #include "tea_meta.h"
+#include "tea_gc.h"
+#include "tea_buf.h"
+#include "tea_strfmt.h"
 
 /* Argument checking */
 static int vm_argcheck(tea_State* T, int nargs, int numparams, int numops, int varg)
@@ -122,6 +125,7 @@ static bool vm_call(tea_State* T, GCfunc* func, int nargs)
 /* Pre-call function */
 static bool vm_precall(tea_State* T, TValue* callee, int nargs)
 {
+    tea_gc_check(T);    /* Safe point: the callee and arguments are on the stack */
     switch(itype(callee))
     {
         case TEA_TMETHOD:
@@ -146,15 +150,16 @@ static bool vm_precall(tea_State* T, TValue* callee, int nargs)
     return false;   /* Unreachable */
 }
 
-/* Invoke a method or function */
-static bool vm_invoke(tea_State* T, TValue* obj, GCstr* name, int nargs)
+/* Invoke a method or function, through an inline cache site of pt */
+static bool vm_invoke(tea_State* T, GCproto* pt, uint8_t ic, TValue* obj, GCstr* name, int nargs)
 {
+    tea_gc_check(T);
     switch(itype(obj))
     {
         case TEA_TCLASS:
         {
             GCclass* klass = classV(obj);
-            uint8_t flags;
+            uint8_t flags = ACC_GET;
             TValue* mo = tea_tab_getx(&klass->methods, name, &flags);
             if(mo && (flags & ACC_STATIC))
             {
@@ -177,15 +182,22 @@ static bool vm_invoke(tea_State* T, TValue* obj, GCstr* name, int nargs)
         {
             GCinstance* instance = instanceV(obj);
             uint8_t flags = ACC_GET;
-            TValue* mo = tea_tab_get(&instance->attrs, name);
-            if(mo)
-            {
-                copyTV(T, T->top - nargs - 1, mo);
-                return vm_precall(T, mo, nargs);
-            }
-            mo = tea_tab_getx(&instance->klass->methods, name, &flags);
+            TValue* mo = tea_meta_icattr(T, pt, ic, instance, name, &flags, MM_GETATTR);
             if(mo)
             {
+                if(flags & ACC_SLOT)
+                {
+                    copyTV(T, T->top - nargs - 1, mo);
+                    return vm_precall(T, mo, nargs);
+                }
+                if(flags & ACC_MM)
+                {
+                    copyTV(T, T->top++, obj);
+                    setstrV(T, T->top++, name);
+                    tea_vm_call(T, mo, 1);
+                    copyTV(T, obj, T->top - 1); T->top--;
+                    return vm_precall(T, obj, nargs);
+                }
                 if(flags & ACC_GET)
                 {
                     copyTV(T, T->top++, obj);
@@ -195,15 +207,6 @@ static bool vm_invoke(tea_State* T, TValue* obj, GCstr* name, int nargs)
                 }
                 return vm_call(T, funcV(mo), nargs);
             }
-            mo = tea_meta_lookup(T, obj, MM_GETATTR);
-            if(mo)
-            {
-                copyTV(T, T->top++, obj);
-                setstrV(T, T->top++, name);
-                tea_vm_call(T, mo, 1);
-                copyTV(T, obj, T->top - 1); T->top--;
-                return vm_precall(T, obj, nargs);
-            }
             tea_err_callerv(T, TEA_ERR_METHOD, str_data(name));
         }
         default:
@@ -212,14 +215,15 @@ static bool vm_invoke(tea_State* T, TValue* obj, GCstr* name, int nargs)
             if(klass)
             {
                 uint8_t flags = ACC_GET;
-                TValue* mo = tea_tab_getx(&klass->methods, name, &flags);
+                TValue* mo = tea_meta_icget(T, pt, ic, klass, name, &flags, MM__MAX);
                 if(mo)
                 {
                     if(flags & ACC_GET)
                     {
                         copyTV(T, T->top++, obj);
                         tea_vm_call(T, mo, 0);
-                        copyTV(T, mo, T->top - 1); T->top--;
+                        copyTV(T, obj, T->top - 1); T->top--;
+                        return vm_precall(T, obj, nargs);
                     }
                     return vm_precall(T, mo, nargs);
                 }
@@ -262,10 +266,10 @@ static void vm_extend(tea_State* T, GClist* list, TValue* obj)
         }
         case TEA_TSTR:
         {
-            GCstr* str = strV(obj);
+            GCstr* str = tea_str_flatten(T, strV(obj));
             for(uint32_t i = 0; i < str->len; i++)
             {
-                GCstr* c = tea_str_new(T, str_data(str) + i, 1);
+                GCstr* c = tea_str_new(T, str_mem(str) + i, 1);
                 TValue tv;
                 setstrV(T, &tv, c);
                 tea_list_add(T, list, &tv);
@@ -323,6 +327,18 @@ static void vm_execute(tea_State* T)
 #define READ_CONSTANT() (proto_kgc(T->ci->func->t.pt, READ_BYTE()))
 #define READ_STRING() strV(READ_CONSTANT())
 
+#define GC_CHECK() \
+    do \
+    { \
+        if(tea_gc_due(T)) \
+        { \
+            STORE_FRAME; \
+            tea_gc_step(T); \
+            READ_FRAME(); \
+        } \
+    } \
+    while(false)
+
 #define RUNTIME_ERROR(...) \
     do \
     { \
@@ -354,6 +370,35 @@ static void vm_execute(tea_State* T)
     } \
     while(false)
 
+/* Rewrite a generic instruction to its number-number form */
+#define QUICKEN(qbc) \
+    do \
+    { \
+        if(tvisnum(T->top - 2) && tvisnum(T->top - 1)) \
+            ip[-1] = (qbc); \
+    } \
+    while(false)
+
+/* Quickened instruction, despecialized if an operand isn't a number */
+#define QUICK_OP(value_type, expr, gbc) \
+    do \
+    { \
+        TValue* v1 = T->top - 2; \
+        TValue* v2 = T->top - 1; \
+        if(TEA_LIKELY(tvisnum(v1) && tvisnum(v2))) \
+        { \
+            double b = numV(--T->top); \
+            double a = numV(T->top - 1); \
+            value_type(T->top - 1, expr); \
+        } \
+        else \
+        { \
+            ip[-1] = (gbc); \
+            ip--;   /* Retry as the generic instruction */ \
+        } \
+    } \
+    while(false)
+
 #define UNARY_OP(value_type, expr, opmm, type) \
     do \
     { \
@@ -372,6 +417,52 @@ static void vm_execute(tea_State* T)
     } \
     while(false)
 
+/*
+** Compare two locals and jump if false, leaving the falsy result
+** on the stack for the branch target to pop
+*/
+#define BRANCH_OP(op, opmm) \
+    do \
+    { \
+        TValue* o1 = base + READ_BYTE(); \
+        TValue* o2 = base + READ_BYTE(); \
+        uint16_t ofs = READ_SHORT(); \
+        if(TEA_LIKELY(tvisnum(o1) && tvisnum(o2))) \
+        { \
+            if(!(numV(o1) op numV(o2))) \
+            { \
+                setfalseV(T->top++); \
+                ip += ofs; \
+            } \
+        } \
+        else \
+        { \
+            TValue* v1 = T->top; \
+            TValue* v2 = T->top + 1; \
+            copyTV(T, T->top++, o1); \
+            copyTV(T, T->top++, o2); \
+            STORE_FRAME; \
+            if(!vm_arith(T, opmm, v1, v2)) \
+                tea_err_bioptype(T, v1, v2, opmm); \
+            READ_FRAME(); \
+            if(tea_obj_isfalse(T->top - 1)) \
+                ip += ofs; \
+            else \
+                T->top--; \
+        } \
+    } \
+    while(false)
+
+/* Check if a builtin iterator can run natively on a sequence */
+#define ITER_NATIVE(ffid, seq) \
+    (((ffid) == FF_ITER_LIST && tvislist(seq)) || \
+    ((ffid) == FF_ITER_MAP && tvismap(seq)) || \
+    ((ffid) == FF_ITER_STR && tvisstr(seq)))
+
+/* Check if a numeric for loop continues, like a range iterator */
+#define FOR_COND(idx, limit, step) \
+    ((step) > 0 ? (idx) < (limit) : (step) < 0 && (idx) > (limit))
+
 #ifdef TEA_COMPUTED_GOTO
     static void* dispatch[] = {
         #define BCGOTO(name, _, __) &&BC_##name,
@@ -463,9 +554,10 @@ static void vm_execute(tea_State* T)
         CASE_CODE(BC_INVOKE):
         {
             GCstr* method = READ_STRING();
+            uint8_t ic = READ_BYTE();
             uint8_t nargs = READ_BYTE();
             STORE_FRAME;
-            if(vm_invoke(T, T->top - 1 - nargs, method, nargs))
+            if(vm_invoke(T, curr_func(T)->t.pt, ic, T->top - 1 - nargs, method, nargs))
             {
                 (T->ci - 1)->state = (CIST_TEA | CIST_CALLING);
             }
@@ -486,6 +578,7 @@ static void vm_execute(tea_State* T)
             {
                 RUNTIME_ERROR(TEA_ERR_NONEW, str_data(klass->name));
             }
+            STORE_FRAME;
             if(tvisfunc(o) && !iscfunc(funcV(o)))
             {
                 setinstanceV(T, T->top - nargs - 1, tea_instance_new(T, klass));
@@ -494,7 +587,6 @@ static void vm_execute(tea_State* T)
             {
                 setclassV(T, T->top - nargs - 1, klass);
             }
-            STORE_FRAME;
             if(vm_precall(T, o, nargs))
             {
                 (T->ci - 1)->state = (CIST_TEA | CIST_CALLING);
@@ -506,16 +598,17 @@ static void vm_execute(tea_State* T)
         {
             GCstr* method = READ_STRING();
             uint8_t nargs = READ_BYTE();
+            GC_CHECK();
             GCclass* super = classV(--T->top);
             STORE_FRAME;
             TValue* mo = tea_tab_get(&super->methods, method);
-            if(TEA_LIKELY(mo && vm_call(T, funcV(mo), nargs)))
+            if(TEA_UNLIKELY(!mo))
             {
-                (T->ci - 1)->state = (CIST_TEA | CIST_CALLING);
+                RUNTIME_ERROR(TEA_ERR_METHOD, str_data(method));
             }
-            else
+            if(vm_call(T, funcV(mo), nargs))
             {
-                RUNTIME_ERROR(TEA_ERR_METHOD, str_data(method));
+                (T->ci - 1)->state = (CIST_TEA | CIST_CALLING);
             }
             READ_FRAME();
             DISPATCH();
@@ -543,21 +636,25 @@ static void vm_execute(tea_State* T)
         /* -- Arithmetic ops ------------------------------------------------ */
         CASE_CODE(BC_ADD):
         {
+            QUICKEN(BC_ADDNN);
             BINARY_OP(setnumV, (a + b), MM_PLUS, double);
             DISPATCH();
         }
         CASE_CODE(BC_SUB):
         {
+            QUICKEN(BC_SUBNN);
             BINARY_OP(setnumV, (a - b), MM_MINUS, double);
             DISPATCH();
         }
         CASE_CODE(BC_MUL):
         {
+            QUICKEN(BC_MULNN);
             BINARY_OP(setnumV, (a * b), MM_MULT, double);
             DISPATCH();
         }
         CASE_CODE(BC_DIV):
         {
+            QUICKEN(BC_DIVNN);
             BINARY_OP(setnumV, (a / b), MM_DIV, double);
             DISPATCH();
         }
@@ -578,7 +675,7 @@ static void vm_execute(tea_State* T)
                 if(!vm_arith(T, MM_EQ, a, b))
                 {
                     T->top -= 2;
-                    setboolV(T->top++, tea_obj_equal(a, b));
+                    setboolV(T->top++, tea_obj_equal(T, a, b));
                     DISPATCH();
                 }
                 READ_FRAME();
@@ -587,27 +684,31 @@ static void vm_execute(tea_State* T)
             else
             {
                 T->top -= 2;
-                setboolV(T->top++, tea_obj_equal(a, b));
+                setboolV(T->top++, tea_obj_equal(T, a, b));
             }
             DISPATCH();
         }
         CASE_CODE(BC_ISLT):
         {
+            QUICKEN(BC_ISLTNN);
             BINARY_OP(setboolV, (a < b), MM_LT, double);
             DISPATCH();
         }
         CASE_CODE(BC_ISLE):
         {
+            QUICKEN(BC_ISLENN);
             BINARY_OP(setboolV, (a <= b), MM_LE, double);
             DISPATCH();
         }
         CASE_CODE(BC_ISGT):
         {
+            QUICKEN(BC_ISGTNN);
             BINARY_OP(setboolV, (a > b), MM_GT, double);
             DISPATCH();
         }
         CASE_CODE(BC_ISGE):
         {
+            QUICKEN(BC_ISGENN);
             BINARY_OP(setboolV, (a >= b), MM_GE, double);
             DISPATCH();
         }
@@ -641,23 +742,27 @@ static void vm_execute(tea_State* T)
         {
             uint16_t ofs = READ_SHORT();
             ip -= ofs;
+            GC_CHECK();
             DISPATCH();
         }
         /* -- Collection ops ------------------------------------------------ */
         CASE_CODE(BC_LIST):
         {
+            STORE_FRAME;
             GClist* list = tea_list_new(T, 0);
             setlistV(T, T->top++, list);
             DISPATCH();
         }
         CASE_CODE(BC_MAP):
         {
+            STORE_FRAME;
             GCmap* map = tea_map_new(T);
             setmapV(T, T->top++, map);
             DISPATCH();
         }
         CASE_CODE(BC_LISTITEM):
         {
+            STORE_FRAME;
             GClist* list = listV(T->top - 2);
             cTValue* item = T->top - 1;
             tea_list_add(T, list, item);
@@ -666,6 +771,7 @@ static void vm_execute(tea_State* T)
         }
         CASE_CODE(BC_MAPFIELD):
         {
+            STORE_FRAME;
             GCmap* map = mapV(T->top - 3);
             TValue* key = T->top - 2;
             TValue* o = T->top - 1;
@@ -684,6 +790,7 @@ static void vm_execute(tea_State* T)
                 RUNTIME_ERROR(TEA_ERR_RANGE);
             }
 
+            STORE_FRAME;
             GCrange* r = tea_range_new(T, numV(a), numV(b), numV(c));
             setrangeV(T, T->top++, r);
             DISPATCH();
@@ -739,6 +846,7 @@ static void vm_execute(tea_State* T)
             {
                 if(i == rest_pos)
                 {
+                    STORE_FRAME;
                     GClist* rest_list = tea_list_new(T, 0);
                     setlistV(T, T->top++, rest_list);
                     int j;
@@ -794,8 +902,9 @@ static void vm_execute(tea_State* T)
         {
             TValue* obj = T->top - 1;
             GCstr* name = READ_STRING();
+            uint8_t ic = READ_BYTE();
             STORE_FRAME;
-            cTValue* o = tea_meta_getattr(T, name, obj);
+            cTValue* o = tea_meta_getattrx(T, curr_func(T)->t.pt, ic, name, obj);
             T->top--;
             copyTV(T, T->top++, o);
             READ_FRAME();
@@ -805,8 +914,9 @@ static void vm_execute(tea_State* T)
         {
             TValue* obj = T->top - 1;
             GCstr* name = READ_STRING();
+            uint8_t ic = READ_BYTE();
             STORE_FRAME;
-            cTValue* o = tea_meta_getattr(T, name, obj);
+            cTValue* o = tea_meta_getattrx(T, curr_func(T)->t.pt, ic, name, obj);
             copyTV(T, T->top++, o);
             READ_FRAME();
             DISPATCH();
@@ -814,10 +924,11 @@ static void vm_execute(tea_State* T)
         CASE_CODE(BC_SETATTR):
         {
             GCstr* name = READ_STRING();
+            uint8_t ic = READ_BYTE();
             TValue* obj = T->top - 2;
             TValue* item = T->top - 1;
             STORE_FRAME;
-            cTValue* o = tea_meta_setattr(T, name, obj, item);
+            cTValue* o = tea_meta_setattrx(T, curr_func(T)->t.pt, ic, name, obj, item);
             T->top -= 2;
             copyTV(T, T->top++, o);
             READ_FRAME();
@@ -865,6 +976,7 @@ static void vm_execute(tea_State* T)
             {
                 RUNTIME_ERROR(TEA_ERR_METHOD, str_data(name));
             }
+            STORE_FRAME;
             GCmethod* bound = tea_method_new(T, T->top - 1, funcV(o));
             T->top--;
             setmethodV(T, T->top++, bound);
@@ -895,21 +1007,25 @@ static void vm_execute(tea_State* T)
         CASE_CODE(BC_SETMODULE):
         {
             uint8_t slot = READ_BYTE();
-            TValue* vars = T->ci->func->t.module->vars;
-            copyTV(T, vars + slot, T->top - 1);
+            GCmodule* module = T->ci->func->t.module;
+            copyTV(T, module->vars + slot, T->top - 1);
+            tea_gc_barrierback(T, obj2gco(module));
             DISPATCH();
         }
         CASE_CODE(BC_DEFMODULE):
         {
             GCstr* name = READ_STRING();
-            copyTV(T, tea_tab_set(T,
-            &T->ci->func->t.module->exports, name), T->top - 1);
+            GCmodule* module = T->ci->func->t.module;
+            STORE_FRAME;
+            copyTV(T, tea_tab_set(T, &module->exports, name), T->top - 1);
+            tea_gc_barrierback(T, obj2gco(module));
             DISPATCH();
         }
         /* -- Closure and upvalue ops --------------------------------------- */
         CASE_CODE(BC_CLOSURE):
         {
             GCproto* pt = protoV(READ_CONSTANT());
+            STORE_FRAME;
             GCfunc* func = tea_func_newT(T, pt, &T->ci->func->t);
             setfuncV(T, T->top++, func);
             DISPATCH();
@@ -930,8 +1046,9 @@ static void vm_execute(tea_State* T)
         CASE_CODE(BC_SETUPVAL):
         {
             uint8_t slot = READ_BYTE();
-            TValue* o = T->ci->func->t.upvalues[slot]->location;
-            copyTV(T, o, T->top - 1);
+            GCupval* uv = T->ci->func->t.upvalues[slot];
+            copyTV(T, uv->location, T->top - 1);
+            tea_gc_barrieruv(T, uv, T->top - 1);
             DISPATCH();
         }
         /* -- Other ops ----------------------------------------------------- */
@@ -998,6 +1115,21 @@ static void vm_execute(tea_State* T)
             READ_FRAME();
             DISPATCH();
         }
+        CASE_CODE(BC_CONCAT):
+        {
+            uint8_t n = READ_BYTE();
+            STORE_FRAME;
+            SBuf* sb = tea_buf_tmp_(T);
+            for(TValue* o = T->top - n; o < T->top; o++)
+            {
+                ToStringState st; st.top = 0;
+                tea_strfmt_obj(T, sb, o, 0, &st);
+            }
+            GCstr* str = tea_buf_str(T, sb);
+            T->top -= n;
+            setstrV(T, T->top++, str);
+            DISPATCH();
+        }
         /* -- Bitwise ops --------------------------------------------------- */
         CASE_CODE(BC_BAND):
         {
@@ -1040,29 +1172,135 @@ static void vm_execute(tea_State* T)
             }
             else
             {
-                STORE_FRAME;
                 TValue* mo = tea_meta_lookup(T, seq, MM_ITER);
                 if(TEA_UNLIKELY(!mo))
                     RUNTIME_ERROR(TEA_ERR_ITER, tea_typename(seq));
+                if(tvisfunc(mo) && ITER_NATIVE(funcV(mo)->c.ffid, seq))
+                {
+                    setnumV(T->top++, 0);   /* Internal cursor */
+                    DISPATCH();
+                }
+                STORE_FRAME;
                 copyTV(T, T->top++, seq);
                 tea_vm_call(T, mo, 0);
                 READ_FRAME();
+                /* A number is reserved for the internal cursor */
+                if(TEA_UNLIKELY(tvisnum(T->top - 1)))
+                    RUNTIME_ERROR(TEA_ERR_CALL, tea_typename(T->top - 1));
             }
             DISPATCH();
         }
         CASE_CODE(BC_FORITER):
         {
-            uint8_t slot = READ_BYTE();    /* iter */
-            TValue* iter = base + slot;
-            STORE_FRAME;
-            copyTV(T, T->top++, iter);
-            tea_vm_call(T, iter, 0);
-            READ_FRAME();
+            TValue* o = base + READ_BYTE();    /* seq, iter */
+            uint8_t nvars = READ_BYTE();
+            uint16_t ofs = READ_SHORT();
+            if(tvisnum(o + 1))
+            {
+                /* Native iteration of a builtin type */
+                uint32_t idx = (uint32_t)numV(o + 1);
+                if(tvislist(o))
+                {
+                    GClist* list = listV(o);
+                    if(idx >= list->len)
+                    {
+                        ip += ofs;
+                        DISPATCH();
+                    }
+                    copyTV(T, T->top++, list_slot(list, idx));
+                }
+                else if(tvismap(o))
+                {
+                    GCmap* map = mapV(o);
+                    for(; idx < map->size && tvisnil(&map->entries[idx].key); idx++);
+                    if(idx >= map->size)
+                    {
+                        ip += ofs;
+                        DISPATCH();
+                    }
+                    if(nvars == 2)
+                    {
+                        /* Push the key and value, skipping the UNPACK */
+                        copyTV(T, T->top++, &map->entries[idx].key);
+                        copyTV(T, T->top++, &map->entries[idx].val);
+                        ip += 2;
+                    }
+                    else
+                    {
+                        STORE_FRAME;
+                        GClist* list = tea_list_new(T, 2);
+                        setlistV(T, T->top++, list);
+                        tea_list_add(T, list, &map->entries[idx].key);
+                        tea_list_add(T, list, &map->entries[idx].val);
+                    }
+                }
+                else
+                {
+                    STORE_FRAME;
+                    GCstr* str = tea_str_flatten(T, strV(o));
+                    if(idx >= str->len)
+                    {
+                        ip += ofs;
+                        DISPATCH();
+                    }
+                    setstrV(T, T->top++, tea_str_new(T, str_mem(str) + idx, 1));
+                }
+                setnumV(o + 1, idx + 1);
+            }
+            else
+            {
+                STORE_FRAME;
+                copyTV(T, T->top++, o + 1);
+                tea_vm_call(T, o + 1, 0);
+                READ_FRAME();
+                /* If nil it means the loop is over */
+                if(tvisnil(T->top - 1))
+                {
+                    T->top--;
+                    ip += ofs;
+                }
+            }
+            DISPATCH();
+        }
+        CASE_CODE(BC_FORPREP):
+        {
+            TValue* o = base + READ_BYTE();  /* idx, limit, step */
+            uint16_t ofs = READ_SHORT();
+            if(TEA_UNLIKELY(!tvisnum(o) || !tvisnum(o + 1) || !tvisnum(o + 2)))
+            {
+                RUNTIME_ERROR(TEA_ERR_RANGE);
+            }
+            if(FOR_COND(numV(o), numV(o + 1), numV(o + 2)))
+            {
+                copyTV(T, T->top++, o);
+                ip += 4;    /* Skip the FORLOOP that follows */
+            }
+            else
+            {
+                ip += ofs;
+            }
+            DISPATCH();
+        }
+        CASE_CODE(BC_FORLOOP):
+        {
+            TValue* o = base + READ_BYTE();  /* idx, limit, step */
+            uint16_t ofs = READ_SHORT();
+            double idx = numV(o) + numV(o + 2);
+            setnumV(o, idx);
+            if(FOR_COND(idx, numV(o + 1), numV(o + 2)))
+            {
+                setnumV(T->top++, idx);
+            }
+            else
+            {
+                ip += ofs;
+            }
             DISPATCH();
         }
         /* -- Class ops ----------------------------------------------------- */
         CASE_CODE(BC_CLASS):
         {
+            STORE_FRAME;
             GCclass* k = tea_class_new(T, READ_STRING());
             setclassV(T, T->top++, k);
             DISPATCH();
@@ -1073,8 +1311,11 @@ static void vm_execute(tea_State* T)
             uint8_t flags = READ_BYTE();
             TValue* mo = T->top - 1;
             GCclass* klass = classV(T->top - 2);
+            STORE_FRAME;
             copyTV(T, tea_tab_setx(T, &klass->methods, name, flags), mo);
             if(name == mmname_str(T, MM_NEW)) copyTV(T, &klass->init, mo);
+            tea_gc_barrierback(T, obj2gco(klass));
+            T->icepoch++;   /* Flush inline caches */
             T->top--;
             DISPATCH();
         }
@@ -1098,6 +1339,8 @@ static void vm_execute(tea_State* T)
             klass->super = superclass;
             klass->init = superclass->init;
             tea_tab_merge(T, &superclass->methods, &klass->methods);
+            tea_gc_barrierback(T, obj2gco(klass));
+            T->icepoch++;   /* Flush inline caches */
             T->top--;
             DISPATCH();
         }
@@ -1130,6 +1373,7 @@ static void vm_execute(tea_State* T)
         {
             tea_assertT(tvisstr(T->top - 1), "expected interpolated string");
             GCstr* path = strV(--T->top);
+            tea_str_data(T, path);  /* The path is used as a C string */
             STORE_FRAME;
             tea_imp_relative(T, T->ci->func->t.module->path, path);
             READ_FRAME();
@@ -1156,6 +1400,107 @@ static void vm_execute(tea_State* T)
             T->last_module = T->ci->func->t.module;
             DISPATCH();
         }
+        /* -- Quickened ops ------------------------------------------------- */
+        CASE_CODE(BC_ADDNN):
+        {
+            QUICK_OP(setnumV, (a + b), BC_ADD);
+            DISPATCH();
+        }
+        CASE_CODE(BC_SUBNN):
+        {
+            QUICK_OP(setnumV, (a - b), BC_SUB);
+            DISPATCH();
+        }
+        CASE_CODE(BC_MULNN):
+        {
+            QUICK_OP(setnumV, (a * b), BC_MUL);
+            DISPATCH();
+        }
+        CASE_CODE(BC_DIVNN):
+        {
+            QUICK_OP(setnumV, (a / b), BC_DIV);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISLTNN):
+        {
+            QUICK_OP(setboolV, (a < b), BC_ISLT);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISLENN):
+        {
+            QUICK_OP(setboolV, (a <= b), BC_ISLE);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISGTNN):
+        {
+            QUICK_OP(setboolV, (a > b), BC_ISGT);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISGENN):
+        {
+            QUICK_OP(setboolV, (a >= b), BC_ISGE);
+            DISPATCH();
+        }
+        /* -- Superinstructions --------------------------------------------- */
+        CASE_CODE(BC_GETLOCALATTR):
+        {
+            uint8_t slot = READ_BYTE();
+            GCstr* name = READ_STRING();
+            uint8_t ic = READ_BYTE();
+            TValue* obj = T->top;
+            copyTV(T, T->top++, base + slot);
+            STORE_FRAME;
+            cTValue* o = tea_meta_getattrx(T, curr_func(T)->t.pt, ic, name, obj);
+            T->top--;
+            copyTV(T, T->top++, o);
+            READ_FRAME();
+            DISPATCH();
+        }
+        CASE_CODE(BC_INCLOCAL):
+        {
+            uint8_t slot = READ_BYTE();
+            TValue* k = READ_CONSTANT();
+            TValue* o = base + slot;
+            if(TEA_LIKELY(tvisnum(o) && tvisnum(k)))
+            {
+                setnumV(o, numV(o) + numV(k));
+            }
+            else
+            {
+                TValue* v1 = T->top;
+                TValue* v2 = T->top + 1;
+                copyTV(T, T->top++, o);
+                copyTV(T, T->top++, k);
+                STORE_FRAME;
+                if(!vm_arith(T, MM_PLUS, v1, v2))
+                    tea_err_bioptype(T, v1, v2, MM_PLUS);
+                READ_FRAME();
+                T->top--;
+                copyTV(T, base + slot, T->top);
+            }
+            DISPATCH();
+        }
+
+        CASE_CODE(BC_ISLTJMP):
+        {
+            BRANCH_OP(<, MM_LT);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISLEJMP):
+        {
+            BRANCH_OP(<=, MM_LE);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISGTJMP):
+        {
+            BRANCH_OP(>, MM_GT);
+            DISPATCH();
+        }
+        CASE_CODE(BC_ISGEJMP):
+        {
+            BRANCH_OP(>=, MM_GE);
+            DISPATCH();
+        }
         /* -- Special cases ------------------------------------------------- */
         CASE_CODE(BC_DEFOPT):
         {
@@ -1201,7 +1546,7 @@ static void vm_execute(tea_State* T)
             TValue* case_value = --T->top;
             for(int i = 0; i < count; i++)
             {
-                if(tea_obj_equal(switch_value, case_value))
+                if(tea_obj_equal(T, switch_value, case_value))
                 {
                     i++;
                     while(i <= count)
@@ -1220,7 +1565,7 @@ static void vm_execute(tea_State* T)
         {
             uint16_t ofs = READ_SHORT();
             TValue* o = --T->top;
-            if(!tea_obj_equal(T->top - 1, o))
+            if(!tea_obj_equal(T, T->top - 1, o))
             {
                 ip += ofs;
             }
@@ -1243,8 +1588,14 @@ static void vm_execute(tea_State* T)
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef QUICKEN
+#undef QUICK_OP
+#undef BRANCH_OP
+#undef ITER_NATIVE
+#undef FOR_COND
 #undef BINARY_OP_FUNCTION
 #undef RUNTIME_ERROR
+#undef GC_CHECK
 
 void tea_vm_call(tea_State* T, TValue* func, int nargs)
 {
@@ -16,6 +16,7 @@
 #define TEA_MODULE_RANDOM "random"
 #define TEA_MODULE_DEBUG "debug"
 #define TEA_MODULE_UTF8 "utf8"
+#define TEA_MODULE_GC "gc"
 
 #define TEA_CLASS_LIST "List"
 #define TEA_CLASS_MAP "Map"
@@ -31,6 +32,7 @@ TEAMOD_API void tea_import_io(tea_State* T);
 TEAMOD_API void tea_import_random(tea_State* T);
 TEAMOD_API void tea_import_debug(tea_State* T);
 TEAMOD_API void tea_import_utf8(tea_State* T);
+TEAMOD_API void tea_import_gc(tea_State* T);
 
 TEAMOD_API void tea_open_list(tea_State* T);
 TEAMOD_API void tea_open_map(tea_State* T);
@@ -32,15 +32,15 @@ from os.path import relpath
 # language's performance for a given benchmark. It compares by running time
 # and score, which is just the inverse running time.
 #
-# For Wren benchmarks, it can also compare against a "baseline". That's a
-# recorded result of a previous run of the Wren benchmarks. This is useful --
-# critical, actually -- for seeing how Wren performance changes. Generating a
+# For Teascript benchmarks, it can also compare against a "baseline". That's a
+# recorded result of a previous run of the Teascript benchmarks. This is
+# useful -- critical, actually -- for seeing how Teascript performance changes. Generating a
 # set of baselines before a change to the VM and then comparing those to the
 # performance after a change is how we track improvements and regressions.
 #
 # To generate a baseline file, run this script with "--generate-baseline".
 
-BENCHMARK_DIR = os.path.join('test', 'benchmark')
+BENCHMARK_DIR = 'benchmark'
 BENCHMARK_DIR = relpath(BENCHMARK_DIR).replace("\\", "/")
 
 # How many times to run a given benchmark.
@@ -49,30 +49,13 @@ NUM_TRIALS = 10
 BENCHMARKS = []
 
 def BENCHMARK(name, pattern):
-    regex = re.compile(pattern + "\n" + r"elapsed: (\d+\.\d+)", re.MULTILINE)
+    if pattern:
+        pattern += "\n"
+    regex = re.compile(pattern + r"elapsed: (\d+\.\d+)", re.MULTILINE)
     BENCHMARKS.append([name, regex, None])
 
-BENCHMARK("api_call", "true")
-
-BENCHMARK("api_foreign_method", "100000000")
-
-BENCHMARK("binary_trees", """stretch tree of depth 13 check: -1
-8192 trees of depth 4 check: -8192
-2048 trees of depth 6 check: -2048
-512 trees of depth 8 check: -512
-128 trees of depth 10 check: -128
-32 trees of depth 12 check: -32
-long lived tree of depth 12 check: -1""")
-
-BENCHMARK("binary_trees_gc", """stretch tree of depth 13 check: -1
-8192 trees of depth 4 check: -8192
-2048 trees of depth 6 check: -2048
-512 trees of depth 8 check: -512
-128 trees of depth 10 check: -128
-32 trees of depth 12 check: -32
-long lived tree of depth 12 check: -1""")
-
-BENCHMARK("delta_blue", "14065400")
+BENCHMARK("fannkuch", r"""8629
+fannkuchen\(9\) = 30""")
 
 BENCHMARK("fib", r"""317811
 317811
@@ -82,14 +65,9 @@ BENCHMARK("fib", r"""317811
 
 BENCHMARK("for", r"""499999500000""")
 
-BENCHMARK("method_call", r"""true
-false""")
-
-BENCHMARK("map_numeric", r"""2000001000000""")
-
-BENCHMARK("map_string", r"""12799920000""")
+BENCHMARK("sort", "")
 
-BENCHMARK("string_equals", r"""3000000""")
+BENCHMARK("strhash", r"""76000000""")
 
 LANGUAGES = [
     ("tea",            ['tea'],                          ".tea"),
@@ -195,7 +173,7 @@ def run_benchmark_language(benchmark, language, benchmark_result):
     score = get_score(best)
 
     comparison = ""
-    if language[0] == "wren":
+    if language[0] == "tea":
         if benchmark[2] != None:
             ratio = 100 * score / benchmark[2]
             comparison =  "{:6.2f}% relative to baseline".format(ratio)
@@ -203,12 +181,12 @@ def run_benchmark_language(benchmark, language, benchmark_result):
                 comparison = green(comparison)
             if ratio < 95:
                 comparison = red(comparison)
-            else:
-                comparison = "no baseline"
+        else:
+            comparison = "no baseline"
     else:
-        # Hack: assumes wren gets run first.
-        wren_score = benchmark_result["wren"]["score"]
-        ratio = 100.0 * wren_score / score
+        # Hack: assumes tea gets run first.
+        tea_score = benchmark_result["tea"]["score"]
+        ratio = 100.0 * tea_score / score
         comparison =  "{:6.2f}%".format(ratio)
         if ratio > 105:
             comparison = green(comparison)
@@ -319,18 +297,19 @@ def print_html():
             time = float(min(result["times"]))
             ratio = int(100 * time / highest)
             css_class = "chart-bar"
-            if language == "wren":
-                    css_class += " wren"
+            if language == "tea":
+                    css_class += " tea"
             print('  <tr>')
             print('    <th>{}</th><td><div class="{}" style="width: {}%;">{:4.2f}s&nbsp;</div></td>'.format(
                 language, css_class, ratio, time))
             print('  </tr>')
         print('</table>')
 
-    print_benchmark("method_call", "Method Call")
-    print_benchmark("delta_blue", "DeltaBlue")
-    print_benchmark("binary_trees", "Binary Trees")
+    print_benchmark("fannkuch", "Fannkuch")
     print_benchmark("fib", "Recursive Fibonacci")
+    print_benchmark("for", "For Loop")
+    print_benchmark("sort", "Sort")
+    print_benchmark("strhash", "String Hashing")
 
 
 def main():
@@ -16,6 +16,8 @@ import platform
 
 parser = ArgumentParser()
 parser.add_argument('--suffix', default='')
+parser.add_argument('--pooled', action='store_true',
+    help='run every test on a pooled state (tea -P)')
 parser.add_argument('suite', nargs='?')
 
 args = parser.parse_args(sys.argv[1:])
@@ -33,6 +35,7 @@ STACK_TRACE_PATTERN = re.compile(r'\[line (\d+)\]')
 STDIN_PATTERN = re.compile(r'// stdin: (.*)')
 SKIP_PATTERN = re.compile(r'// skip: (.*)')
 NONTEST_PATTERN = re.compile(r'// nontest')
+POOLED_PATTERN = re.compile(r'// pooled')
 
 passed = 0
 failed = 0
@@ -49,6 +52,7 @@ class Test:
         self.runtime_error_message = None
         self.exit_code = 0
         self.input_bytes = None
+        self.pooled = args.pooled
         self.failures = []
 
 
@@ -110,6 +114,10 @@ class Test:
                 if match:
                     input_lines.append(match.group(1))
 
+                match = POOLED_PATTERN.search(line)
+                if match:
+                    self.pooled = True
+
                 match = SKIP_PATTERN.search(line)
                 if match:
                     num_skipped += 1
@@ -135,7 +143,8 @@ class Test:
     def run(self, app, type):
         # Invoke wren and run the test.
         test_arg = self.path
-        proc = Popen([app, test_arg], stdin=PIPE, stdout=PIPE, stderr=PIPE)
+        options = ['-P'] if self.pooled else []
+        proc = Popen([app] + options + [test_arg], stdin=PIPE, stdout=PIPE, stderr=PIPE)
 
         # If a test takes longer than five seconds, kill it.
         #